@@ -94,8 +94,11 @@
 #define configCPU_CLOCK_HZ                  ( ( unsigned long ) 80000000 )
 #define configTICK_RATE_HZ                  ( ( portTickType ) 1000 )
 #define configMINIMAL_STACK_SIZE            ( ( unsigned short ) 200 )
-/* Heap size in bytes; 20,000 of 32,768 available bytes in SRAM */
-#define configTOTAL_HEAP_SIZE               ( ( size_t ) ( 20000 ) )
+/* Heap size in bytes; 16,000 of 32,768 available bytes in SRAM. The task
+ * stacks and control blocks, mutexes and channel data need under half of
+ * it (the free heap is printed with the stack watermarks); the rest of
+ * SRAM holds the static buffers. */
+#define configTOTAL_HEAP_SIZE               ( ( size_t ) ( 16000 ) )
 #define configMAX_TASK_NAME_LEN             ( 12 )
 #define configUSE_TRACE_FACILITY            1
 #define configUSE_16_BIT_TICKS              0
@@ -0,0 +1,407 @@
+/*
+ * budget.c
+ * The cellular data budget meter (see budget.h). The Modem UART task counts
+ * bytes as it writes them, and the Data task calls vBudgetUpdate() once per
+ * second to roll the day over, pick the throttle level, update the usage
+ * channels and save the counters.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef STORE_HOST_EMULATOR
+#include "host/flash_emu.h"
+#else
+#include "driverlib/flash.h"
+#endif
+#include "budget.h"
+#include "channel.h"
+#include "clock_sync.h"
+#include "debug_helper.h"
+#include "hibernate_rtc.h"
+#include "profile.h"
+#include "store.h"
+#include "store_task.h"
+#include "uplink.h"
+#include "urgent.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+#define BUDGET_S_PER_DAY                86400
+/* Value of flash that has been erased but not programmed */
+#define BUDGET_ERASED_WORD              0xFFFFFFFF
+
+
+/* What is saved to flash. The check word is the sum of the others, and is
+ * programmed last, so a snapshot cut short by a reset is never used. */
+typedef struct {
+    uint32_t ulMagic;
+    uint32_t ulSeq;
+    uint32_t ulDay;
+    uint32_t ulDailyKB;
+    uint32_t pulBytes[BUDGET_COUNTERS];
+    uint32_t pulHistoryKB[BUDGET_HISTORY_DAYS];
+    uint32_t ulCheck;
+} BudgetSnapshot_t;
+
+#define BUDGET_SNAPSHOT_WORDS           ( sizeof(BudgetSnapshot_t) / 4 )
+#define BUDGET_SLOTS_PER_BLOCK          ( STORE_SECTOR_BYTES / \
+                                          sizeof(BudgetSnapshot_t) )
+
+
+/* The counters, added to by the Modem UART task and reset by the Data task,
+ * both only in critical sections (see BudgetAdd()). */
+static volatile uint32_t pulBytes[BUDGET_COUNTERS];
+static uint32_t pulHistoryKB[BUDGET_HISTORY_DAYS];
+/* The day being counted, or 0 until the RTC has been set or a snapshot
+ * restored */
+static uint32_t ulDay = 0;
+static volatile uint32_t ulDailyKB = BUDGET_DEFAULT_DAILY_KB;
+static volatile uint8_t ucLevel = BUDGET_LEVEL_NONE;
+
+/* Flash block and slot the next snapshot goes to, and its sequence number */
+static uint32_t ulSaveBlock = 0;
+static uint32_t ulSaveSlot = 0;
+static uint32_t ulSaveSeq = 1;
+/* Seconds until the next save */
+static uint32_t ulSaveCountdown = BUDGET_SAVE_INTERVAL_S;
+
+
+/*
+ * Returns the flash address of a snapshot slot.
+ */
+static uint32_t BudgetSlotAddress(uint32_t ulBlock, uint32_t ulSlot) {
+    return BUDGET_FLASH_BASE + ulBlock * STORE_SECTOR_BYTES +
+           ulSlot * sizeof(BudgetSnapshot_t);
+}
+
+/*
+ * Returns the check word of a snapshot.
+ */
+static uint32_t BudgetCheck(const BudgetSnapshot_t *pxSnapshot) {
+    const uint32_t *pulWords = (const uint32_t *)pxSnapshot;
+    uint32_t ulSum = 0;
+    uint32_t i;
+
+    for (i = 0; i < BUDGET_SNAPSHOT_WORDS - 1; i++) {
+        ulSum += pulWords[i];
+    }
+
+    return ulSum;
+}
+
+/*
+ * Writes the counters to the next slot, moving to the other block (and
+ * erasing it) when this one is full. The flash controller is shared with the
+ * flash log, so the log's lock is held throughout.
+ */
+static void BudgetSave(void) {
+    BudgetSnapshot_t xSnapshot;
+    uint32_t i;
+
+    vStoreTaskLockFlash();
+
+    if (ulSaveSlot >= BUDGET_SLOTS_PER_BLOCK) {
+        ulSaveBlock ^= 1;
+        ulSaveSlot = 0;
+        if (FlashErase(BudgetSlotAddress(ulSaveBlock, 0)) != 0) {
+            vStoreTaskUnlockFlash();
+            debug_print("budget: erase failed\n");
+            return;
+        }
+    }
+
+    xSnapshot.ulMagic = BUDGET_MAGIC;
+    xSnapshot.ulSeq = ulSaveSeq;
+    xSnapshot.ulDay = ulDay;
+    xSnapshot.ulDailyKB = ulDailyKB;
+    for (i = 0; i < BUDGET_COUNTERS; i++) {
+        xSnapshot.pulBytes[i] = pulBytes[i];
+    }
+    memcpy(xSnapshot.pulHistoryKB, pulHistoryKB, sizeof(pulHistoryKB));
+    xSnapshot.ulCheck = BudgetCheck(&xSnapshot);
+
+    if (FlashProgram((uint32_t *)&xSnapshot,
+                     BudgetSlotAddress(ulSaveBlock, ulSaveSlot),
+                     sizeof(xSnapshot)) != 0) {
+        debug_print("budget: save failed\n");
+    }
+
+    vStoreTaskUnlockFlash();
+
+    /* A failed slot is skipped rather than programmed twice. */
+    ulSaveSlot++;
+    ulSaveSeq++;
+}
+
+/*
+ * Starts counting a new day, shifting the link totals into the history.
+ */
+static void BudgetNewDay(uint32_t ulNewDay) {
+    uint32_t ulDays = ulDay ? ulNewDay - ulDay : BUDGET_HISTORY_DAYS;
+    uint32_t i;
+
+    if (ulDays > BUDGET_HISTORY_DAYS) {
+        ulDays = BUDGET_HISTORY_DAYS;
+    }
+
+    for (i = BUDGET_HISTORY_DAYS; i-- > ulDays; ) {
+        pulHistoryKB[i] = pulHistoryKB[i - ulDays];
+    }
+    for (i = 0; i < ulDays; i++) {
+        pulHistoryKB[i] = 0;
+    }
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < BUDGET_COUNTERS; i++) {
+        pulBytes[i] = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    ulDay = ulNewDay;
+}
+
+/*
+ * Returns the throttle level for the day's usage so far.
+ */
+static uint8_t BudgetLevel(void) {
+    uint64_t ullPercent;
+
+    if (!ulDailyKB) {
+        return BUDGET_LEVEL_NONE;
+    }
+
+    ullPercent = (uint64_t)pulBytes[BUDGET_COUNTER_LINK] * 100 /
+                 ((uint64_t)ulDailyKB * 1024);
+
+    if (ullPercent >= 100) {
+        return BUDGET_LEVEL_EXHAUSTED;
+    }
+    if (ullPercent >= BUDGET_COARSE_PERCENT) {
+        return BUDGET_LEVEL_COARSE;
+    }
+    if (ullPercent >= BUDGET_RATES_PERCENT) {
+        return BUDGET_LEVEL_RATES;
+    }
+    if (ullPercent >= BUDGET_DEADBANDS_PERCENT) {
+        return BUDGET_LEVEL_DEADBANDS;
+    }
+
+    return BUDGET_LEVEL_NONE;
+}
+
+/*
+ * Restores the newest snapshot in flash, and picks the slot after it for the
+ * next one. Must be called before the scheduler starts.
+ */
+void vBudgetInit(void) {
+    const BudgetSnapshot_t *pxSnapshot;
+    const BudgetSnapshot_t *pxNewest = NULL;
+    uint32_t ulBlock;
+    uint32_t ulSlot;
+    uint32_t i;
+
+    for (ulBlock = 0; ulBlock < 2; ulBlock++) {
+        for (ulSlot = 0; ulSlot < BUDGET_SLOTS_PER_BLOCK; ulSlot++) {
+            pxSnapshot = (const BudgetSnapshot_t *)STORE_FLASH_POINTER(
+                             BudgetSlotAddress(ulBlock, ulSlot));
+
+            if (pxSnapshot->ulMagic != BUDGET_MAGIC ||
+                pxSnapshot->ulCheck != BudgetCheck(pxSnapshot)) {
+                continue;
+            }
+
+            if (!pxNewest || pxSnapshot->ulSeq > pxNewest->ulSeq) {
+                pxNewest = pxSnapshot;
+                ulSaveBlock = ulBlock;
+                ulSaveSlot = ulSlot + 1;
+            }
+        }
+    }
+
+    if (!pxNewest) {
+        /* Nothing saved yet, so the first snapshot starts a fresh block. */
+        ulSaveBlock = 1;
+        ulSaveSlot = BUDGET_SLOTS_PER_BLOCK;
+        debug_print("budget: no saved counters\n");
+        return;
+    }
+
+    ulSaveSeq = pxNewest->ulSeq + 1;
+    ulDay = pxNewest->ulDay;
+    ulDailyKB = pxNewest->ulDailyKB;
+    for (i = 0; i < BUDGET_COUNTERS; i++) {
+        pulBytes[i] = pxNewest->pulBytes[i];
+    }
+    memcpy(pulHistoryKB, pxNewest->pulHistoryKB, sizeof(pulHistoryKB));
+
+    /* A slot after the newest snapshot may have been partly programmed. */
+    for (ulSlot = ulSaveSlot; ulSlot < BUDGET_SLOTS_PER_BLOCK; ulSlot++) {
+        pxSnapshot = (const BudgetSnapshot_t *)STORE_FLASH_POINTER(
+                         BudgetSlotAddress(ulSaveBlock, ulSlot));
+        if (pxSnapshot->ulMagic == BUDGET_ERASED_WORD &&
+            pxSnapshot->ulCheck == BUDGET_ERASED_WORD) {
+            break;
+        }
+    }
+    ulSaveSlot = ulSlot;
+
+    debug_print("budget: day %d, %d link bytes\n", ulDay,
+                pulBytes[BUDGET_COUNTER_LINK]);
+}
+
+/*
+ * Adds to a counter. The read-modify-write is done in a critical section, so
+ * a new day's reset can't fall between the read and the write and be undone
+ * by writing back the old total.
+ */
+static void BudgetAdd(uint32_t ulCounter, uint32_t ulBytes) {
+    taskENTER_CRITICAL();
+    pulBytes[ulCounter] += ulBytes;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Counts the bytes of a record sent on the TCP stream against its stream
+ * (see uplink.h), or against BUDGET_COUNTER_OTHER if it has none.
+ */
+void vBudgetCountRecord(uint8_t ucStream, uint32_t ulBytes) {
+    if (ucStream >= UPLINK_STREAM_COUNT) {
+        ucStream = BUDGET_COUNTER_OTHER;
+    }
+    BudgetAdd(ucStream, ulBytes);
+}
+
+/*
+ * Counts stream packet bytes written to the modem.
+ */
+void vBudgetCountLink(uint32_t ulBytes) {
+    BudgetAdd(BUDGET_COUNTER_LINK, ulBytes);
+}
+
+/*
+ * Counts AT command bytes written to the modem.
+ */
+void vBudgetCountCommand(uint32_t ulBytes) {
+    BudgetAdd(BUDGET_COUNTER_COMMANDS, ulBytes);
+}
+
+/*
+ * Returns true if the day's cap has been reached, so live records should be
+ * logged rather than sent.
+ */
+bool bBudgetExhausted(void) {
+    return ucLevel == BUDGET_LEVEL_EXHAUSTED;
+}
+
+/*
+ * Sets the daily cap, in kilobytes (0 for none). The level is revised on the
+ * next update.
+ */
+void vBudgetSetDaily(uint32_t ulNewDailyKB) {
+    ulDailyKB = ulNewDailyKB;
+}
+
+/*
+ * Called once per second by the Data task. Rolls the counters over at the
+ * end of the RTC's day, revises the throttle level, samples the usage
+ * channels and saves the counters when they are due.
+ */
+void vBudgetUpdate(void) {
+    uint32_t ulToday;
+    uint32_t ulUsageKB;
+    uint8_t ucNewLevel;
+    bool bLevelChanged;
+    bool bSave = false;
+
+    if (bClockSyncIsSet()) {
+        ulToday = HibernateRTCGetS() / BUDGET_S_PER_DAY;
+        if (ulToday != ulDay) {
+            BudgetNewDay(ulToday);
+            bSave = true;
+        }
+    }
+
+    ulUsageKB = pulBytes[BUDGET_COUNTER_LINK] / 1024;
+    pulHistoryKB[0] = ulUsageKB;
+
+    ucNewLevel = BudgetLevel();
+    bLevelChanged = (ucNewLevel != ucLevel);
+    if (bLevelChanged) {
+        debug_print("budget: level %d at %d KB\n", ucNewLevel, ulUsageKB);
+        ucLevel = ucNewLevel;
+        vProfileSetBudgetLevel(ucNewLevel < BUDGET_LEVEL_EXHAUSTED ?
+                               ucNewLevel : BUDGET_LEVEL_COARSE);
+    }
+
+    vChannelStore(&chDataUsage, &ulUsageKB);
+    vChannelStore(&chDataLevel, &ucNewLevel);
+
+    /* The server hears of a new level without waiting for a sample. */
+    if (bLevelChanged) {
+        bUrgentPost(&chDataLevel);
+    }
+
+    if (--ulSaveCountdown == 0 || bSave) {
+        ulSaveCountdown = BUDGET_SAVE_INTERVAL_S;
+        BudgetSave();
+    }
+}
+
+/*
+ * Copies out the counters, cap and level.
+ */
+void vBudgetGetStats(BudgetStats_t *pxStats) {
+    uint32_t i;
+
+    pxStats->ulDay = ulDay;
+    pxStats->ulDailyKB = ulDailyKB;
+    pxStats->ucLevel = ucLevel;
+    for (i = 0; i < BUDGET_COUNTERS; i++) {
+        pxStats->pulBytes[i] = pulBytes[i];
+    }
+    memcpy(pxStats->pulHistoryKB, pulHistoryKB, sizeof(pulHistoryKB));
+}
+
+/*
+ * Prints the day's counters and the link totals of earlier days.
+ */
+void vBudgetPrintStats(void) {
+    BudgetStats_t xStats;
+    uint32_t i;
+
+    vBudgetGetStats(&xStats);
+
+    debug_print("budget: level %d, %d of %d KB today, %d AT bytes\n",
+                xStats.ucLevel, xStats.pulBytes[BUDGET_COUNTER_LINK] / 1024,
+                xStats.ulDailyKB, xStats.pulBytes[BUDGET_COUNTER_COMMANDS]);
+    for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+        debug_print("budget %dHz: %d bytes\n",
+                    pxSampleRateBuffers[i]->usSampleRateHz,
+                    xStats.pulBytes[i]);
+    }
+    debug_print("budget other: %d bytes\n",
+                xStats.pulBytes[BUDGET_COUNTER_OTHER]);
+    for (i = 1; i < BUDGET_HISTORY_DAYS; i++) {
+        debug_print("budget day -%d: %d KB\n", i, xStats.pulHistoryKB[i]);
+    }
+}
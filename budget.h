@@ -0,0 +1,104 @@
+/*
+ * budget.h
+ * Definitions for the cellular data budget meter, which counts the bytes the
+ * uplink uses each day and throttles sampling as a daily cap is approached.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUDGET_H_
+#define BUDGET_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "store.h"
+#include "uplink.h"
+
+
+/* Bytes are counted per UTC day of the RTC: the record bytes of each uplink
+ * stream, of records belonging to no stream (drained, resent, schema, event
+ * and burst records), the stream packet bytes written to the modem (after
+ * compression and framing, which is what the cellular link carries apart
+ * from TCP/IP overhead), and the AT command bytes. The link bytes are what
+ * the budget is judged on.
+ *
+ * As the day's link bytes approach the daily cap, sampling is throttled in
+ * levels (see profile.c): archive deadbands, then archive rates as well,
+ * then four times the archive deadbands. At the cap, live records are
+ * logged to flash instead of sent, and the backlog drains the next day. The
+ * level only falls when the day rolls over or the cap is raised. The server
+ * sets the cap with "YYYm<KB per day>", where 0 means no cap.
+ *
+ * The counters and cap are saved to flash every BUDGET_SAVE_INTERVAL_S and
+ * at each new day, so a reset loses at most that much counting. The day's
+ * link kilobytes and the throttle level are sampled as the chDataUsage and
+ * chDataLevel channels. */
+#define BUDGET_DEFAULT_DAILY_KB         8192
+#define BUDGET_LEVEL_NONE               0
+#define BUDGET_LEVEL_DEADBANDS          1
+#define BUDGET_LEVEL_RATES              2
+#define BUDGET_LEVEL_COARSE             3
+#define BUDGET_LEVEL_EXHAUSTED          4
+/* Percentage of the daily cap at which each level above starts */
+#define BUDGET_DEADBANDS_PERCENT        50
+#define BUDGET_RATES_PERCENT            75
+#define BUDGET_COARSE_PERCENT           90
+
+/* Counter indexes. Streams come first, in the order of uplink.h. */
+#define BUDGET_COUNTER_OTHER            UPLINK_STREAM_COUNT
+#define BUDGET_COUNTER_LINK             ( UPLINK_STREAM_COUNT + 1 )
+#define BUDGET_COUNTER_COMMANDS         ( UPLINK_STREAM_COUNT + 2 )
+#define BUDGET_COUNTERS                 ( UPLINK_STREAM_COUNT + 3 )
+
+/* Days of link totals kept, including today */
+#define BUDGET_HISTORY_DAYS             7
+
+/* Snapshots of the counters are written in turn to two flash blocks just
+ * below the flash log (see store.h), so the application must be linked
+ * below BUDGET_FLASH_BASE. One block is only erased once the other holds a
+ * newer snapshot. */
+#define BUDGET_FLASH_BASE               ( STORE_FLASH_BASE - \
+                                          2 * STORE_SECTOR_BYTES )
+#define BUDGET_SAVE_INTERVAL_S          300
+#define BUDGET_MAGIC                    0x54474442
+
+
+/* Today's counters, and link kilobytes of each earlier day (index 1 is
+ * yesterday) */
+typedef struct {
+    uint32_t ulDay;
+    uint32_t ulDailyKB;
+    uint8_t ucLevel;
+    uint32_t pulBytes[BUDGET_COUNTERS];
+    uint32_t pulHistoryKB[BUDGET_HISTORY_DAYS];
+} BudgetStats_t;
+
+
+void vBudgetInit(void);
+void vBudgetCountRecord(uint8_t ucStream, uint32_t ulBytes);
+void vBudgetCountLink(uint32_t ulBytes);
+void vBudgetCountCommand(uint32_t ulBytes);
+bool bBudgetExhausted(void);
+void vBudgetSetDaily(uint32_t ulDailyKB);
+void vBudgetUpdate(void);
+void vBudgetGetStats(BudgetStats_t *pxStats);
+void vBudgetPrintStats(void);
+
+
+#endif /* BUDGET_H_ */
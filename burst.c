@@ -0,0 +1,346 @@
+/*
+ * burst.c
+ * Event-triggered burst capture. Selected channels keep a short history of
+ * every value stored to them. When a trigger rule fires, the history around
+ * the event is frozen and uploaded at low priority as burst records.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h> /* Needed for hibernate.h. */
+#include "driverlib/hibernate.h"
+#include "burst.h"
+#include "channel.h"
+#include "debug_helper.h"
+#include "hibernate_rtc.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+#define ARRAY_LENGTH(x)                 (sizeof(x) / sizeof(x[0]))
+
+
+/* Capture state shared by all burst channels */
+typedef enum {
+    /* Recording history and checking triggers */
+    BURST_ARMED,
+    /* A trigger fired; recording post-trigger values */
+    BURST_TRIGGERED,
+    /* The window is complete and being uploaded */
+    BURST_FROZEN
+} BurstState_t;
+
+
+/* Channels recorded at their source rate. Wheel speeds are 0.01km/h per count,
+ * so a fall of 3000 counts per second is roughly 0.85g of braking. RPM above
+ * 1500 catches the flare after a remote start, and a vehicle battery reading
+ * below 2833 ADC codes (10.5V) catches the dip while cranking. */
+static BurstChannel_t xBurstChannels[] = {
+    { .pxCh = &chWheelSpeedFL, .eTrigger = BURST_TRIGGER_FALL,
+      .lThreshold = 3000 },
+    { .pxCh = &chWheelSpeedFR, .eTrigger = BURST_TRIGGER_NONE },
+    { .pxCh = &chWheelSpeedRL, .eTrigger = BURST_TRIGGER_NONE },
+    { .pxCh = &chWheelSpeedRR, .eTrigger = BURST_TRIGGER_NONE },
+    { .pxCh = &chRPM, .eTrigger = BURST_TRIGGER_ABOVE, .lThreshold = 1500 },
+    { .pxCh = &chVehicleBatt, .eTrigger = BURST_TRIGGER_BELOW,
+      .lThreshold = 2833 }
+};
+
+static volatile BurstState_t eBurstState = BURST_ARMED;
+/* Tick count when the trigger fired */
+static volatile TickType_t xTriggerTick;
+/* RTC time of the trigger, computed when the window is frozen */
+static uint32_t ulTriggerS;
+static uint32_t ulTriggerSS;
+/* Incremented for every burst so that the server can group records */
+static uint8_t ucBurstID = 0;
+/* Next channel and entry within that channel to upload while frozen */
+static uint32_t ulUploadIndex;
+static uint32_t ulUploadEntry;
+
+
+/*
+ * Evaluates a channel's trigger rule against a new value. Returns true only
+ * when the condition becomes true, not while it continues to hold.
+ */
+static bool BurstCheckTrigger(BurstChannel_t *pxBurst, int32_t lValue,
+                              TickType_t xNow) {
+    /* Index of the previous entry */
+    uint32_t ulLast;
+    /* Time since the previous entry */
+    uint16_t usElapsedMS;
+    /* Change per second since the previous entry */
+    int32_t lRate;
+    bool bCondition = false;
+
+    switch (pxBurst->eTrigger) {
+        case BURST_TRIGGER_ABOVE :
+            bCondition = lValue > pxBurst->lThreshold;
+            break;
+        case BURST_TRIGGER_BELOW :
+            bCondition = lValue < pxBurst->lThreshold;
+            break;
+        case BURST_TRIGGER_RISE :
+        case BURST_TRIGGER_FALL :
+            if (pxBurst->ucCount == 0) {
+                break;
+            }
+            ulLast = (pxBurst->ucWriteIndex + BURST_HISTORY_LENGTH - 1) %
+                     BURST_HISTORY_LENGTH;
+            usElapsedMS = (uint16_t)xNow - pxBurst->pusTicks[ulLast];
+            if (usElapsedMS == 0) {
+                /* Too close together to give a meaningful rate. Keep the
+                 * previous condition. */
+                return false;
+            }
+            lRate = ((lValue - (int32_t)pxBurst->pulValues[ulLast]) * 1000) /
+                    (int32_t)usElapsedMS;
+            if (pxBurst->eTrigger == BURST_TRIGGER_RISE) {
+                bCondition = lRate > pxBurst->lThreshold;
+            }
+            else {
+                bCondition = lRate < -pxBurst->lThreshold;
+            }
+            break;
+        default :
+            break;
+    }
+
+    if (!bCondition) {
+        pxBurst->bTripped = false;
+        return false;
+    }
+
+    /* Don't fire until enough history has been collected to fill the
+     * pre-trigger part of the window. The condition isn't latched until
+     * then, so one that starts just after a rearm still fires once the
+     * history is long enough. */
+    if (pxBurst->bTripped ||
+            pxBurst->ucCount < BURST_HISTORY_LENGTH - BURST_POST_ENTRIES) {
+        return false;
+    }
+
+    pxBurst->bTripped = true;
+    return true;
+}
+
+/*
+ * Marks each burst channel with its place in xBurstChannels, so that channel
+ * stores can skip every other channel without a search. Called once by
+ * vChannelInit().
+ */
+void vBurstInit(void) {
+    uint32_t i;
+
+    for (i = 0; i < ARRAY_LENGTH(xBurstChannels); i++) {
+        xBurstChannels[i].pxCh->ucBurstSlot = i + 1;
+    }
+}
+
+/*
+ * Called whenever a burst channel (one with a nonzero ucBurstSlot) is
+ * stored. Its new value is added to its history and its trigger rule is
+ * checked. This may be called from ISRs as well as tasks.
+ */
+void vBurstChannelUpdate(volatile Channel_t *pxCh) {
+    uint32_t j;
+    BurstChannel_t *pxBurst;
+    uint32_t ulValue = 0;
+    TickType_t xNow;
+    UBaseType_t uxSavedInterruptStatus;
+
+    pxBurst = &xBurstChannels[pxCh->ucBurstSlot - 1];
+
+    /* This masks interrupts in both task and ISR context, so that the
+     * history and trigger state stay consistent. */
+    uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+
+    xNow = xTaskGetTickCountFromISR();
+
+    if (eBurstState == BURST_FROZEN) {
+        taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+        return;
+    }
+
+    if (eBurstState == BURST_TRIGGERED) {
+        /* Stop recording this channel once its post-trigger entries or the
+         * post-trigger time are used up, so that the pre-trigger history is
+         * never overwritten. */
+        if (pxBurst->ucPostCount >= BURST_POST_ENTRIES ||
+                xNow - xTriggerTick > pdMS_TO_TICKS(BURST_POST_MS)) {
+            taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+            return;
+        }
+        pxBurst->ucPostCount++;
+    }
+
+    /* Channels are little-endian and at most 4 bytes. */
+    memcpy(&ulValue, (void *)(pxCh->xData), pxCh->ucByteCount);
+
+    if (eBurstState == BURST_ARMED &&
+            BurstCheckTrigger(pxBurst, (int32_t)ulValue, xNow)) {
+        eBurstState = BURST_TRIGGERED;
+        xTriggerTick = xNow;
+        for (j = 0; j < ARRAY_LENGTH(xBurstChannels); j++) {
+            xBurstChannels[j].ucPostCount = 0;
+        }
+    }
+
+    pxBurst->pulValues[pxBurst->ucWriteIndex] = ulValue;
+    pxBurst->pusTicks[pxBurst->ucWriteIndex] = (uint16_t)xNow;
+    pxBurst->ucWriteIndex = (pxBurst->ucWriteIndex + 1) % BURST_HISTORY_LENGTH;
+    if (pxBurst->ucCount < BURST_HISTORY_LENGTH) {
+        pxBurst->ucCount++;
+    }
+
+    taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+}
+
+/*
+ * Completes a burst window once the post-trigger time has passed. The RTC
+ * time of the trigger is back-calculated from the tick count here rather than
+ * read when the trigger fires, because triggers may fire inside ISRs.
+ */
+static void BurstFreeze(void) {
+    uint32_t ulS;
+    uint32_t ulSS;
+    /* Ticks (ms) since the trigger, converted to RTC subseconds */
+    uint32_t ulElapsedSS;
+
+    HibernateRTCGetBoth(&ulS, &ulSS);
+    ulElapsedSS = (xTaskGetTickCount() - xTriggerTick) * 32768 / 1000;
+
+    ulTriggerS = ulS - ulElapsedSS / 32768;
+    ulElapsedSS %= 32768;
+    if (ulSS < ulElapsedSS) {
+        ulTriggerS--;
+        ulSS += 32768;
+    }
+    ulTriggerSS = ulSS - ulElapsedSS;
+
+    ulUploadIndex = 0;
+    ulUploadEntry = 0;
+    eBurstState = BURST_FROZEN;
+
+    debug_print("burst %d frozen\n", ucBurstID);
+}
+
+/*
+ * Clears all histories and re-arms the triggers after a burst is uploaded.
+ */
+static void BurstRearm(void) {
+    uint32_t i;
+
+    taskENTER_CRITICAL();
+    for (i = 0; i < ARRAY_LENGTH(xBurstChannels); i++) {
+        xBurstChannels[i].ucWriteIndex = 0;
+        xBurstChannels[i].ucCount = 0;
+        xBurstChannels[i].bTripped = false;
+    }
+    ucBurstID++;
+    eBurstState = BURST_ARMED;
+    taskEXIT_CRITICAL();
+}
+
+/*
+ * Writes the next burst record (up to BURST_RECORD_ENTRIES of one channel's
+ * window) to pucRecord, which must hold BURST_RECORD_MAX_BYTES. Returns the
+ * record length, or 0 if there is nothing to upload. Only the Modem UART task
+ * calls this, and only when it has no sample data waiting, so bursts never
+ * delay live data.
+ *
+ * Record layout after the common header (rate 0, size, trigger S, trigger SS):
+ * burst ID (1 byte), channel index (1 byte), value size (1 byte), entry count
+ * (1 byte), then each entry as a signed millisecond offset from the trigger
+ * (2 bytes) and the value.
+ */
+uint32_t ulBurstGetRecord(uint8_t *pucRecord) {
+    BurstChannel_t *pxBurst;
+    uint16_t usRate = BURST_RECORD_RATE;
+    uint16_t usSize;
+    uint8_t ucByteCount;
+    int16_t sOffsetMS;
+    uint8_t ucEntries;
+    uint32_t ulIndex;
+    uint32_t ulPos;
+    uint32_t i;
+
+    if (eBurstState == BURST_TRIGGERED &&
+            xTaskGetTickCount() - xTriggerTick > pdMS_TO_TICKS(BURST_POST_MS)) {
+        BurstFreeze();
+    }
+
+    if (eBurstState != BURST_FROZEN) {
+        return 0;
+    }
+
+    /* Skip channels that recorded nothing. */
+    while (ulUploadIndex < ARRAY_LENGTH(xBurstChannels) &&
+           xBurstChannels[ulUploadIndex].ucCount == 0) {
+        ulUploadIndex++;
+    }
+
+    if (ulUploadIndex == ARRAY_LENGTH(xBurstChannels)) {
+        BurstRearm();
+        return 0;
+    }
+
+    pxBurst = &xBurstChannels[ulUploadIndex];
+    ucByteCount = pxBurst->pxCh->ucByteCount;
+    ucEntries = pxBurst->ucCount - ulUploadEntry;
+    if (ucEntries > BURST_RECORD_ENTRIES) {
+        ucEntries = BURST_RECORD_ENTRIES;
+    }
+    usSize = 14 + ucEntries * (sizeof(sOffsetMS) + ucByteCount);
+
+    memcpy(pucRecord, &usRate, 2);
+    memcpy(pucRecord + 2, &usSize, 2);
+    memcpy(pucRecord + 4, &ulTriggerS, 4);
+    memcpy(pucRecord + 8, &ulTriggerSS, 2);
+    pucRecord[10] = ucBurstID;
+    pucRecord[11] = ucChannelGetIndex(pxBurst->pxCh);
+    pucRecord[12] = ucByteCount;
+    pucRecord[13] = ucEntries;
+    ulPos = 14;
+
+    /* Entries are written oldest first. */
+    ulIndex = (pxBurst->ucWriteIndex + BURST_HISTORY_LENGTH -
+               pxBurst->ucCount + ulUploadEntry) % BURST_HISTORY_LENGTH;
+    for (i = 0; i < ucEntries; i++) {
+        sOffsetMS = (int16_t)(pxBurst->pusTicks[ulIndex] -
+                              (uint16_t)xTriggerTick);
+        memcpy(pucRecord + ulPos, &sOffsetMS, sizeof(sOffsetMS));
+        memcpy(pucRecord + ulPos + sizeof(sOffsetMS),
+               &(pxBurst->pulValues[ulIndex]), ucByteCount);
+        ulPos += sizeof(sOffsetMS) + ucByteCount;
+        ulIndex = (ulIndex + 1) % BURST_HISTORY_LENGTH;
+    }
+
+    /* Move on to the next channel once this one is fully uploaded. */
+    ulUploadEntry += ucEntries;
+    if (ulUploadEntry >= pxBurst->ucCount) {
+        ulUploadIndex++;
+        ulUploadEntry = 0;
+    }
+
+    return ulPos;
+}
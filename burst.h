@@ -0,0 +1,90 @@
+/*
+ * burst.h
+ * Types and public functions for event-triggered burst capture.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BURST_H_
+#define BURST_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "channel.h"
+
+
+/* Number of values kept per burst channel. At most BURST_POST_ENTRIES of these
+ * are recorded after the trigger, the rest are pre-trigger history. */
+#define BURST_HISTORY_LENGTH            24
+#define BURST_POST_ENTRIES              8
+/* Time after a trigger during which post-trigger values are recorded */
+#define BURST_POST_MS                   250
+
+/* Burst records share the sample record header (rate, size, timestamp). A
+ * rate of 0 marks the record as a burst rather than a sample. */
+#define BURST_RECORD_RATE               0
+/* A channel's window is split into records of at most this many entries to
+ * keep each record small relative to the modem TX buffer */
+#define BURST_RECORD_ENTRIES            16
+/* Largest burst record: header (10 bytes), burst info (4 bytes) and one
+ * offset (2 bytes) and value (up to 4 bytes) per entry */
+#define BURST_RECORD_MAX_BYTES          ( 14 + BURST_RECORD_ENTRIES * 6 )
+
+
+/* Trigger rules. Threshold rules fire when the value crosses the threshold;
+ * rate rules fire when the change per second crosses it. */
+typedef enum {
+    BURST_TRIGGER_NONE,
+    BURST_TRIGGER_ABOVE,
+    BURST_TRIGGER_BELOW,
+    BURST_TRIGGER_RISE,
+    BURST_TRIGGER_FALL
+} BurstTrigger_t;
+
+/* A channel whose values are kept at their source rate (every time the channel
+ * is stored) so that they can be uploaded around a trigger event. */
+typedef struct {
+    /* The channel recorded */
+    volatile Channel_t *pxCh;
+    /* Trigger rule for this channel (may be BURST_TRIGGER_NONE) */
+    BurstTrigger_t eTrigger;
+    /* Threshold in channel units, or channel units per second for rate rules
+     * (always positive) */
+    int32_t lThreshold;
+    /* Recorded values and the low 16 bits of the tick count when each was
+     * stored */
+    uint32_t pulValues[BURST_HISTORY_LENGTH];
+    uint16_t pusTicks[BURST_HISTORY_LENGTH];
+    /* Index of the next entry to write and number of valid entries */
+    uint8_t ucWriteIndex;
+    uint8_t ucCount;
+    /* Number of entries recorded since the trigger */
+    uint8_t ucPostCount;
+    /* Whether the trigger has fired for a condition that still holds, so
+     * that rules only fire once per transition */
+    bool bTripped;
+} BurstChannel_t;
+
+
+void vBurstInit(void);
+void vBurstChannelUpdate(volatile Channel_t *pxCh);
+uint32_t ulBurstGetRecord(uint8_t *pucRecord);
+
+
+#endif /* BURST_H_ */
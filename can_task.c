@@ -43,6 +43,7 @@
 #include "priorities.h"
 #include "remote_start_task.h"
 #include "stack_sizes.h"
+#include "timestamp.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
@@ -121,6 +122,12 @@ uint32_t pulObj2ID[] = {
  * be processed. */
 volatile uint32_t ulErrFlag = 0;
 
+/* Timestamp at which the latest frame in each message object arrived, recorded
+ * by the ISR for CAN event records. Indexed by message object number. The
+ * task reads a 64-bit entry in two halves, so it must do so in a critical
+ * section (which masks the CAN ISR) or a new frame could tear it. */
+static volatile uint64_t pullObjRxTime[LAST_OBJ + 1];
+
 
 /*
  * The CAN0 interrupt handler notifies the CAN task when a message is received
@@ -169,6 +176,10 @@ void CAN0IntHandler( void ) {
          * separately clear it here. */
         CANIntClear( CAN0_BASE, ulStatus );
 
+        /* Timestamp the frame now, since the task may process it much
+         * later. */
+        pullObjRxTime[ ulStatus ] = ullTimestampNow();
+
         /* Set the object's bit so that the message will be handled in
          * the CAN task. The bits in the CAN task's notification value map to
          * the 32 message objects. Multiple bits can be set, instructing the
@@ -336,6 +347,10 @@ static void CANTask( void *pvParameters ) {
     /* Count of old data reads, which should only occur as a potential side
      * effect of a message loss event. */
     uint32_t ulCANOldDataCount = 0;
+    /* Arrival time of the frame being processed, for CAN event records */
+    uint32_t ulRxS;
+    uint32_t ulRxSS;
+    uint64_t ullRxTime;
 
     /* Main task loop. */
     while ( 1 ) {
@@ -404,6 +419,12 @@ static void CANTask( void *pvParameters ) {
                         else {
                             vChannelStoreCANData( xCAN0RxMessage.ui32MsgID,
                                                   xCAN0RxMessage.pui8MsgData );
+                            taskENTER_CRITICAL();
+                            ullRxTime = pullObjRxTime[ ulObjNum ];
+                            taskEXIT_CRITICAL();
+                            vTimestampToRTC( ullRxTime, &ulRxS, &ulRxSS );
+                            vChannelStoreCANEvent( xCAN0RxMessage.ui32MsgID,
+                                                   ulRxS, ulRxSS );
                         }
 
                     } /* if ( ( 1 << ulObjNum ) & ulNotificationValue ) */
@@ -22,13 +22,17 @@
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "driverlib/gpio.h"
 #include "inc/hw_memmap.h"
 #include "utils/uartstdio.h"
+#include "burst.h"
 #include "channel.h"
+#include "debug_helper.h"
 #include "ring_buffer.h"
 #include "sample.h"
+#include "urgent.h"
 #include "task.h"
 
 
@@ -56,12 +60,30 @@ volatile Channel_t chCabinTemp = { .ucByteCount = sizeof(uint32_t),
                               .usSampleRateHz = RATE_1HZ
 };
 
+volatile Channel_t chClockDrift = { .ucByteCount = sizeof(int32_t),
+                              .eType = CHANNEL_TYPE_SIGNED,
+                              .usSampleRateHz = RATE_1HZ
+};
+
+volatile Channel_t chClockOffset = { .ucByteCount = sizeof(int32_t),
+                              .eType = CHANNEL_TYPE_SIGNED,
+                              .usSampleRateHz = RATE_1HZ
+};
+
 volatile Channel_t chCoolantTemp = { .ucByteCount = sizeof(uint8_t),
                               .usSampleRateHz = RATE_1HZ,
                               .usCANID = 0x420,
                               .ucOffset = 0
 };
 
+volatile Channel_t chDataLevel = { .ucByteCount = sizeof(uint8_t),
+                              .usSampleRateHz = RATE_1HZ
+};
+
+volatile Channel_t chDataUsage = { .ucByteCount = sizeof(uint32_t),
+                              .usSampleRateHz = RATE_1HZ
+};
+
 volatile Channel_t chDeviceBatt = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_1HZ
 };
@@ -78,6 +100,14 @@ volatile Channel_t chGearPosition = { .ucByteCount = sizeof(uint8_t),
                               .ucOffset = 0
 };
 
+volatile Channel_t chSampleGaps = { .ucByteCount = sizeof(uint32_t),
+                              .usSampleRateHz = RATE_1HZ
+};
+
+volatile Channel_t chSampleJitter = { .ucByteCount = sizeof(uint32_t),
+                              .usSampleRateHz = RATE_1HZ
+};
+
 volatile Channel_t chAVGP2Raw = { .ucByteCount = sizeof(uint32_t),
                               .usSampleRateHz = RATE_10HZ
 };
@@ -93,6 +123,7 @@ volatile Channel_t chFuelLevelInst = { .ucByteCount = sizeof(uint8_t),
 };
 
 volatile Channel_t chNotifications = { .ucByteCount = sizeof(uint32_t),
+                              .eType = CHANNEL_TYPE_FLAGS,
                               .usSampleRateHz = RATE_10HZ
 };
 
@@ -100,14 +131,16 @@ volatile Channel_t chRPM = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x201,
                               .ucOffset = 0,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chSpeed = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x201,
                               .ucOffset = 4,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chTempKnob = { .ucByteCount = sizeof(uint32_t),
@@ -129,13 +162,15 @@ volatile Channel_t chTestDist1 = { .ucByteCount = sizeof(uint32_t),
 volatile Channel_t chThrottlePosition = { .ucByteCount = sizeof(uint8_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x201,
-                              .ucOffset = 6
+                              .ucOffset = 6,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chThrottlePositionROC = { .ucByteCount = sizeof(uint8_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x201,
-                              .ucOffset = 7
+                              .ucOffset = 7,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chVehicleBatt = { .ucByteCount = sizeof(uint32_t),
@@ -146,28 +181,32 @@ volatile Channel_t chWheelSpeedFL = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x4B0,
                               .ucOffset = 0,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chWheelSpeedFR = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x4B0,
                               .ucOffset = 2,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chWheelSpeedRL = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x4B0,
                               .ucOffset = 4,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 volatile Channel_t chWheelSpeedRR = { .ucByteCount = sizeof(uint16_t),
                               .usSampleRateHz = RATE_10HZ,
                               .usCANID = 0x4B0,
                               .ucOffset = 6,
-                              .bReverse = true
+                              .bReverse = true,
+                              .bCANEvent = true
 };
 
 /* An array of pointers to each channel, allowing for iteration. The order of
@@ -179,10 +218,16 @@ volatile Channel_t *xChannels[] = {
                          &chAVTEMP3Raw,
                          &chAVTEMP4Raw,
                          &chCabinTemp,
+                         &chClockDrift,
+                         &chClockOffset,
                          &chCoolantTemp,
+                         &chDataLevel,
+                         &chDataUsage,
                          &chDeviceBatt,
                          &chFuelLevelMean,
                          &chGearPosition,
+                         &chSampleGaps,
+                         &chSampleJitter,
                          &chAVGP2Raw,
                          &chDeviceCurrent,
                          &chFuelLevelInst,
@@ -202,6 +247,28 @@ volatile Channel_t *xChannels[] = {
                          &chWheelSpeedRR
 };
 
+/* Channel pointers reordered so that the channels of each sample buffer are
+ * adjacent, in the same order as they appear in xChannels. Each buffer's
+ * channels then occupy one contiguous region of the snapshot. */
+static volatile Channel_t *pxSnapshotOrder[ARRAY_LENGTH(xChannels)];
+
+/* A copy of every sampled channel's value, taken once per sampling event so
+ * that all sample buffers due at the same time are written from the same
+ * instant. */
+static uint8_t *pucSnapshot;
+
+/* The values last written to each sample buffer, in the same layout as the
+ * snapshot. Used to apply channel deadbands. */
+static uint8_t *pucLastSampled;
+
+/* Whether channels flagged with bCANEvent are sent once per received frame
+ * (true) or sampled like other channels (false) */
+static bool bCANEventMode = false;
+
+/* Incremented by every vChannelLayout() call, so that readers of the layout
+ * (see schema.c) can tell when it has changed */
+static volatile uint32_t ulLayoutGeneration = 0;
+
 
 /*
  * Counts the number of bytes of channel data for a given sample rate. Data is
@@ -214,7 +281,8 @@ uint32_t ulChannelGetByteCountForRate(SampleRateHz_t freq) {
     uint32_t byteCount = 0;
 
     for (i = 0; i < ucChannelCount; i++) {
-        if (xChannels[i]->usSampleRateHz == freq) {
+        if (xChannels[i]->usSampleRateHz == freq &&
+                !(bCANEventMode && xChannels[i]->bCANEvent)) {
             byteCount += xChannels[i]->ucByteCount;
         }
     }
@@ -223,23 +291,139 @@ uint32_t ulChannelGetByteCountForRate(SampleRateHz_t freq) {
 }
 
 /*
- * This function iterates through all channels, writing their current values to
- * the ring buffer of the passed SampleRateBuffer_t if they match the buffer's
- * sample rate. The buffer should have already been written with the sample
- * frequency as described in sample.h, and this call should occur within a
- * critical section so that a complete sample snapshot is always written.
+ * Copies the current values of the channels belonging to each sample buffer
+ * flagged in ulBufferMask (bit i corresponds to pxSampleRateBuffers[i]) into
+ * the snapshot. Each channel is read exactly once, so every buffer sampled
+ * from this snapshot sees the same values. This call should occur within a
+ * critical section so that channels aren't updated partway through.
+ */
+void vChannelSnapshot(uint32_t ulBufferMask) {
+    uint32_t ucNumBuffers = ucSampleGetBufferCount();
+    uint32_t ulOffset;
+    uint32_t i, j;
+
+    for (i = 0; i < ucNumBuffers; i++) {
+        if (ulBufferMask & (1 << i)) {
+            ulOffset = pxSampleRateBuffers[i]->usSnapshotOffset;
+
+            for (j = pxSampleRateBuffers[i]->ucSnapshotFirst;
+                 j < pxSampleRateBuffers[i]->ucSnapshotFirst +
+                     pxSampleRateBuffers[i]->ucSnapshotCount; j++) {
+                memcpy(pucSnapshot + ulOffset,
+                       (void *)(pxSnapshotOrder[j]->xData),
+                       pxSnapshotOrder[j]->ucByteCount);
+                ulOffset += pxSnapshotOrder[j]->ucByteCount;
+            }
+        }
+    }
+}
+
+/*
+ * Checks the latest snapshot against the values last written to the passed
+ * buffer and decides whether a new sample is worth writing. A channel with no
+ * deadband always makes the sample due; any other channel only does if it
+ * has moved by more than its deadband. A buffer with no channels is never
+ * due. When this returns true, the snapshot values are remembered as the last
+ * written values.
+ */
+bool bChannelSampleDue(SampleRateBuffer_t *pxBuffer) {
+    volatile Channel_t *pxCh;
+    uint32_t ulOffset = pxBuffer->usSnapshotOffset;
+    uint32_t ulNew;
+    uint32_t ulOld;
+    int32_t lChange;
+    bool bDue = pxBuffer->bForceSample;
+    uint32_t j;
+
+    if (pxBuffer->usSnapshotBytes == 0) {
+        return false;
+    }
+
+    for (j = pxBuffer->ucSnapshotFirst;
+         !bDue && j < pxBuffer->ucSnapshotFirst + pxBuffer->ucSnapshotCount;
+         j++) {
+        pxCh = pxSnapshotOrder[j];
+
+        if (pxCh->ulDeadband == 0) {
+            bDue = true;
+        }
+        else {
+            ulNew = 0;
+            ulOld = 0;
+            memcpy(&ulNew, pucSnapshot + ulOffset, pxCh->ucByteCount);
+            memcpy(&ulOld, pucLastSampled + ulOffset, pxCh->ucByteCount);
+            lChange = (int32_t)(ulNew - ulOld);
+            if (lChange > (int32_t)pxCh->ulDeadband ||
+                    lChange < -(int32_t)pxCh->ulDeadband) {
+                bDue = true;
+            }
+        }
+
+        ulOffset += pxCh->ucByteCount;
+    }
+
+    if (bDue) {
+        memcpy(pucLastSampled + pxBuffer->usSnapshotOffset,
+               pucSnapshot + pxBuffer->usSnapshotOffset,
+               pxBuffer->usSnapshotBytes);
+        pxBuffer->bForceSample = false;
+    }
+
+    return bDue;
+}
+
+/*
+ * Writes the channel values for the passed SampleRateBuffer_t from the latest
+ * snapshot to its ring buffer. vChannelSnapshot() must have been called for
+ * this buffer first, and the buffer should have already been written with the
+ * sample frequency as described in sample.h. This call should occur within a
+ * critical section so that a complete sample is always written.
  */
 void vChannelSample(SampleRateBuffer_t *pxBuffer) {
+    eRingBufferWriteN(&(pxBuffer->xData),
+                      pucSnapshot + pxBuffer->usSnapshotOffset,
+                      pxBuffer->usSnapshotBytes);
+}
+
+/*
+ * Computes the snapshot layout from the channels' current sample rates: each
+ * sample buffer is assigned a contiguous run of channels in pxSnapshotOrder
+ * and a matching region of the snapshot. Channels whose rate has no sample
+ * buffer are left out, as are CAN event channels while CAN event mode is on.
+ * Every buffer is flagged to write its next sample regardless of deadbands,
+ * since its layout may have changed.
+ *
+ * This runs at startup and whenever a sampling profile changes channel rates,
+ * in which case it must be called from the sampling ISR's critical section.
+ */
+void vChannelLayout(void) {
     uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
-    uint32_t i;
+    uint32_t ucNumBuffers = ucSampleGetBufferCount();
+    uint32_t ulOrderIndex = 0;
+    uint32_t ulOffset = 0;
+    uint32_t i, j;
 
-    for (i = 0; i < ucChannelCount; i++) {
-        if (xChannels[i]->usSampleRateHz == pxBuffer->usSampleRateHz) {
-            eRingBufferWriteN(&(pxBuffer->xData),
-                              (uint8_t *)(xChannels[i]->xData),
-                              xChannels[i]->ucByteCount);
+    for (i = 0; i < ucNumBuffers; i++) {
+        pxSampleRateBuffers[i]->ucSnapshotFirst = ulOrderIndex;
+        pxSampleRateBuffers[i]->usSnapshotOffset = ulOffset;
+
+        for (j = 0; j < ucChannelCount; j++) {
+            if (xChannels[j]->usSampleRateHz ==
+                    pxSampleRateBuffers[i]->usSampleRateHz &&
+                    !(bCANEventMode && xChannels[j]->bCANEvent)) {
+                pxSnapshotOrder[ulOrderIndex++] = xChannels[j];
+                ulOffset += xChannels[j]->ucByteCount;
+            }
         }
+
+        pxSampleRateBuffers[i]->ucSnapshotCount =
+            ulOrderIndex - pxSampleRateBuffers[i]->ucSnapshotFirst;
+        pxSampleRateBuffers[i]->usSnapshotBytes =
+            ulOffset - pxSampleRateBuffers[i]->usSnapshotOffset;
+        pxSampleRateBuffers[i]->bForceSample = true;
     }
+
+    ulLayoutGeneration++;
 }
 
 /*
@@ -247,13 +431,127 @@ void vChannelSample(SampleRateBuffer_t *pxBuffer) {
  * once, and the memory is needed until the device resets, so it is never freed.
  * This could be accomplished with plain static allocation and is only done for
  * convenience while the number and size of channels is in flux.
+ *
+ * Each channel's initial rate is also saved as its default, and the snapshot
+ * is sized to hold every channel so that any profile's layout will fit. Burst
+ * channels are marked here too (see burst.c).
  */
 void vChannelInit(void) {
     uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
+    uint32_t ulTotalBytes = 0;
     uint32_t i;
 
     for (i = 0; i < ucChannelCount; i++) {
         xChannels[i]->xData = pvPortMalloc(xChannels[i]->ucByteCount);
+        xChannels[i]->usDefaultRateHz = xChannels[i]->usSampleRateHz;
+        ulTotalBytes += xChannels[i]->ucByteCount;
+    }
+
+    pucSnapshot = pvPortMalloc(ulTotalBytes);
+    pucLastSampled = pvPortMalloc(ulTotalBytes);
+
+    vBurstInit();
+
+    vChannelLayout();
+}
+
+/*
+ * Restores every channel's default sample rate and clears its deadband. A
+ * sampling profile then applies its own changes on top of the defaults.
+ */
+void vChannelRestoreDefaults(void) {
+    uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
+    uint32_t i;
+
+    for (i = 0; i < ucChannelCount; i++) {
+        xChannels[i]->usSampleRateHz = xChannels[i]->usDefaultRateHz;
+        xChannels[i]->ulDeadband = 0;
+    }
+}
+
+/*
+ * Get the position of a channel in xChannels, which is how the server
+ * identifies channels outside of regular samples.
+ */
+uint8_t ucChannelGetIndex(volatile Channel_t *pxCh) {
+    uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
+    uint32_t i;
+
+    for (i = 0; i < ucChannelCount; i++) {
+        if (xChannels[i] == pxCh) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ * Get the number of channels in xChannels.
+ */
+uint32_t ulChannelGetCount(void) {
+    return ARRAY_LENGTH(xChannels);
+}
+
+/*
+ * Get the channel at a position in xChannels, or NULL if there is none.
+ */
+volatile Channel_t *pxChannelGet(uint32_t ulIndex) {
+
+    if (ulIndex >= ARRAY_LENGTH(xChannels)) {
+        return NULL;
+    }
+
+    return xChannels[ulIndex];
+}
+
+/*
+ * Get the number of times the sample layout has been computed. A change in
+ * this value means the layout may have changed.
+ */
+uint32_t ulChannelGetLayoutGeneration(void) {
+    return ulLayoutGeneration;
+}
+
+/*
+ * Copies the channels that make up the passed buffer's samples, in the order
+ * their values appear, into ppxChannels. Returns the number of channels, or 0
+ * if there are more than ulMaxChannels. The sampling ISR can change the
+ * layout when a profile is applied, so callers outside it must hold a
+ * critical section.
+ */
+uint32_t ulChannelGetLayout(SampleRateBuffer_t *pxBuffer,
+                            volatile Channel_t **ppxChannels,
+                            uint32_t ulMaxChannels) {
+    uint32_t j;
+
+    if (pxBuffer->ucSnapshotCount > ulMaxChannels) {
+        return 0;
+    }
+
+    for (j = 0; j < pxBuffer->ucSnapshotCount; j++) {
+        ppxChannels[j] = pxSnapshotOrder[pxBuffer->ucSnapshotFirst + j];
+    }
+
+    return pxBuffer->ucSnapshotCount;
+}
+
+/*
+ * Prints the compression achieved by frame encoding for each channel that
+ * has been sent, as encoded bytes per 100 raw bytes. Channels are identified
+ * by their position in xChannels.
+ */
+void vChannelPrintEncodingStats(void) {
+    uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
+    uint32_t i;
+
+    debug_print("channel encoding (bytes per 100 raw):\n");
+    for (i = 0; i < ucChannelCount; i++) {
+        if (xChannels[i]->ulEncodedRawBytes) {
+            debug_print("%d: %d\n", i,
+                        (uint32_t)(((uint64_t)xChannels[i]->ulEncodedBytes *
+                                    100) / xChannels[i]->ulEncodedRawBytes));
+        }
     }
 }
 
@@ -295,6 +593,9 @@ uint8_t ucChannelValueGet( volatile Channel_t *pxCh ) {
  */
 void vChannelStore(volatile Channel_t *pxCh, void *pucNewValue) {
     memcpy((void *)(pxCh->xData), pucNewValue, pxCh->ucByteCount);
+    if (pxCh->ucBurstSlot) {
+        vBurstChannelUpdate(pxCh);
+    }
 }
 
 /*
@@ -303,12 +604,17 @@ void vChannelStore(volatile Channel_t *pxCh, void *pucNewValue) {
  * something in a compact form, avoiding the need for individual channels and
  * allowing 32 notifications per channel to operate independently. Some bits
  * serve as status indicators while others are true notifications that require
- * a response from the server to confirm and clear.
+ * a response from the server to confirm and clear. Each change is also
+ * posted to the urgent queue (see urgent.h), so the server hears of it
+ * without waiting for the next sample.
  */
 void vNotificationChannelSet(volatile Channel_t *pxCh, uint32_t ulBitsToSet) {
 
     if (pxCh->ucByteCount == sizeof(uint32_t)) {
-        *(uint32_t *)(pxCh->xData) |= ulBitsToSet;
+        if ((*(uint32_t *)(pxCh->xData) & ulBitsToSet) != ulBitsToSet) {
+            *(uint32_t *)(pxCh->xData) |= ulBitsToSet;
+            bUrgentPost(pxCh);
+        }
     }
     else {
         /* The channel is of incorrect size. */
@@ -318,13 +624,81 @@ void vNotificationChannelSet(volatile Channel_t *pxCh, uint32_t ulBitsToSet) {
 void vNotificationChannelClear(volatile Channel_t *pxCh, uint32_t ulBitsToClear) {
 
     if (pxCh->ucByteCount == sizeof(uint32_t)) {
-        *(uint32_t *)(pxCh->xData) &= !ulBitsToClear;
+        if (*(uint32_t *)(pxCh->xData) & ulBitsToClear) {
+            *(uint32_t *)(pxCh->xData) &= ~ulBitsToClear;
+            bUrgentPost(pxCh);
+        }
     }
     else {
         /* The channel is of incorrect size. */
     }
 }
 
+/*
+ * Turns CAN event mode on or off. vChannelLayout() must be called afterward
+ * (from the sampling ISR) for the change to take effect in samples.
+ */
+void vChannelSetCANEventMode(bool bEnable) {
+    bCANEventMode = bEnable;
+}
+
+/*
+ * In CAN event mode, writes one event record for a received frame containing
+ * the values of every bCANEvent channel carried by that frame. The record has
+ * the same header as a sample, with SAMPLE_EVENT_RATE as the frequency and the
+ * frame's arrival time as the timestamp, followed by the CAN ID (2 bytes) and
+ * the channel values in xChannels order. Frames carrying no event channels
+ * produce nothing. This must be called after vChannelStoreCANData() for the
+ * same frame.
+ */
+void vChannelStoreCANEvent(uint32_t ulMsgID, uint32_t ulS, uint32_t ulSS) {
+    uint32_t ucChannelCount = ARRAY_LENGTH(xChannels);
+    uint32_t i;
+    uint16_t usRateField = SAMPLE_EVENT_RATE;
+    /* Header, CAN ID and values */
+    uint16_t usSize = 12;
+    uint16_t usID = ulMsgID;
+
+    if (!bCANEventMode) {
+        return;
+    }
+
+    for (i = 0; i < ucChannelCount; i++) {
+        if (xChannels[i]->usCANID == ulMsgID && xChannels[i]->bCANEvent) {
+            usSize += xChannels[i]->ucByteCount;
+        }
+    }
+
+    if (usSize == 12) {
+        return;
+    }
+
+    /* The record is written in a critical section so that it can't be read
+     * while only partly written, and is dropped if it doesn't fit whole. */
+    taskENTER_CRITICAL();
+    if (ulRingBufferFree(&(xEventBuffer.xData)) < usSize) {
+        taskEXIT_CRITICAL();
+        return;
+    }
+    eRingBufferWriteN(&(xEventBuffer.xData), (uint8_t *)(&usRateField),
+                      sizeof(usRateField));
+    eRingBufferWriteN(&(xEventBuffer.xData), (uint8_t *)(&usSize),
+                      sizeof(usSize));
+    eRingBufferWriteN(&(xEventBuffer.xData), (uint8_t *)(&ulS), sizeof(ulS));
+    eRingBufferWriteN(&(xEventBuffer.xData), (uint8_t *)(&ulSS),
+                      sizeof(uint16_t));
+    eRingBufferWriteN(&(xEventBuffer.xData), (uint8_t *)(&usID),
+                      sizeof(usID));
+    for (i = 0; i < ucChannelCount; i++) {
+        if (xChannels[i]->usCANID == ulMsgID && xChannels[i]->bCANEvent) {
+            eRingBufferWriteN(&(xEventBuffer.xData),
+                              (uint8_t *)(xChannels[i]->xData),
+                              xChannels[i]->ucByteCount);
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
 /*
  * Store the data from a single CAN message in the applicable channels. Each
  * channel with an ID that matches the message's ID is updated.
@@ -343,6 +717,9 @@ void vChannelStoreCANData(uint32_t ulMsgID, uint8_t *pui8MsgData) {
             else {
                 memcpy((void *)(xChannels[i]->xData), pui8MsgData + xChannels[i]->ucOffset, xChannels[i]->ucByteCount);
             }
+            if (xChannels[i]->ucBurstSlot) {
+                vBurstChannelUpdate(xChannels[i]);
+            }
         }
     }
 }
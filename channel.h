@@ -36,6 +36,14 @@
 #define NT_RS_READY                     0x00000001
 
 
+/* How a channel's raw value is interpreted, so that the server can decode
+ * values from the schema (see schema.h) alone */
+typedef enum {
+    CHANNEL_TYPE_UNSIGNED = 0,
+    CHANNEL_TYPE_SIGNED = 1,
+    CHANNEL_TYPE_FLAGS = 2
+} ChannelType_t;
+
 /* The Channel_t struct represents a measured value from a sensor, CAN bus, or
  * internal/onboard source. The latest value is stored (generally updated by a
  * specific task) along with various channel metadata. */
@@ -44,6 +52,8 @@ typedef struct {
     uint8_t *xData;
     /* Number of bytes for the channel value */
     uint8_t ucByteCount;
+    /* Interpretation of the value (unsigned unless set otherwise) */
+    ChannelType_t eType;
     /* CAN ID for received CAN messages containing this channel (if
      * applicable) */
     uint16_t usCANID;
@@ -52,8 +62,24 @@ typedef struct {
     uint8_t ucOffset;
     /* Whether the bytes arrive reversed on the CAN bus */
     bool bReverse;
-    /* Sample rate for this channel in Hz */
+    /* Whether this CAN channel is sent once per received frame (instead of
+     * being sampled) while CAN event mode is on */
+    bool bCANEvent;
+    /* Sample rate for this channel in Hz (may be changed by the active
+     * sampling profile) */
     SampleRateHz_t usSampleRateHz;
+    /* Sample rate defined here, restored when profiles change */
+    SampleRateHz_t usDefaultRateHz;
+    /* Smallest change (in raw channel units) that makes a new sample worth
+     * sending. 0 means every sample is sent. Set by the sampling profile. */
+    uint32_t ulDeadband;
+    /* 1 + this channel's index in the burst channel list (see burst.c), or 0
+     * if it isn't a burst channel. Set by vBurstInit(). */
+    uint8_t ucBurstSlot;
+    /* Bytes of this channel's samples before and after frame encoding, for
+     * reporting the compression achieved per channel */
+    uint32_t ulEncodedRawBytes;
+    uint32_t ulEncodedBytes;
 } Channel_t;
 
 /* Channel declarations. These are global to the program as they are relevant
@@ -64,10 +90,16 @@ extern volatile Channel_t chAVTEMP2Raw;
 extern volatile Channel_t chAVTEMP3Raw;
 extern volatile Channel_t chAVTEMP4Raw;
 extern volatile Channel_t chCabinTemp;
+extern volatile Channel_t chClockDrift;
+extern volatile Channel_t chClockOffset;
 extern volatile Channel_t chCoolantTemp;
+extern volatile Channel_t chDataLevel;
+extern volatile Channel_t chDataUsage;
 extern volatile Channel_t chDeviceBatt;
 extern volatile Channel_t chFuelLevelMean;
 extern volatile Channel_t chGearPosition;
+extern volatile Channel_t chSampleGaps;
+extern volatile Channel_t chSampleJitter;
 extern volatile Channel_t chAVGP2Raw;
 extern volatile Channel_t chDeviceCurrent;
 extern volatile Channel_t chFuelLevelInst;
@@ -87,14 +119,28 @@ extern volatile Channel_t chWheelSpeedRL;
 extern volatile Channel_t chWheelSpeedRR;
 
 uint32_t ulChannelGetByteCountForRate(SampleRateHz_t freq);
+void vChannelSnapshot(uint32_t ulBufferMask);
+bool bChannelSampleDue(SampleRateBuffer_t *pxBuffer);
 void vChannelSample(SampleRateBuffer_t *pxBuffer);
+void vChannelLayout(void);
 void vChannelInit(void);
+void vChannelRestoreDefaults(void);
 void vChannelStore(volatile Channel_t *pxCh, void *pucNewValue);
+uint8_t ucChannelGetIndex(volatile Channel_t *pxCh);
+uint32_t ulChannelGetCount(void);
+volatile Channel_t *pxChannelGet(uint32_t ulIndex);
+uint32_t ulChannelGetLayoutGeneration(void);
+uint32_t ulChannelGetLayout(SampleRateBuffer_t *pxBuffer,
+                            volatile Channel_t **ppxChannels,
+                            uint32_t ulMaxChannels);
+void vChannelPrintEncodingStats(void);
 uint32_t ulChannelValueGet( volatile Channel_t *pxCh );
 uint16_t usChannelValueGet( volatile Channel_t *pxCh );
 uint8_t ucChannelValueGet( volatile Channel_t *pxCh );
 void vNotificationChannelSet(volatile Channel_t *pxCh, uint32_t ulBitsToSet);
 void vNotificationChannelClear(volatile Channel_t *pxCh, uint32_t ulBitsToClear);
+void vChannelSetCANEventMode(bool bEnable);
+void vChannelStoreCANEvent(uint32_t ulMsgID, uint32_t ulS, uint32_t ulSS);
 void vChannelStoreCANData(uint32_t ulMsgID, uint8_t *pui8MsgData);
 
 #endif /* CHANNEL_H_ */
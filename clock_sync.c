@@ -0,0 +1,259 @@
+/*
+ * clock_sync.c
+ * A clock discipline loop that keeps the real-time clock aligned with network
+ * or server time by trimming its rate rather than stepping it.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h> /* Needed for hibernate.h. */
+#include "inc/hw_ints.h"
+#include "driverlib/hibernate.h"
+#include "driverlib/interrupt.h"
+#include "channel.h"
+#include "clock_sync.h"
+#include "data_task.h"
+#include "debug_helper.h"
+#include "hibernate_rtc.h"
+
+
+/* Subsecond counts per second of the RTC (32768Hz clock) */
+#define RTC_SS_PER_S                    32768
+/* Default value of the HIBRTCT register. With this trim value every second is
+ * exactly 32768 counts long. */
+#define CLOCK_SYNC_NOMINAL_TRIM         0x7FFF
+/* The trim value is applied once every 64 seconds, so one count of trim
+ * changes the rate of the clock by 1 / (32768 * 64) = 476.837ppb. */
+#define CLOCK_SYNC_PPB_PER_TRIM         477
+/* Largest trim adjustment allowed in either direction (about 244ppm). This is
+ * far beyond the tolerance of the 32.768kHz crystal and only limits how
+ * aggressively a large phase offset is slewed out. */
+#define CLOCK_SYNC_TRIM_LIMIT           512
+/* Offsets larger than this (in RTC subseconds) are stepped instead of slewed.
+ * Slewing 2 seconds at the trim limit would take over two hours. */
+#define CLOCK_SYNC_STEP_LIMIT_SS        ( 2 * RTC_SS_PER_S )
+/* Time constant in seconds over which a phase offset is slewed out. */
+#define CLOCK_SYNC_PHASE_HORIZON_S      512
+/* Minimum spacing in seconds between references used to estimate the
+ * frequency error. The trim only takes effect every 64 seconds, so closer
+ * references can't show its effect. */
+#define CLOCK_SYNC_MIN_INTERVAL_S       64
+/* Nanoseconds per RTC subsecond count (30517.578), rounded */
+#define NS_PER_SS                       30518
+
+
+/* Whether the RTC has been set from a reference at least once */
+static bool bClockSet = false;
+/* Whether lLastOffsetSS and ulLastS hold a usable fine reference */
+static bool bHaveLast = false;
+/* Local RTC seconds at the last fine reference */
+static uint32_t ulLastS;
+/* Offset measured at the last fine reference, in RTC subseconds */
+static int32_t lLastOffsetSS;
+/* Estimated frequency error of the crystal in ppb. Positive means the RTC
+ * runs fast. */
+static int32_t lFreqPPB = 0;
+/* Rate correction currently applied through the trim register, in ppb, and
+ * the local RTC seconds when it was applied */
+static int32_t lAppliedPPB = 0;
+static uint32_t ulAppliedS;
+/* Applied correction integrated over time since the baseline at ulLastS, in
+ * ppb seconds. The trim can change at every reference while the baseline
+ * only moves every CLOCK_SYNC_MIN_INTERVAL_S. */
+static int64_t llAppliedPPBS = 0;
+
+
+/*
+ * Sets the RTC to the given time and (re)arms the first sampling match. This
+ * is only done for the very first reference or when the clock is so far off
+ * that slewing would take an unreasonable amount of time.
+ */
+static void ClockSyncStep( uint32_t ulRefS ) {
+
+    /* The sampling ISR must not run between the schedule reset and the new
+     * match, or it would sample against a half-updated schedule. As in the
+     * Data task's watchdog, hibernate interrupts are disabled at the NVIC
+     * because that is much faster than HibernateIntDisable(). */
+    IntDisable( INT_HIBERNATE );
+    HibernateRTCDisable();
+    HibernateRTCSet( ulRefS );
+    vDataSamplingReset();
+
+    /* Set a match in the near future to kick off the RTC interrupt sampling
+     * cycle. 2 seconds are added to ensure that the match time isn't in the
+     * past by the time the RTC is enabled again. */
+    HibernateRTCMatchSet( 0, ulRefS + 2 );
+    HibernateRTCSSMatchSet( 0, 0 );
+    /* Enable the match interrupt at the peripheral. */
+    HibernateIntEnable( HIBERNATE_INT_RTC_MATCH_0 );
+    /* Enable the real-time clock (begin counting). */
+    HibernateRTCEnable();
+    IntEnable( INT_HIBERNATE );
+}
+
+/*
+ * Programs the trim register for a given rate correction in ppb, where a
+ * positive correction slows the clock down. Returns the correction that was
+ * actually applied after quantization and limiting.
+ */
+static int32_t ClockSyncTrimSet( int32_t lCorrectionPPB ) {
+    int32_t lTrim = lCorrectionPPB / CLOCK_SYNC_PPB_PER_TRIM;
+
+    if ( lTrim > CLOCK_SYNC_TRIM_LIMIT ) {
+        lTrim = CLOCK_SYNC_TRIM_LIMIT;
+    }
+    else if ( lTrim < -CLOCK_SYNC_TRIM_LIMIT ) {
+        lTrim = -CLOCK_SYNC_TRIM_LIMIT;
+    }
+
+    /* A trim value above 0x7FFF lengthens every 64th second, slowing the
+     * clock. */
+    HibernateRTCTrimSet( CLOCK_SYNC_NOMINAL_TRIM + lTrim );
+
+    return lTrim * CLOCK_SYNC_PPB_PER_TRIM;
+}
+
+/*
+ * Feeds a reference time to the discipline loop. ulRefS is Unix time and
+ * ulRefSS is the fractional second in RTC subseconds (1/32768ths). The local
+ * RTC is read as close to the call as possible, so callers should pass the
+ * reference as soon as it is received.
+ *
+ * The first reference (and any fine reference that disagrees with the RTC by
+ * more than a couple of seconds) steps the clock. All other fine references
+ * are used to estimate the phase offset and frequency error of the RTC, which
+ * are corrected by slewing through the hibernate module's trim register.
+ * Coarse references (e.g. AT+CCLK, which only has one second resolution) only
+ * set the clock while it has never been set. After that they are only
+ * reported, because their quantization error would swamp the estimate and a
+ * modem that lost its time would step a disciplined clock.
+ *
+ * The measured offset (in microseconds) and the estimated drift (in ppb) are
+ * exported through chClockOffset and chClockDrift.
+ */
+void vClockSyncUpdate( uint32_t ulRefS, uint32_t ulRefSS, bool bCoarse ) {
+    /* Local RTC time at the moment the reference is processed */
+    uint32_t ulLocalS;
+    uint32_t ulLocalSS;
+    /* Whole-second part of the offset, checked before scaling */
+    int32_t lOffsetS;
+    /* Offset between the RTC and the reference in RTC subseconds. Positive
+     * means the RTC is ahead. */
+    int32_t lOffsetSS;
+    /* Rate of change of the offset since the last reference, in ppb */
+    int32_t lResidualPPB;
+    /* Rate correction needed to remove the phase offset over the horizon */
+    int32_t lPhasePPB;
+    /* Values exported to channels */
+    int32_t lOffsetUS;
+    int32_t lDriftPPB;
+
+    HibernateRTCGetBoth( &ulLocalS, &ulLocalSS );
+
+    lOffsetS = ( int32_t )( ulLocalS - ulRefS );
+
+    if ( bCoarse && bClockSet ) {
+        debug_print( "clock sync: coarse offset %ds ignored\n", lOffsetS );
+        return;
+    }
+
+    if ( bClockSet && lOffsetS < 2 && lOffsetS > -2 ) {
+        lOffsetSS = lOffsetS * RTC_SS_PER_S +
+                    ( ( int32_t )ulLocalSS - ( int32_t )ulRefSS );
+    }
+    else {
+        lOffsetSS = CLOCK_SYNC_STEP_LIMIT_SS + 1;
+    }
+
+    /* Step the clock if it has never been set or is far off. Any estimate
+     * made against the old time base is discarded. */
+    if ( lOffsetSS > CLOCK_SYNC_STEP_LIMIT_SS ||
+         lOffsetSS < -CLOCK_SYNC_STEP_LIMIT_SS ) {
+        debug_print( "clock sync: stepping RTC to %d\n", ulRefS );
+        ClockSyncStep( ulRefS );
+        bClockSet = true;
+        bHaveLast = false;
+        lAppliedPPB = ClockSyncTrimSet( lFreqPPB );
+        return;
+    }
+
+    /* Integrate the correction in force since the last reference. */
+    if ( bHaveLast ) {
+        llAppliedPPBS += ( int64_t )lAppliedPPB *
+                         ( int32_t )( ulLocalS - ulAppliedS );
+        ulAppliedS = ulLocalS;
+    }
+
+    /* Update the frequency estimate once enough time has passed for the
+     * trim to have had an effect. The offset changes at the rate of the
+     * crystal's error minus the correction applied, so adding back the
+     * average correction applied over the same interval recovers the
+     * crystal's error. Only half of the new estimate is taken to filter out
+     * reference jitter. */
+    if ( bHaveLast && ulLocalS - ulLastS >= CLOCK_SYNC_MIN_INTERVAL_S ) {
+        lResidualPPB = ( int32_t )( ( ( int64_t )( lOffsetSS - lLastOffsetSS ) *
+                                      NS_PER_SS ) /
+                                    ( int32_t )( ulLocalS - ulLastS ) );
+        lFreqPPB += ( lResidualPPB +
+                      ( int32_t )( llAppliedPPBS /
+                                   ( int32_t )( ulLocalS - ulLastS ) ) -
+                      lFreqPPB ) / 2;
+
+        if ( lFreqPPB > CLOCK_SYNC_TRIM_LIMIT * CLOCK_SYNC_PPB_PER_TRIM ) {
+            lFreqPPB = CLOCK_SYNC_TRIM_LIMIT * CLOCK_SYNC_PPB_PER_TRIM;
+        }
+        else if ( lFreqPPB <
+                  -CLOCK_SYNC_TRIM_LIMIT * CLOCK_SYNC_PPB_PER_TRIM ) {
+            lFreqPPB = -CLOCK_SYNC_TRIM_LIMIT * CLOCK_SYNC_PPB_PER_TRIM;
+        }
+    }
+
+    /* Start a new baseline for the next frequency estimate unless the last
+     * one is still too recent to be replaced. */
+    if ( !bHaveLast || ulLocalS - ulLastS >= CLOCK_SYNC_MIN_INTERVAL_S ) {
+        bHaveLast = true;
+        ulLastS = ulLocalS;
+        lLastOffsetSS = lOffsetSS;
+        llAppliedPPBS = 0;
+        ulAppliedS = ulLocalS;
+    }
+
+    /* Slew out the phase offset on top of the frequency correction. */
+    lPhasePPB = ( int32_t )( ( ( int64_t )lOffsetSS * NS_PER_SS ) /
+                             CLOCK_SYNC_PHASE_HORIZON_S );
+    lAppliedPPB = ClockSyncTrimSet( lFreqPPB + lPhasePPB );
+
+    lOffsetUS = ( int32_t )( ( ( int64_t )lOffsetSS * 1000000 ) /
+                             RTC_SS_PER_S );
+    lDriftPPB = lFreqPPB;
+    vChannelStore( &chClockOffset, &lOffsetUS );
+    vChannelStore( &chClockDrift, &lDriftPPB );
+
+    debug_print( "clock sync: offset %dus, drift %dppb\n", lOffsetUS,
+                 lDriftPPB );
+}
+
+/*
+ * Whether the RTC has been set from a reference yet.
+ */
+bool bClockSyncIsSet( void ) {
+    return bClockSet;
+}
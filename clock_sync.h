@@ -0,0 +1,33 @@
+/*
+ * clock_sync.h
+ * Public functions for disciplining the real-time clock against network or
+ * server time.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CLOCK_SYNC_H_
+#define CLOCK_SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void vClockSyncUpdate( uint32_t ulRefS, uint32_t ulRefSS, bool bCoarse );
+bool bClockSyncIsSet( void );
+
+#endif /* CLOCK_SYNC_H_ */
@@ -0,0 +1,38 @@
+/*
+ * crc.h
+ * CRC declarations.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CRC_H_
+#define CRC_H_
+
+
+#include <stdint.h>
+
+
+/* Initial value for usCRC16(). The CRC is CRC-16/CCITT-FALSE: polynomial
+ * 0x1021, not reflected, no final XOR. */
+#define CRC16_INIT                      0xFFFF
+
+
+uint16_t usCRC16(const uint8_t *pucData, uint32_t ulLength, uint16_t usCRC);
+
+
+#endif /* CRC_H_ */
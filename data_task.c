@@ -36,13 +36,20 @@
 #include "driverlib/rom.h"
 #include "driverlib/sysctl.h"
 #include "utils/uartstdio.h"
+#include "budget.h"
 #include "channel.h"
 #include "debug_helper.h"
 #include "hibernate_rtc.h"
+#include "lz.h"
 #include "modem_uart_task.h"
 #include "priorities.h"
+#include "profile.h"
 #include "sample.h"
 #include "stack_sizes.h"
+#include "store_task.h"
+#include "timestamp.h"
+#include "uplink.h"
+#include "urgent.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
@@ -56,10 +63,101 @@
 #include "remote_start_task.h"
 
 
+/* Subsecond counts the next match must be ahead of the RTC when it is
+ * written. A hibernate register write takes up to ~100us (about 3 counts) to
+ * complete, and a match written in the past never fires. */
+#define SAMPLE_MATCH_MARGIN_SS          8
+/* Number of bins in the sampling latency histogram. Bin 0 counts latencies
+ * under 1us and bin n counts latencies in [2^(n-1), 2^n)us. The last bin also
+ * counts anything longer. */
+#define SAMPLE_JITTER_BINS              12
+/* Interval (in Data task loops, about a second each) at which the latency
+ * histogram and the channel encoding and uplink compression statistics are
+ * printed */
+#define SAMPLE_JITTER_PRINT_INTERVAL    60
+
+
 TaskHandle_t xDataTaskHandle;
 
 uint32_t debugCount = 0;
 
+/* Sampling schedule state, shared between the ISR and resynchronization.
+ * ulCurrentMS is the fractional part of the current match in milliseconds,
+ * and fNextMatchSS is the next subseconds match value (ulNextMatchSS is
+ * used). */
+static uint32_t ulCurrentMS = 0;
+static float fNextMatchSS = 0.0;
+/* The last match that was actually serviced, i.e. the start of any gap */
+static uint32_t ulLastMatchS;
+static uint32_t ulLastMatchSS;
+/* Latency of the sampling ISR behind its nominal sample time, as a histogram
+ * since startup and as the maximum (in us) since the last whole second */
+static uint32_t pulJitterHistogram[SAMPLE_JITTER_BINS];
+static uint32_t ulJitterMaxUS = 0;
+/* Set by the sampling ISR when it switches profile, so that this task can
+ * report it (printing from the ISR would block it) */
+static volatile bool bProfileSwitched = false;
+
+
+/*
+ * Writes a gap record to the first sample buffer, marking the interval from
+ * the first missed sample time up to (not including) the next sample time.
+ * The record has the same header as a sample, with SAMPLE_GAP_RATE as the
+ * frequency and the start of the gap as the timestamp. Its payload is the
+ * time sampling resumes (seconds, 4 bytes; subseconds, 2 bytes). The
+ * chSampleGaps counter is also incremented, even if the record doesn't fit
+ * and is dropped.
+ *
+ * This must be called from within a critical section.
+ */
+static void SampleGapRecord(uint32_t ulFromS, uint32_t ulFromSS,
+                            uint32_t ulToS, uint32_t ulToSS) {
+    uint16_t usRateField = SAMPLE_GAP_RATE;
+    uint16_t usSize = SAMPLE_GAP_BYTES;
+    uint32_t ulGapCount = ulChannelValueGet(&chSampleGaps) + 1;
+    volatile RingBuffer_t *pxData = &(pxSampleRateBuffers[0]->xData);
+
+    if (ulRingBufferFree(pxData) >= SAMPLE_GAP_BYTES) {
+        eRingBufferWriteN(pxData, (uint8_t *)(&usRateField),
+                          sizeof(usRateField));
+        eRingBufferWriteN(pxData, (uint8_t *)(&usSize), sizeof(usSize));
+        eRingBufferWriteN(pxData, (uint8_t *)(&ulFromS), sizeof(ulFromS));
+        eRingBufferWriteN(pxData, (uint8_t *)(&ulFromSS), sizeof(uint16_t));
+        eRingBufferWriteN(pxData, (uint8_t *)(&ulToS), sizeof(ulToS));
+        eRingBufferWriteN(pxData, (uint8_t *)(&ulToSS), sizeof(uint16_t));
+    }
+
+    vChannelStore(&chSampleGaps, &ulGapCount);
+}
+
+/*
+ * Adds one sampling latency, in timestamp counter ticks, to the histogram
+ * and the per-second maximum.
+ */
+static void SampleJitterRecord(uint32_t ulTicks) {
+    uint32_t ulUS = ulTicks / (TIMESTAMP_TICKS_PER_S / 1000000);
+    uint32_t ulBin = 0;
+
+    while ((ulUS >> ulBin) && ulBin < SAMPLE_JITTER_BINS - 1) {
+        ulBin++;
+    }
+    pulJitterHistogram[ulBin]++;
+
+    if (ulUS > ulJitterMaxUS) {
+        ulJitterMaxUS = ulUS;
+    }
+}
+
+/*
+ * Resets the sampling schedule so that the next match is taken to be on a
+ * whole second. Called whenever the match is re-armed outside the ISR (the
+ * watchdog below, or a clock step), which always re-arms on a whole second.
+ */
+void vDataSamplingReset(void) {
+    ulCurrentMS = 0;
+    fNextMatchSS = 0.0;
+}
+
 
 /*
  * The hibernate module's real-time clock (RTC) is used to sample data at
@@ -90,28 +188,45 @@ void HibernateIntHandler( void ) {
     uint32_t ulMatchS;
     /* The current subseconds match value for the RTC */
     uint32_t ulMatchSS;
-    /* The next subseconds match value for the RTC, i.e. floor(fNextMatchSS) */
+    /* The next match value for the RTC. ulNextMatchSS is
+     * floor(fNextMatchSS). */
+    uint32_t ulNextMatchS;
     uint32_t ulNextMatchSS;
+    /* The RTC time when the next match is scheduled */
+    uint32_t ulNowS;
+    uint32_t ulNowSS;
+    /* The first sample time that was missed, if any */
+    uint32_t ulMissedS;
+    uint32_t ulMissedSS;
+    /* Number of sample times skipped because they had already passed */
+    uint32_t ulMissedCount;
     /* The minimum sampling period in seconds (e.g. if the fastest channel is
      * 100Hz, ulMinPeriodMS = 10). Also the increment for ulCurrentMS */
     static uint32_t ulMinPeriodMS = 0;
-    /* The fractional part of the current match subseconds */
-    static uint32_t ulCurrentMS = 0;
     /* The value to increment the RTC match by. This is a count of 1/32768ths
      * of a second. */
     static float fIncrementSS = 0.0;
-    /* The next subseconds match value for the RTC (ulMatchSSNext is used) */
-    static float fNextMatchSS = 0.0;
     /* Temp variable for the current sample buffer's rate */
     uint16_t usSampleRateHz;
+    /* Frequency field written to each sample, tagged with the layout ID */
+    uint16_t usRateField;
+    /* Bit i is set if pxSampleRateBuffers[i] is due on this match */
+    uint32_t ulDueMask;
     /* For iteration through sample buffers */
     uint32_t i;
+    /* Timestamp counter at entry and its latency behind the match time */
+    uint64_t ullEntryCounter;
+    uint32_t ulLatencyTicks;
     /* Required to save state when entering a critical section from an ISR */
     UBaseType_t uxSavedInterruptStatus;
     /* Will be set by xTaskNotifyFromISR() if a higher-priority task than the
      * current task should be yielded to by portYIELD_FROM_ISR() */
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
+    /* Read the counter before anything else so that the latency measured
+     * below only includes the time until this ISR started. */
+    ullEntryCounter = ullTimestampCounter();
+
     debug_set_bus( 6 );
 
     /* Ensure write completion before accessing hibernate registers. */
@@ -145,24 +260,66 @@ void HibernateIntHandler( void ) {
         ulMatchS = HibernateRTCMatchGet(0);
         ulMatchSS = HibernateRTCGetSSMatch();
 
-        /* Iterate through the sample buffers, only sampling for them if 
-         * needed. */
+        /* Export the worst latency of the last second, then measure how
+         * late this interrupt was serviced. */
+        if (ulCurrentMS == 0) {
+            vChannelStore(&chSampleJitter, &ulJitterMaxUS);
+            ulJitterMaxUS = 0;
+        }
+        if (bTimestampSinceRTC(ullEntryCounter, ulMatchS, ulMatchSS,
+                               &ulLatencyTicks)) {
+            SampleJitterRecord(ulLatencyTicks);
+        }
+
+        /* Determine which sample buffers are due. A buffer is only sampled
+         * if the current time is divisible by the buffer's sample period. */
+        ulDueMask = 0;
         for (i = 0; i < ucSampleGetBufferCount(); i++) {
             usSampleRateHz = pxSampleRateBuffers[i]->usSampleRateHz;
 
-            /* Only sample this buffer if the current time is divisible by the
-             * buffer's sample frequency. */
             if ( !( ulCurrentMS % (1000/usSampleRateHz) ) ) {
-                /* Ensure an uninterrupted write to the buffer. No other part
-                 * of the application will ever write to a sample buffer, but
-                 * this is needed to ensure that the buffer can't be read when
-                 * a sample has been only partially written. */
-                uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+                ulDueMask |= 1 << i;
+            }
+        }
+
+        /* Ensure an uninterrupted write to the buffers. No other part of the
+         * application will ever write to a sample buffer, but this is needed
+         * to ensure that a buffer can't be read when a sample has been only
+         * partially written. */
+        uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+
+        /* Sampling profiles only change on whole seconds, where every buffer
+         * is due, so every buffer switches layout on the same sample. */
+        if (ulCurrentMS == 0 && bProfileApplyPending()) {
+            bProfileSwitched = true;
+        }
+
+        /* Read every due channel once. All due buffers are then written from
+         * this one snapshot, so values at different rates are simultaneous. */
+        vChannelSnapshot(ulDueMask);
+
+        /* Iterate through the sample buffers, only sampling for them if
+         * needed. */
+        for (i = 0; i < ucSampleGetBufferCount(); i++) {
+            usSampleRateHz = pxSampleRateBuffers[i]->usSampleRateHz;
 
-                /* Write the frequency to the buffer (2 bytes). */
+            /* Buffers whose channels are all within their deadbands are
+             * skipped, as are full buffers. A sample is written whole or not
+             * at all, since a partial one would leave the frame encoder
+             * reading values as headers. */
+            if ( ( ulDueMask & (1 << i) ) &&
+                 ulRingBufferFree(&(pxSampleRateBuffers[i]->xData)) >=
+                 pxSampleRateBuffers[i]->ulSampleSize &&
+                 bChannelSampleDue(pxSampleRateBuffers[i]) ) {
+                usRateField = usSampleRateHz |
+                              ((ulChannelGetLayoutGeneration() &
+                                SAMPLE_LAYOUT_ID_MASK) << SAMPLE_LAYOUT_SHIFT);
+
+                /* Write the frequency and layout ID to the buffer (2
+                 * bytes). */
                 eRingBufferWriteN(&(pxSampleRateBuffers[i]->xData),
-                                  (uint8_t *)(&usSampleRateHz),
-                                  sizeof(usSampleRateHz));
+                                  (uint8_t *)(&usRateField),
+                                  sizeof(usRateField));
 
                 /* Write the sample byte count to the buffer (2 bytes). */
                 eRingBufferWriteN(&(pxSampleRateBuffers[i]->xData),
@@ -178,32 +335,100 @@ void HibernateIntHandler( void ) {
                 /* Sample the channel values themselves. */
                 vChannelSample(pxSampleRateBuffers[i]);
 
-                taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+            } /* if ( ulDueMask & (1 << i) && bChannelSampleDue(...) ) */
+        }
 
-            } /* if (!(ulMatchSS % (uint32_t)(32768 / usSampleRateHz))) */
+        taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
+
+        /* Realign the timestamp service with the RTC once per second, from
+         * the counter read on entry and this match's time. */
+        if (ulCurrentMS == 0) {
+            vTimestampRebase(ullEntryCounter, ulMatchS, ulMatchSS);
         }
 
+        ulLastMatchS = ulMatchS;
+        ulLastMatchSS = ulMatchSS;
+
         /* Set up the next match. The match subseconds value is computed and
-         * stored as a float so that it does not appreciably lose accuracy. */
-        fNextMatchSS = fNextMatchSS + fIncrementSS;
-        ulNextMatchSS = (uint32_t)fNextMatchSS;
-        /* Check if we are within one increment of the next second and update
-         * the RTC match values accordingly. The fractional part of the
-         * subseconds is also updated because it will be needed on the next
-         * interrupt to determine which sample buffers to sample. */
-        if ( ulNextMatchSS > 32768 - (uint32_t)fIncrementSS ) {
+         * stored as a float so that it does not appreciably lose accuracy.
+         * If this ISR ran late enough that the next sample time has already
+         * passed (or is too close to be written in time), that match would
+         * never fire. Such sample times are skipped until one is safely in
+         * the future, and the skipped interval is recorded as a gap. Samples
+         * are never taken for the missed times, since their values would not
+         * match their timestamps. */
+        HibernateRTCGetBoth(&ulNowS, &ulNowSS);
+        /* The margin may carry into the next second, which must be counted
+         * there, or a match at the start of that second would look safe. */
+        ulNowSS += SAMPLE_MATCH_MARGIN_SS;
+        if ( ulNowSS >= 32768 ) {
+            ulNowS++;
+            ulNowSS -= 32768;
+        }
+        ulNextMatchS = ulMatchS;
+        ulMissedCount = 0;
+
+        if ( ulNowS > ulMatchS + 1 ) {
+            /* More than a second behind. Rather than stepping through every
+             * missed sample time, resume on the next whole second. */
+            ulMissedCount = 1;
+            fNextMatchSS = fNextMatchSS + fIncrementSS;
+            ulMissedSS = (uint32_t)fNextMatchSS;
+            ulMissedS = ulMatchS;
+            if ( ulMissedSS > 32768 - (uint32_t)fIncrementSS ) {
+                ulMissedS++;
+                ulMissedSS = 0;
+            }
             ulCurrentMS = 0;
             fNextMatchSS = 0.0;
-            HibernateRTCMatchSet(0, ++ulMatchS);
-            HibernateRTCSSMatchSet(0, 0);
+            ulNextMatchS = ulNowS + 1;
+            ulNextMatchSS = 0;
         }
         else {
-            ulCurrentMS += ulMinPeriodMS;
-            HibernateRTCSSMatchSet(0, ulNextMatchSS);
+            do {
+                if ( ulMissedCount == 1 ) {
+                    ulMissedS = ulNextMatchS;
+                    ulMissedSS = ulNextMatchSS;
+                }
+
+                fNextMatchSS = fNextMatchSS + fIncrementSS;
+                ulNextMatchSS = (uint32_t)fNextMatchSS;
+                /* Check if we are within one increment of the next second and
+                 * update the RTC match values accordingly. The fractional
+                 * part of the subseconds is also updated because it will be
+                 * needed on the next interrupt to determine which sample
+                 * buffers to sample. */
+                if ( ulNextMatchSS > 32768 - (uint32_t)fIncrementSS ) {
+                    ulCurrentMS = 0;
+                    fNextMatchSS = 0.0;
+                    ulNextMatchS++;
+                    ulNextMatchSS = 0;
+                }
+                else {
+                    ulCurrentMS += ulMinPeriodMS;
+                }
+
+                ulMissedCount++;
+            } while ( ulNextMatchS < ulNowS ||
+                      ( ulNextMatchS == ulNowS && ulNextMatchSS <= ulNowSS ) );
+
+            /* The first step is the normal advance to the next match. */
+            ulMissedCount--;
+        }
+
+        if ( ulMissedCount ) {
+            uxSavedInterruptStatus = taskENTER_CRITICAL_FROM_ISR();
+            SampleGapRecord(ulMissedS, ulMissedSS, ulNextMatchS, ulNextMatchSS);
+            taskEXIT_CRITICAL_FROM_ISR(uxSavedInterruptStatus);
         }
 
-        /* Set the MODEM_NOTIFY_SAMPLE bit. */
-        xTaskNotifyFromISR(xModemUARTTaskHandle, MODEM_NOTIFY_SAMPLE, eSetBits,
+        if ( ulNextMatchS != ulMatchS ) {
+            HibernateRTCMatchSet(0, ulNextMatchS);
+        }
+        HibernateRTCSSMatchSet(0, ulNextMatchSS);
+
+        /* Set the STORE_NOTIFY_SAMPLE bit. */
+        xTaskNotifyFromISR(xStoreTaskHandle, STORE_NOTIFY_SAMPLE, eSetBits,
                            &xHigherPriorityTaskWoken);
 
     } /* if (ulStatus == HIBERNATE_INT_RTC_MATCH_0) */
@@ -214,9 +439,9 @@ void HibernateIntHandler( void ) {
 
     debug_set_bus( LAST_PORT_F_VALUE );
 
-    /* If the notification brought the Modem UART task to the ready state,
+    /* If the notification brought the Store task to the ready state,
      * xHigherPriorityTaskWoken will be set to pdTRUE and this call will tell
-     * the scheduler to switch context to the Modem UART task. */
+     * the scheduler to switch context to the Store task. */
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
@@ -231,12 +456,26 @@ void HibernateIntHandler( void ) {
 static void DataTask(void *pvParameters) {
     uint32_t ulS;
     uint32_t ulMatchS;
+    uint32_t ulLoopCount = 0;
+    uint32_t i;
 
     /* Main task loop. The hibernate interrupt does all the sampling work, so
      * the task's only job is to periodically check that sampling is still
-     * running. */
+     * running and to choose the sampling profile. */
     while (1) {
 
+        /* Pick a profile for the current vehicle state. The sampling ISR
+         * switches to it on the next whole second. */
+        vProfileUpdate();
+        if (bProfileSwitched) {
+            bProfileSwitched = false;
+            debug_print("profile %d active\n", ucProfileGetActive());
+        }
+
+        /* Count the day's data use against the budget, which may throttle
+         * sampling further. */
+        vBudgetUpdate();
+
         /* This if statement acts as a "watchdog" for the RTC sampling
          * interrupts. If the program ever hangs and the interrupt fails to
          * trigger, this will reset the match to the next second. This only
@@ -261,6 +500,20 @@ static void DataTask(void *pvParameters) {
                 debug_print("RTC interrupts fell out of sync.\n");
                 debug_print("adjusting match: %d to %d\n", ulMatchS, ulS + 2);
 
+                /* The ISR handles late interrupts itself, so this only
+                 * happens if the match interrupt stopped entirely. Everything
+                 * since the last serviced match is recorded as a gap. */
+                taskENTER_CRITICAL();
+                /* If no match was ever serviced, the gap starts at the
+                 * match that never fired. */
+                if (ulLastMatchS == 0) {
+                    ulLastMatchS = ulMatchS;
+                    ulLastMatchSS = 0;
+                }
+                SampleGapRecord(ulLastMatchS, ulLastMatchSS, ulS + 2, 0);
+                taskEXIT_CRITICAL();
+                vDataSamplingReset();
+
                 /* The hibernate module is a bit buggy on the TM4C (see the
                  * errata document), so to be extra safe we disable the RTC
                  * while reloading the matches. This will rarely need to occur
@@ -276,6 +529,26 @@ static void DataTask(void *pvParameters) {
             IntEnable(INT_HIBERNATE);
         }
 
+        /* Periodically print the sampling latency histogram and the
+         * compression achieved per channel and on the uplink, the flash log
+         * totals, the uplink scheduler's per-stream latency, and how often
+         * the Modem UART task wakes to send and how busy UART6 is, and the
+         * data budget. */
+        if (++ulLoopCount % SAMPLE_JITTER_PRINT_INTERVAL == 0) {
+            debug_print("sampling latency histogram:\n");
+            for (i = 0; i < SAMPLE_JITTER_BINS; i++) {
+                debug_print(">=%dus: %d\n", i ? 1 << (i - 1) : 0,
+                            pulJitterHistogram[i]);
+            }
+            vChannelPrintEncodingStats();
+            vLZPrintStats();
+            vStoreTaskPrintStats();
+            vUplinkPrintStats();
+            vUrgentPrintStats();
+            vModemUARTPrintStats();
+            vBudgetPrintStats();
+        }
+
         /* Run this check every second. */
         vTaskDelay(pdMS_TO_TICKS(1000));
     }
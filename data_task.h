@@ -28,6 +28,7 @@
 
 extern TaskHandle_t xDataTaskHandle;
 
+void vDataSamplingReset(void);
 uint32_t DataTaskInit(void);
 
 #endif /* __DATA_TASK_H__ */
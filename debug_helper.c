@@ -47,6 +47,7 @@
 #include "remote_start_task.h"
 #include "srf_task.h"
 #include "stack_sizes.h"
+#include "store_task.h"
 #include "FreeRTOSConfig.h"
 #include "semphr.h"
 
@@ -74,6 +75,14 @@ volatile uint32_t ulRuntimeStatsCounter = 0;
  * exits. */
 volatile uint32_t ulLastPortFValue = 0;
 
+/* Bounds of the system stack (the .stack section, sized with the linker's
+ * --stack_size), which main() and every ISR run on. The TI linker defines
+ * both symbols. The unused part is filled with SYSTEM_STACK_FILL before the
+ * scheduler starts, so its watermark can be printed like a task's. */
+extern uint32_t __stack;
+extern uint32_t __STACK_END;
+#define SYSTEM_STACK_FILL               0xA5A5A5A5
+
 /*
  * ISR for the runtime stats counter. Configured to interrupt at 10kHz below.
  * Increments ulRuntimeStatsCounter, which serves as a "clock" for the kernel's
@@ -98,6 +107,35 @@ void WTimer2AIntHandler(void) {
     debug_set_bus( LAST_PORT_F_VALUE );
 }
 
+/*
+ * Fills the system stack below the caller's frame with SYSTEM_STACK_FILL.
+ * Interrupts must still be masked.
+ */
+static void DebugFillSystemStack(void) {
+    volatile uint32_t ulMarker = 0;
+    /* Leave room for this function's own frame below the marker */
+    uint32_t *pulEnd = (uint32_t *)&ulMarker - 16;
+    uint32_t *pulWord;
+
+    for (pulWord = &__stack; pulWord < pulEnd; pulWord++) {
+        *pulWord = SYSTEM_STACK_FILL;
+    }
+}
+
+/*
+ * Returns the number of words of the system stack never used since it was
+ * filled.
+ */
+static uint32_t DebugSystemStackWatermark(void) {
+    uint32_t *pulWord = &__stack;
+
+    while (pulWord < &__STACK_END && *pulWord == SYSTEM_STACK_FILL) {
+        pulWord++;
+    }
+
+    return pulWord - &__stack;
+}
+
 /*
  * Prints out the minimum free stack for each task (its "watermark"), alongside
  * the total allocated stack. Also prints the amount of heap free (not a
@@ -115,6 +153,8 @@ void vPrintStackWatermarks( void ) {
     debug_print( "modem uart:  %d / %d\n", uxTaskGetStackHighWaterMark( xModemUARTTaskHandle ), MODEMUARTTASKSTACKSIZE );
     debug_print( "remote:      %d / %d\n", uxTaskGetStackHighWaterMark( xRemoteStartTaskHandle ), REMOTESTARTTASKSTACKSIZE );
     debug_print( "srf:         %d / %d\n", uxTaskGetStackHighWaterMark( xSRFTaskHandle ), SRFTASKSTACKSIZE );
+    debug_print( "store:       %d / %d\n", uxTaskGetStackHighWaterMark( xStoreTaskHandle ), STORETASKSTACKSIZE );
+    debug_print( "system:      %d / %d\n", DebugSystemStackWatermark(), (int)(&__STACK_END - &__stack) );
     debug_print( "free heap:   %d bytes / %d total\n\n", xPortGetFreeHeapSize(), configTOTAL_HEAP_SIZE );
 }
 
@@ -234,6 +274,10 @@ void ConfigureUART0(void) {
  */
 void DebugHelperInit(void) {
 
+    /* Interrupts are still masked. The scheduler resets the system stack
+     * pointer to the top when it starts, so from then on only ISRs use it. */
+    DebugFillSystemStack();
+
     /* Initialize UART0 and configure it for 115,200, 8-N-1 operation. */
     ConfigureUART0();
 
@@ -255,6 +299,7 @@ void DebugHelperInit(void) {
     vTaskSetApplicationTaskTag( xModemUARTTaskHandle,   ( TaskHookFunction_t ) 12 );
     vTaskSetApplicationTaskTag( xRemoteStartTaskHandle, ( TaskHookFunction_t ) 14 );
     vTaskSetApplicationTaskTag( xSRFTaskHandle,         ( TaskHookFunction_t ) 16 );
+    vTaskSetApplicationTaskTag( xStoreTaskHandle,       ( TaskHookFunction_t ) 20 );
 
     DebugHelperGPIOConfigure();
 
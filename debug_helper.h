@@ -58,7 +58,7 @@
             do { if ( DEBUG_TEST ) GPIOPinWrite( GPIO_PORTF_BASE, UINT8_MAX, \
                                                  busValue ); } while (0)
 
-#define NUM_TASKS                       8
+#define NUM_TASKS                       9
 
 
 #ifdef DEBUG
@@ -35,6 +35,7 @@
 #include "driverlib/sysctl.h"
 #include "utils/uartstdio.h"
 #include "analog_task.h"
+#include "budget.h"
 #include "can_task.h"
 #include "channel.h"
 #include "data_task.h"
@@ -44,7 +45,10 @@
 #include "modem_uart_task.h"
 #include "priorities.h"
 #include "remote_start_task.h"
+#include "sink.h"
 #include "srf_task.h"
+#include "store_task.h"
+#include "timestamp.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
@@ -97,6 +101,12 @@ main(void) {
      * call IntEnable() as needed even before that. */
     IntMasterDisable();
 
+    /* Start the timestamp counter before any ISR or task can read it. */
+    vTimestampInit();
+
+    /* Restore the data budget counters from flash (budget.h). */
+    vBudgetInit();
+
     /* Create the Modem UART task (modem_uart_task.h). */
     if(ModemUARTTaskInit() != 0) { while(1) {} }
 
@@ -115,6 +125,9 @@ main(void) {
     /* Create the Remote Start task (remote_start_task.h). */
     if(RemoteStartTaskInit() != 0) { while(1) {} }
 
+    /* Create the uplink record routing task (store_task.h). */
+    if(StoreTaskInit() != 0) { while(1) {} }
+
     /* Create the data collection task (data_task.h). */
     if(DataTaskInit() != 0) { while(1) {} }
 
@@ -127,6 +140,13 @@ main(void) {
     IntPrioritySet( INT_HIBERNATE, PRIORITY_DATA_SAMPLING_INT << 5 );
     IntPrioritySet( INT_CAN0, PRIORITY_CAN0_INT << 5 );
     IntPrioritySet( INT_WTIMER1A, PRIORITY_IGNITION_TIMER_INT << 5 );
+    IntPrioritySet( INT_ADC0SS0, PRIORITY_ADC_INT << 5 );
+    IntPrioritySet( INT_ADC0SS1, PRIORITY_ADC_INT << 5 );
+#ifdef LOCAL_SINK
+    /* The sink ISR makes no API calls, but at its baud rate it must not
+     * delay sampling either. */
+    IntPrioritySet( INT_UART0, PRIORITY_SINK_UART_INT << 5 );
+#endif
 
     /* The xTaskCreate() calls have globally masked interrupts using PRIMASK,
      * so these will not trigger until vTaskStartScheduler() unmasks them
@@ -136,6 +156,9 @@ main(void) {
     /* Initialize the debug helper. */
     debug_init();
 
+    /* Initialize the local sink (sink.h), which uses UART0 instead. */
+    sink_init();
+
     /* Start the scheduler. This should not return. */
     vTaskStartScheduler();
 
@@ -72,5 +72,9 @@
 #define EXPLORERLINK_MAIN_H_
 
 
+/* Firmware version, sent to the server in the schema (see schema.h). The
+ * upper byte is the major version and the lower byte the minor version. */
+#define EXPLORERLINK_FIRMWARE_VERSION   0x0100
+
 
 #endif /* EXPLORERLINK_MAIN_H_ */
@@ -0,0 +1,384 @@
+/*
+ * frame.c
+ * Packs consecutive samples from a sample buffer into batched frames, so that
+ * the rate, size and timestamp header is sent once per frame rather than once
+ * per sample, and delta encodes the channel values within each frame. See
+ * frame.h for the format.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "channel.h"
+#include "frame.h"
+#include "ring_buffer.h"
+#include "sample.h"
+#include "schema.h"
+
+
+/* Subsecond counts per second of the RTC (32768Hz clock) */
+#define RTC_SS_PER_S                    32768
+
+
+/*
+ * Returns the time from the first sample in the frame to the given time, in
+ * RTC subseconds. Times before the first sample (after a clock step) give
+ * very large values.
+ */
+static uint32_t FrameElapsedSS(Frame_t *pxFrame, uint32_t ulS, uint32_t ulSS) {
+    return (ulS - pxFrame->ulBaseS) * RTC_SS_PER_S + ulSS - pxFrame->ulBaseSS;
+}
+
+/*
+ * Returns the number of bytes at the end of the frame's buffer holding the
+ * previous sample's payload (see Frame_t).
+ */
+static uint32_t FramePreviousBytes(Frame_t *pxFrame) {
+    return (pxFrame->ucLayout == FRAME_LAYOUT_DELTA) ?
+           pxFrame->usPayloadBytes : 0;
+}
+
+/*
+ * Returns where the previous sample's payload is kept (see Frame_t).
+ */
+static uint8_t *FramePrevious(Frame_t *pxFrame) {
+    return pxFrame->pucData + FRAME_MAX_BYTES - FramePreviousBytes(pxFrame);
+}
+
+/*
+ * Returns where the offset of sample ulIndex is kept until the frame is
+ * finished (see Frame_t).
+ */
+static uint8_t *FrameOffset(Frame_t *pxFrame, uint32_t ulIndex) {
+    return FramePrevious(pxFrame) - (ulIndex + 1) * sizeof(uint16_t);
+}
+
+/*
+ * Starts a new frame with the passed record as its first sample. The frame
+ * references the schema, and is delta encoded, if the schema's layout is
+ * known to be the one the record was sampled with: the layout ID matches and
+ * the channel widths add up to the payload length. The schema is rebuilt
+ * first if the layout has changed. Records sampled before a layout change
+ * (still buffered when the layout is recomputed) are sent raw, with no
+ * schema.
+ */
+static void FrameStart(Frame_t *pxFrame, SampleRateBuffer_t *pxBuffer,
+                       uint16_t usRateField, uint16_t usPayloadBytes,
+                       uint32_t ulS, uint32_t ulSS) {
+    uint8_t ucLayoutID;
+    uint32_t ulWidthSum = 0;
+    uint32_t ulWidth;
+    uint32_t j;
+
+    pxFrame->usRateField = usRateField;
+    pxFrame->usPayloadBytes = usPayloadBytes;
+    pxFrame->ulBaseS = ulS;
+    pxFrame->ulBaseSS = ulSS;
+    pxFrame->ulLength = FRAME_HEADER_BYTES;
+    pxFrame->usMaxDeltaBytes = 0;
+
+    bSchemaUpdate();
+    pxFrame->ucChannelCount = ulSchemaGetLayout(pxBuffer,
+                                                pxFrame->pxChannels,
+                                                FRAME_MAX_CHANNELS,
+                                                &ucLayoutID);
+
+    for (j = 0; j < pxFrame->ucChannelCount; j++) {
+        ulWidth = pxFrame->pxChannels[j]->ucByteCount;
+        ulWidthSum += ulWidth;
+        /* A width of w bytes gives a zigzag value of up to 8w + 1 bits */
+        pxFrame->usMaxDeltaBytes += (ulWidth * 8 + 1 + 6) / 7;
+    }
+
+    if (pxFrame->ucChannelCount &&
+        ucLayoutID == (usRateField >> SAMPLE_LAYOUT_SHIFT) &&
+        ulWidthSum == usPayloadBytes) {
+        pxFrame->usSchemaHash = usSchemaGetHash();
+    }
+    else {
+        pxFrame->usSchemaHash = 0;
+    }
+
+    if (pxFrame->usSchemaHash && usPayloadBytes <= FRAME_MAX_PAYLOAD_BYTES) {
+        pxFrame->ucLayout = FRAME_LAYOUT_DELTA;
+    }
+    else {
+        pxFrame->ucLayout = FRAME_LAYOUT_RAW;
+    }
+}
+
+/*
+ * Writes the change of each channel from pucPrevious to pucCurrent as a
+ * zigzag varint (see frame.h) and returns the number of bytes written. This
+ * runs for every sample on the upload path, so it sticks to shifts and
+ * masks.
+ */
+static uint32_t FrameDeltaEncode(Frame_t *pxFrame, uint8_t *pucOut,
+                                 uint8_t *pucCurrent) {
+    uint8_t *pucPrevious = FramePrevious(pxFrame);
+    volatile Channel_t *pxCh;
+    uint32_t ulPos = 0;
+    uint32_t ulChannelStart;
+    uint32_t ulOffset = 0;
+    uint32_t ulWidth;
+    uint32_t ulShift;
+    uint32_t ulNew;
+    uint32_t ulOld;
+    int32_t lDelta;
+    uint32_t ulZigzag;
+    uint32_t j;
+
+    for (j = 0; j < pxFrame->ucChannelCount; j++) {
+        pxCh = pxFrame->pxChannels[j];
+        ulWidth = pxCh->ucByteCount;
+        ulShift = 32 - ulWidth * 8;
+        ulChannelStart = ulPos;
+
+        ulNew = 0;
+        ulOld = 0;
+        memcpy(&ulNew, pucCurrent + ulOffset, ulWidth);
+        memcpy(&ulOld, pucPrevious + ulOffset, ulWidth);
+
+        /* Sign-extend the difference from the channel's width, so small
+         * changes in either direction give small values. */
+        lDelta = (int32_t)((ulNew - ulOld) << ulShift) >> ulShift;
+        ulZigzag = ((uint32_t)lDelta << 1) ^ (uint32_t)(lDelta >> 31);
+
+        while (ulZigzag >= 0x80) {
+            pucOut[ulPos++] = (ulZigzag & 0x7F) | 0x80;
+            ulZigzag >>= 7;
+        }
+        pucOut[ulPos++] = ulZigzag;
+
+        pxCh->ulEncodedRawBytes += ulWidth;
+        pxCh->ulEncodedBytes += ulPos - ulChannelStart;
+        ulOffset += ulWidth;
+    }
+
+    return ulPos;
+}
+
+/*
+ * Reads the next sample's payload from the sample buffer into the frame,
+ * encoding it for the frame's layout.
+ */
+static void FrameAddPayload(Frame_t *pxFrame, SampleRateBuffer_t *pxBuffer) {
+    /* Only the Store task encodes frames, so one scratch copy of the
+     * current sample serves all of them. */
+    static uint8_t pucCurrent[FRAME_MAX_PAYLOAD_BYTES];
+    uint32_t j;
+
+    if (pxFrame->ucLayout == FRAME_LAYOUT_RAW) {
+        eRingBufferReadN(&(pxBuffer->xData),
+                         pxFrame->pucData + pxFrame->ulLength,
+                         pxFrame->usPayloadBytes);
+        pxFrame->ulLength += pxFrame->usPayloadBytes;
+        return;
+    }
+
+    eRingBufferReadN(&(pxBuffer->xData), pucCurrent, pxFrame->usPayloadBytes);
+
+    /* The first sample is a keyframe with every value at full width. */
+    if (pxFrame->ucCount == 0) {
+        memcpy(pxFrame->pucData + pxFrame->ulLength, pucCurrent,
+               pxFrame->usPayloadBytes);
+        pxFrame->ulLength += pxFrame->usPayloadBytes;
+        for (j = 0; j < pxFrame->ucChannelCount; j++) {
+            pxFrame->pxChannels[j]->ulEncodedRawBytes +=
+                pxFrame->pxChannels[j]->ucByteCount;
+            pxFrame->pxChannels[j]->ulEncodedBytes +=
+                pxFrame->pxChannels[j]->ucByteCount;
+        }
+    }
+    else {
+        pxFrame->ulLength += FrameDeltaEncode(pxFrame,
+                                              pxFrame->pucData +
+                                              pxFrame->ulLength,
+                                              pucCurrent);
+    }
+
+    memcpy(FramePrevious(pxFrame), pucCurrent, pxFrame->usPayloadBytes);
+}
+
+/*
+ * Fills in the header (and offsets, if needed) of the frame being built and
+ * returns its total length. The frame is left in pucData for the caller to
+ * send, and the next sample added starts a new frame.
+ */
+static uint32_t FrameFinish(Frame_t *pxFrame) {
+    uint8_t ucVersion = pxFrame->ucLayout;
+    uint16_t usSize;
+    uint16_t usFirst;
+    uint16_t usLast;
+    uint32_t j;
+
+    /* The offsets are kept last sample lowest, so they are put in order
+     * where they are, then moved down to follow the payloads. The two areas
+     * can overlap. */
+    if (pxFrame->bJitter) {
+        ucVersion |= FRAME_FLAG_JITTER;
+        for (j = 0; j < pxFrame->ucCount / 2; j++) {
+            memcpy(&usFirst, FrameOffset(pxFrame, j), sizeof(uint16_t));
+            memcpy(&usLast, FrameOffset(pxFrame, pxFrame->ucCount - 1 - j),
+                   sizeof(uint16_t));
+            memcpy(FrameOffset(pxFrame, j), &usLast, sizeof(uint16_t));
+            memcpy(FrameOffset(pxFrame, pxFrame->ucCount - 1 - j), &usFirst,
+                   sizeof(uint16_t));
+        }
+        memmove(pxFrame->pucData + pxFrame->ulLength,
+                FrameOffset(pxFrame, pxFrame->ucCount - 1),
+                pxFrame->ucCount * sizeof(uint16_t));
+        pxFrame->ulLength += pxFrame->ucCount * sizeof(uint16_t);
+    }
+
+    usSize = pxFrame->ulLength;
+    memcpy(pxFrame->pucData, &(pxFrame->usRateField), 2);
+    memcpy(pxFrame->pucData + 2, &usSize, 2);
+    memcpy(pxFrame->pucData + 4, &(pxFrame->ulBaseS), 4);
+    memcpy(pxFrame->pucData + 8, &(pxFrame->ulBaseSS), 2);
+    pxFrame->pucData[10] = ucVersion;
+    pxFrame->pucData[11] = pxFrame->ucCount;
+    memcpy(pxFrame->pucData + 12, &(pxFrame->usSchemaHash), 2);
+
+    pxFrame->ucCount = 0;
+    pxFrame->bJitter = false;
+
+    return usSize;
+}
+
+/*
+ * Moves sample records from a sample buffer into the buffer's frame. Returns
+ * the length of a record that is ready to send, which the caller must send
+ * from *ppucOut before calling again, or 0 once the sample buffer is empty
+ * and nothing is ready. The caller should keep calling until 0 is returned.
+ *
+ * A frame is ready when it spans FRAME_MAX_SPAN_SS, when it is full, or when
+ * the next sample can't be added to it (a layout change). A frame that has
+ * had no new samples for FRAME_MAX_SPAN_SS of the current time (ulNowS and
+ * ulNowSS) is also sent, so deadbanded buffers don't hold samples back.
+ * Gap records are returned unchanged, after any frame before them.
+ *
+ * Only the Store task reads the sample buffers. The sampling ISR writes whole
+ * records within critical sections, so a record's header is never read
+ * without its payload being available.
+ */
+uint32_t ulFrameEncode(Frame_t *pxFrame, SampleRateBuffer_t *pxBuffer,
+                       uint32_t ulNowS, uint32_t ulNowSS, uint8_t **ppucOut) {
+    /* Fields of the record being added */
+    uint16_t usRateField;
+    uint16_t usSize;
+    uint16_t usPayloadBytes;
+    uint32_t ulS;
+    uint32_t ulSS = 0;
+    uint32_t ulRateHz;
+    /* Time of the record from the start of the frame, and the time implied
+     * by its position in the frame, in RTC subseconds */
+    uint32_t ulOffset = 0;
+    uint32_t ulImplied;
+    /* Most bytes the record can add to the frame's payloads */
+    uint32_t ulMaxBytes;
+
+    *ppucOut = pxFrame->pucData;
+
+    while (1) {
+        if (!pxFrame->bPending) {
+            if (eRingBufferReadN(&(pxBuffer->xData), pxFrame->pucPending,
+                                 SAMPLE_METADATA_BYTES) == BUFFER_EMPTY) {
+                break;
+            }
+            pxFrame->bPending = true;
+        }
+
+        memcpy(&usRateField, pxFrame->pucPending, 2);
+        memcpy(&usSize, pxFrame->pucPending + 2, 2);
+        memcpy(&ulS, pxFrame->pucPending + 4, 4);
+        memcpy(&ulSS, pxFrame->pucPending + 8, 2);
+        usPayloadBytes = usSize - SAMPLE_METADATA_BYTES;
+        ulRateHz = usRateField & SAMPLE_RATE_MASK;
+
+        /* Gap records are sent as they are, in order with the samples. */
+        if (ulRateHz == SAMPLE_GAP_RATE) {
+            if (pxFrame->ucCount) {
+                return FrameFinish(pxFrame);
+            }
+            memcpy(pxFrame->pucData, pxFrame->pucPending,
+                   SAMPLE_METADATA_BYTES);
+            eRingBufferReadN(&(pxBuffer->xData),
+                             pxFrame->pucData + SAMPLE_METADATA_BYTES,
+                             usPayloadBytes);
+            pxFrame->bPending = false;
+            return usSize;
+        }
+
+        if (pxFrame->ucCount) {
+            ulOffset = FrameElapsedSS(pxFrame, ulS, ulSS);
+            ulMaxBytes = (pxFrame->ucLayout == FRAME_LAYOUT_DELTA) ?
+                         pxFrame->usMaxDeltaBytes : usPayloadBytes;
+
+            /* The sample must share the frame's layout (the layout ID is
+             * part of the rate field) and fit clear of the tail, including
+             * its offset. */
+            if (usRateField != pxFrame->usRateField ||
+                usPayloadBytes != pxFrame->usPayloadBytes ||
+                ulOffset >= FRAME_MAX_SPAN_SS ||
+                pxFrame->ucCount == FRAME_MAX_SAMPLES ||
+                pxFrame->ulLength + ulMaxBytes +
+                (pxFrame->ucCount + 1) * sizeof(uint16_t) +
+                FramePreviousBytes(pxFrame) > FRAME_MAX_BYTES) {
+                return FrameFinish(pxFrame);
+            }
+        }
+        else {
+            /* Start a new frame. A sample always fits in an empty frame,
+             * since a buffer's samples are much smaller than a frame. */
+            FrameStart(pxFrame, pxBuffer, usRateField, usPayloadBytes, ulS,
+                       ulSS);
+            ulOffset = 0;
+        }
+
+        FrameAddPayload(pxFrame, pxBuffer);
+        pxFrame->bPending = false;
+
+        /* Sample times are rounded down to whole subseconds, so a sample on
+         * schedule can be a subsecond off the implied time. */
+        ulImplied = (pxFrame->ucCount * RTC_SS_PER_S) / ulRateHz;
+        if (ulOffset > ulImplied + 1 || ulOffset + 1 < ulImplied) {
+            pxFrame->bJitter = true;
+        }
+        memcpy(FrameOffset(pxFrame, pxFrame->ucCount), &ulOffset,
+               sizeof(uint16_t));
+        pxFrame->ucCount++;
+
+        /* Send the frame now if the next sample would fall outside its
+         * span, rather than waiting for that sample to arrive. */
+        if (ulOffset + (RTC_SS_PER_S + ulRateHz - 1) / ulRateHz >=
+            FRAME_MAX_SPAN_SS) {
+            return FrameFinish(pxFrame);
+        }
+    }
+
+    if (pxFrame->ucCount &&
+        FrameElapsedSS(pxFrame, ulNowS, ulNowSS) >= FRAME_MAX_SPAN_SS) {
+        return FrameFinish(pxFrame);
+    }
+
+    return 0;
+}
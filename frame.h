@@ -0,0 +1,128 @@
+/*
+ * frame.h
+ * Definitions for the batched sample frame format and its encoder.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "channel.h"
+#include "sample.h"
+
+
+/* A frame carries consecutive samples of one buffer behind a single header:
+ *
+ *   rate (2 bytes)        frequency and layout ID, as in a sample
+ *   size (2 bytes)        total frame length in bytes
+ *   timestamp (6 bytes)   time of the first sample
+ *   version (1 byte)      layout of the payloads, plus FRAME_FLAG_JITTER
+ *   count (1 byte)        number of samples
+ *   schema (2 bytes)      hash of the schema (see schema.h) describing the
+ *                         samples' channels, or 0 if none does
+ *   payloads              count sample payloads
+ *   offsets               only with FRAME_FLAG_JITTER: count offsets (2 bytes
+ *                         each) of each sample from the first, in RTC
+ *                         subseconds
+ *
+ * With FRAME_LAYOUT_RAW, every payload holds the channel values at their full
+ * width, as in a sample. With FRAME_LAYOUT_DELTA, only the first payload does
+ * (a keyframe, so every frame decodes on its own). Each later payload holds,
+ * per channel, the change from the previous sample: the difference modulo
+ * the channel's width, sign-extended from that width, zigzag-encoded
+ * ((d << 1) ^ (d >> 31)) and written as a varint (7 bits per byte, least
+ * significant first, high bit set on all but the last byte). Decoding needs
+ * the channel widths of the sample's layout, which the schema gives for the
+ * frame's rate. Delta encoded frames always reference a schema.
+ *
+ * Without FRAME_FLAG_JITTER, sample k was taken k * 32768 / rate subseconds
+ * (rounded down) after the first. The jitter flag is set when any sample is
+ * off that schedule by more than a subsecond, which happens when samples
+ * are skipped for deadbands or missed ticks.
+ *
+ * Gap records pass through the encoder unchanged, and are told apart from
+ * frames by their rate field (SAMPLE_GAP_RATE). The host-side decoder is in
+ * host/frame_decode.c. */
+#define FRAME_HEADER_BYTES              14
+#define FRAME_LAYOUT_RAW                1
+#define FRAME_LAYOUT_DELTA              2
+#define FRAME_FLAG_JITTER               0x80
+#define FRAME_VERSION_MASK              0x7F
+
+/* Largest frame, including the header and any offsets */
+#define FRAME_MAX_BYTES                 512
+/* Most samples in one frame */
+#define FRAME_MAX_SAMPLES               64
+/* Most channels and payload bytes in a sample for it to be delta encoded.
+ * Larger samples are sent raw. A delta encoded frame keeps a copy of the
+ * previous payload in its unused tail (see Frame_t), so the keyframe, that
+ * copy and one offset must fit an empty frame. */
+#define FRAME_MAX_CHANNELS              32
+#define FRAME_MAX_PAYLOAD_BYTES         128
+/* A frame is sent once it spans this many RTC subseconds (1 second), which
+ * bounds the latency batching adds. */
+#define FRAME_MAX_SPAN_SS               32768
+
+
+typedef struct {
+    /* The frame being built. The header is filled in when it is finished.
+     * Until then, the end of the buffer holds the previous sample's payload,
+     * which deltas are taken against (FRAME_LAYOUT_DELTA only), and below it
+     * the offset of each sample from the first, in RTC subseconds, last
+     * sample lowest. Samples are only added while the payloads stay clear
+     * of this tail, and the offsets are moved after the payloads when the
+     * frame is finished. */
+    uint8_t pucData[FRAME_MAX_BYTES];
+    /* Bytes of pucData in use, including the (unwritten) header */
+    uint32_t ulLength;
+    /* Number of samples in the frame */
+    uint8_t ucCount;
+    /* Whether any sample is off the implied schedule */
+    bool bJitter;
+    /* Payload layout (FRAME_LAYOUT_RAW or FRAME_LAYOUT_DELTA) */
+    uint8_t ucLayout;
+    /* Channels making up each sample, as given by the schema, and the most
+     * bytes a delta encoded sample can take (used with FRAME_LAYOUT_DELTA
+     * only) */
+    volatile Channel_t *pxChannels[FRAME_MAX_CHANNELS];
+    uint8_t ucChannelCount;
+    uint16_t usMaxDeltaBytes;
+    /* Hash of the schema the frame's layout came from, or 0 */
+    uint16_t usSchemaHash;
+    /* Rate field and payload length shared by every sample in the frame */
+    uint16_t usRateField;
+    uint16_t usPayloadBytes;
+    /* Timestamp of the first sample */
+    uint32_t ulBaseS;
+    uint32_t ulBaseSS;
+    /* Header of a record read from the sample buffer but not yet added,
+     * because the frame had to be sent first */
+    uint8_t pucPending[SAMPLE_METADATA_BYTES];
+    bool bPending;
+} Frame_t;
+
+
+uint32_t ulFrameEncode(Frame_t *pxFrame, SampleRateBuffer_t *pxBuffer,
+                       uint32_t ulNowS, uint32_t ulNowSS, uint8_t **ppucOut);
+
+
+#endif /* FRAME_H_ */
@@ -0,0 +1,293 @@
+/*
+ * ack_server.c
+ * Stand-in server for the TCP stream (see ack_server.h). Packets are found
+ * with host/stream_decode.c and compressed blocks expanded with
+ * host/lz_decode.c. A packet is only acknowledged once everything in it has
+ * been unpacked, so a compressed block that continues a record from a lost
+ * block is left for the device to send again.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "ack_server.h"
+
+
+/* Rate field of a compressed block, and the bits of the field holding the
+ * rate (see host/frame_decode.h) */
+#define ACK_LZ_RATE                     0x0FFD
+#define ACK_RATE_MASK                   0x0FFF
+
+/* How far behind the connection's packets the cumulative sequence number is
+ * put when it isn't known. The device's window never spans this many
+ * packets, so nothing is acknowledged by it. */
+#define ACK_UNKNOWN_OFFSET              0x4000
+
+
+/*
+ * Returns the little-endian 16-bit field at pucBytes.
+ */
+static uint16_t AckGet16(const uint8_t *pucBytes) {
+    return pucBytes[0] | (pucBytes[1] << 8);
+}
+
+/*
+ * Adds the bytes of a decompressed block to the record being put back
+ * together, passing each completed record to the callback. Returns false if
+ * a record header can't be right.
+ */
+static bool AckServerCollect(AckServer_t *pxServer, const uint8_t *pucData,
+                             uint32_t ulBytes) {
+    uint32_t ulWanted;
+    uint32_t ulRecordLength;
+
+    while (ulBytes) {
+        /* The size field comes first, then the rest of the record. */
+        if (pxServer->ulRecordBytes < STREAM_MIN_RECORD_BYTES) {
+            ulWanted = STREAM_MIN_RECORD_BYTES - pxServer->ulRecordBytes;
+        }
+        else {
+            ulRecordLength = AckGet16(pxServer->pucRecord + 2);
+            if (ulRecordLength < STREAM_MIN_RECORD_BYTES ||
+                ulRecordLength > STREAM_MAX_RECORD_BYTES) {
+                return false;
+            }
+            ulWanted = ulRecordLength - pxServer->ulRecordBytes;
+        }
+
+        if (ulWanted > ulBytes) {
+            ulWanted = ulBytes;
+        }
+
+        memcpy(pxServer->pucRecord + pxServer->ulRecordBytes, pucData,
+               ulWanted);
+        pxServer->ulRecordBytes += ulWanted;
+        pucData += ulWanted;
+        ulBytes -= ulWanted;
+
+        if (pxServer->ulRecordBytes >= STREAM_MIN_RECORD_BYTES &&
+            pxServer->ulRecordBytes ==
+            AckGet16(pxServer->pucRecord + 2)) {
+            pxServer->pxCallback(pxServer->pucRecord,
+                                 pxServer->ulRecordBytes,
+                                 pxServer->pvContext);
+            pxServer->xStats.ulRecords++;
+            pxServer->ulRecordBytes = 0;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Unpacks the record carried by a packet. Returns false if any of it
+ * couldn't be used.
+ */
+static bool AckServerUnpack(AckServer_t *pxServer,
+                            const StreamPacket_t *pxPacket) {
+    uint8_t pucBlock[LZ_BLOCK_BYTES];
+    int32_t lBlockBytes;
+
+    /* A record split across blocks can't be finished if any packet went
+     * missing since it started. */
+    if (pxPacket->ulLostPackets || pxPacket->ulSkippedBytes) {
+        pxServer->bRecordValid = false;
+    }
+
+    if ((AckGet16(pxPacket->pucRecord) & ACK_RATE_MASK) != ACK_LZ_RATE) {
+        pxServer->pxCallback(pxPacket->pucRecord, pxPacket->ulLength,
+                             pxServer->pvContext);
+        pxServer->xStats.ulRecords++;
+        return true;
+    }
+
+    lBlockBytes = lLZDecompress(pxPacket->pucRecord, pxPacket->ulLength,
+                                pucBlock, sizeof(pucBlock));
+    if (lBlockBytes < 0) {
+        pxServer->bRecordValid = false;
+        return false;
+    }
+
+    if (!bLZContinued(pxPacket->pucRecord)) {
+        pxServer->ulRecordBytes = 0;
+        pxServer->bRecordValid = true;
+    }
+    else if (!pxServer->bRecordValid) {
+        return false;
+    }
+
+    if (!AckServerCollect(pxServer, pucBlock, lBlockBytes)) {
+        pxServer->bRecordValid = false;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Notes that a packet was unpacked, advancing the cumulative point or adding
+ * it to the selective list. The device never resends a packet on the same
+ * connection, so once a packet is missed the cumulative point stays behind it
+ * and everything after is acknowledged selectively.
+ */
+static void AckServerMark(AckServer_t *pxServer, uint16_t usSeq,
+                          bool bFirst) {
+
+    if (!pxServer->bCumulativeKnown && bFirst) {
+        pxServer->bCumulativeKnown = true;
+        pxServer->usCumulative = usSeq;
+        pxServer->bCumulativeChanged = true;
+    }
+    else if (pxServer->bCumulativeKnown &&
+             usSeq == (uint16_t)(pxServer->usCumulative + 1)) {
+        pxServer->usCumulative = usSeq;
+        pxServer->bCumulativeChanged = true;
+    }
+    /* A full list just leaves the packet unacknowledged, and its records are
+     * sent again. */
+    else if (pxServer->ulSelectiveCount < ACK_MAX_SELECTIVE) {
+        pxServer->pusSelective[pxServer->ulSelectiveCount++] = usSeq;
+    }
+}
+
+/*
+ * Prepares a server with no connection. pxCallback is given every record
+ * unpacked.
+ */
+void vAckServerInit(AckServer_t *pxServer, AckRecordCallback_t pxCallback,
+                    void *pvContext) {
+    memset(pxServer, 0, sizeof(AckServer_t));
+    pxServer->pxCallback = pxCallback;
+    pxServer->pvContext = pvContext;
+    vAckServerConnect(pxServer);
+    pxServer->xStats.ulConnections = 0;
+}
+
+/*
+ * Starts a new connection. Acknowledgements only cover packets received on
+ * the connection they are sent on.
+ */
+void vAckServerConnect(AckServer_t *pxServer) {
+    vStreamInit(&(pxServer->xStream));
+    pxServer->ulInputBytes = 0;
+    pxServer->ulRecordBytes = 0;
+    pxServer->bRecordValid = false;
+    pxServer->bCumulativeKnown = false;
+    pxServer->usCumulative = 0;
+    pxServer->bCumulativeChanged = false;
+    pxServer->ulSelectiveCount = 0;
+    pxServer->xStats.ulConnections++;
+}
+
+/*
+ * Takes bytes received on the current connection, unpacking every complete
+ * packet among them.
+ */
+void vAckServerReceive(AckServer_t *pxServer, const uint8_t *pucData,
+                       uint32_t ulBytes) {
+    StreamPacket_t xPacket;
+    uint32_t ulChunk;
+    uint32_t ulConsumed;
+    bool bFirst;
+
+    while (ulBytes) {
+        ulChunk = ACK_INPUT_BYTES - pxServer->ulInputBytes;
+        if (ulChunk > ulBytes) {
+            ulChunk = ulBytes;
+        }
+
+        memcpy(pxServer->pucInput + pxServer->ulInputBytes, pucData, ulChunk);
+        pxServer->ulInputBytes += ulChunk;
+        pucData += ulChunk;
+        ulBytes -= ulChunk;
+
+        while (1) {
+            /* The connection's first packet is only trusted to be first if
+             * nothing was skipped before it. */
+            bFirst = !pxServer->xStream.bSynced &&
+                     !pxServer->xStream.ulSkippedBytes;
+
+            if (!bStreamNextPacket(&(pxServer->xStream), pxServer->pucInput,
+                                   pxServer->ulInputBytes, &xPacket,
+                                   &ulConsumed)) {
+                break;
+            }
+
+            pxServer->xStats.ulPackets++;
+            pxServer->xStats.ulSkippedBytes += xPacket.ulSkippedBytes;
+            bFirst = bFirst && !xPacket.ulSkippedBytes;
+
+            if (AckServerUnpack(pxServer, &xPacket)) {
+                AckServerMark(pxServer, xPacket.usSeq, bFirst);
+            }
+            else {
+                pxServer->xStats.ulUnusablePackets++;
+            }
+
+            memmove(pxServer->pucInput, pxServer->pucInput + ulConsumed,
+                    pxServer->ulInputBytes - ulConsumed);
+            pxServer->ulInputBytes -= ulConsumed;
+        }
+
+        /* Skipped bytes are done with even when no packet was found. */
+        memmove(pxServer->pucInput, pxServer->pucInput + ulConsumed,
+                pxServer->ulInputBytes - ulConsumed);
+        pxServer->ulInputBytes -= ulConsumed;
+    }
+}
+
+/*
+ * Writes the next acknowledgement line for the device into pcLine, which
+ * must hold ACK_MAX_LINE_BYTES. Returns its length, or 0 if there is nothing
+ * new to acknowledge.
+ */
+uint32_t ulAckServerGetAck(AckServer_t *pxServer, char *pcLine) {
+    uint16_t usCumulative;
+    uint32_t ulLength;
+    uint32_t i;
+
+    if (!pxServer->bCumulativeChanged && !pxServer->ulSelectiveCount) {
+        return 0;
+    }
+
+    if (pxServer->bCumulativeKnown) {
+        usCumulative = pxServer->usCumulative;
+    }
+    else {
+        usCumulative = pxServer->pusSelective[0] - ACK_UNKNOWN_OFFSET;
+    }
+
+    ulLength = sprintf(pcLine, "YYYk%u", usCumulative);
+    for (i = 0; i < pxServer->ulSelectiveCount; i++) {
+        ulLength += sprintf(pcLine + ulLength, ",%u",
+                            pxServer->pusSelective[i]);
+    }
+    ulLength += sprintf(pcLine + ulLength, "\n");
+
+    /* The device keeps what it has been told, so each packet only needs to
+     * be listed once. */
+    pxServer->bCumulativeChanged = false;
+    pxServer->ulSelectiveCount = 0;
+    pxServer->xStats.ulAckLines++;
+
+    return ulLength;
+}
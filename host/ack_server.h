@@ -0,0 +1,96 @@
+/*
+ * ack_server.h
+ * A stand-in for the server's end of the TCP stream, which unpacks packets
+ * into records and acknowledges them the way the device's upload window
+ * (window.h) expects.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACK_SERVER_H_
+#define ACK_SERVER_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lz_decode.h"
+#include "stream_decode.h"
+
+
+/* These mirror the device's definitions in window.h. */
+#define ACK_MAX_SELECTIVE               8
+#define ACK_MAX_LINE_BYTES              64
+
+/* Received bytes held while a packet is incomplete */
+#define ACK_INPUT_BYTES                 (2 * STREAM_MAX_RECORD_BYTES)
+
+
+/* Called with each record unpacked from the stream. Records resent after a
+ * reconnect arrive again, so the callback must tolerate duplicates (frames
+ * can be matched by their start time). */
+typedef void (*AckRecordCallback_t)(const uint8_t *pucRecord,
+                                    uint32_t ulLength, void *pvContext);
+
+/* Totals since the server was initialized */
+typedef struct {
+    uint32_t ulConnections;
+    uint32_t ulPackets;
+    uint32_t ulRecords;
+    /* Packets that arrived but couldn't be unpacked, so were never
+     * acknowledged */
+    uint32_t ulUnusablePackets;
+    uint32_t ulSkippedBytes;
+    uint32_t ulAckLines;
+} AckServerStats_t;
+
+typedef struct {
+    StreamState_t xStream;
+    uint8_t pucInput[ACK_INPUT_BYTES];
+    uint32_t ulInputBytes;
+
+    /* Records spanning compressed blocks are put back together here */
+    uint8_t pucRecord[STREAM_MAX_RECORD_BYTES];
+    uint32_t ulRecordBytes;
+    bool bRecordValid;
+
+    /* Every packet up to and including usCumulative arrived and was
+     * unpacked on this connection. Not known until the connection's first
+     * packet arrives with nothing before it. */
+    bool bCumulativeKnown;
+    uint16_t usCumulative;
+    bool bCumulativeChanged;
+    /* Packets after a gap, not yet acknowledged. ulAckServerGetAck() should
+     * be called after each vAckServerReceive() so this doesn't fill. */
+    uint16_t pusSelective[ACK_MAX_SELECTIVE];
+    uint32_t ulSelectiveCount;
+
+    AckRecordCallback_t pxCallback;
+    void *pvContext;
+    AckServerStats_t xStats;
+} AckServer_t;
+
+
+void vAckServerInit(AckServer_t *pxServer, AckRecordCallback_t pxCallback,
+                    void *pvContext);
+void vAckServerConnect(AckServer_t *pxServer);
+void vAckServerReceive(AckServer_t *pxServer, const uint8_t *pucData,
+                       uint32_t ulBytes);
+uint32_t ulAckServerGetAck(AckServer_t *pxServer, char *pcLine);
+
+
+#endif /* ACK_SERVER_H_ */
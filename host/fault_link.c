@@ -0,0 +1,132 @@
+/*
+ * fault_link.c
+ * The simulated unreliable connection (see fault_link.h). Faults come from a
+ * seeded xorshift generator, so the same configuration always gives the
+ * same faults for the same traffic.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "fault_link.h"
+
+
+/*
+ * Returns true with a chance of ulPPM in a million.
+ */
+static bool FaultLinkChance(FaultLink_t *pxLink, uint32_t ulPPM) {
+    uint32_t x = pxLink->ulRandom;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pxLink->ulRandom = x;
+
+    return (x % 1000000) < ulPPM;
+}
+
+/*
+ * Sets up a disconnected link with the given fault rates.
+ */
+void vFaultLinkInit(FaultLink_t *pxLink, const FaultLinkConfig_t *pxConfig) {
+    memset(pxLink, 0, sizeof(FaultLink_t));
+    pxLink->xConfig = *pxConfig;
+    if (pxLink->xConfig.ulCapacity > FAULT_LINK_MAX_BYTES) {
+        pxLink->xConfig.ulCapacity = FAULT_LINK_MAX_BYTES;
+    }
+
+    /* xorshift never leaves zero. */
+    pxLink->ulRandom = pxConfig->ulSeed ? pxConfig->ulSeed : 1;
+}
+
+/*
+ * Opens a new connection with nothing in flight.
+ */
+void vFaultLinkConnect(FaultLink_t *pxLink) {
+    pxLink->bConnected = true;
+    pxLink->ulReadIndex = 0;
+    pxLink->ulCount = 0;
+}
+
+/*
+ * Returns true until the connection drops.
+ */
+bool bFaultLinkConnected(const FaultLink_t *pxLink) {
+    return pxLink->bConnected;
+}
+
+/*
+ * Accepts as many bytes as there is room in flight for, like the modem
+ * taking data into its buffer. Each byte may drop the connection, in which
+ * case everything in flight is lost and no more is accepted. Returns the
+ * number of bytes accepted.
+ */
+uint32_t ulFaultLinkSend(FaultLink_t *pxLink, const uint8_t *pucData,
+                         uint32_t ulBytes) {
+    uint32_t ulSent = 0;
+
+    while (pxLink->bConnected && ulSent < ulBytes &&
+           pxLink->ulCount < pxLink->xConfig.ulCapacity) {
+
+        if (FaultLinkChance(pxLink, pxLink->xConfig.ulDropPPM)) {
+            pxLink->bConnected = false;
+            pxLink->xStats.ulLostBytes += pxLink->ulCount;
+            pxLink->xStats.ulDrops++;
+            pxLink->ulCount = 0;
+            break;
+        }
+
+        pxLink->pucData[(pxLink->ulReadIndex + pxLink->ulCount) %
+                        FAULT_LINK_MAX_BYTES] = pucData[ulSent++];
+        pxLink->ulCount++;
+    }
+
+    pxLink->xStats.ulSentBytes += ulSent;
+
+    return ulSent;
+}
+
+/*
+ * Moves up to ulMaxBytes in flight to the server end, corrupting some of
+ * them. Returns the number of bytes delivered.
+ */
+uint32_t ulFaultLinkDeliver(FaultLink_t *pxLink, uint8_t *pucOut,
+                            uint32_t ulMaxBytes) {
+    uint32_t ulDelivered = 0;
+
+    while (pxLink->bConnected && ulDelivered < ulMaxBytes &&
+           pxLink->ulCount) {
+        pucOut[ulDelivered] = pxLink->pucData[pxLink->ulReadIndex];
+
+        if (FaultLinkChance(pxLink, pxLink->xConfig.ulCorruptPPM)) {
+            pucOut[ulDelivered] ^= 0x5A;
+            pxLink->xStats.ulCorruptedBytes++;
+        }
+
+        pxLink->ulReadIndex = (pxLink->ulReadIndex + 1) % FAULT_LINK_MAX_BYTES;
+        pxLink->ulCount--;
+        ulDelivered++;
+    }
+
+    pxLink->xStats.ulDeliveredBytes += ulDelivered;
+
+    return ulDelivered;
+}
@@ -0,0 +1,80 @@
+/*
+ * fault_link.h
+ * A simulated connection from the device to the server that drops the
+ * connection and corrupts bytes at chosen rates, for measuring how much of
+ * the stream survives an unreliable link.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FAULT_LINK_H_
+#define FAULT_LINK_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Most bytes the link can hold in flight. The modem accepts this much before
+ * any of it reaches the server, and all of it is lost if the connection
+ * drops. */
+#define FAULT_LINK_MAX_BYTES            8192
+
+
+typedef struct {
+    /* Seed for the fault pattern, so a run can be repeated */
+    uint32_t ulSeed;
+    /* Bytes held in flight, up to FAULT_LINK_MAX_BYTES */
+    uint32_t ulCapacity;
+    /* Chance of each byte sent dropping the connection, and of each byte
+     * delivered being corrupted, in parts per million */
+    uint32_t ulDropPPM;
+    uint32_t ulCorruptPPM;
+} FaultLinkConfig_t;
+
+/* Totals since the link was initialized */
+typedef struct {
+    uint32_t ulSentBytes;
+    uint32_t ulDeliveredBytes;
+    /* Bytes accepted but in flight when the connection dropped */
+    uint32_t ulLostBytes;
+    uint32_t ulCorruptedBytes;
+    uint32_t ulDrops;
+} FaultLinkStats_t;
+
+typedef struct {
+    FaultLinkConfig_t xConfig;
+    uint32_t ulRandom;
+    bool bConnected;
+    uint8_t pucData[FAULT_LINK_MAX_BYTES];
+    uint32_t ulReadIndex;
+    uint32_t ulCount;
+    FaultLinkStats_t xStats;
+} FaultLink_t;
+
+
+void vFaultLinkInit(FaultLink_t *pxLink, const FaultLinkConfig_t *pxConfig);
+void vFaultLinkConnect(FaultLink_t *pxLink);
+bool bFaultLinkConnected(const FaultLink_t *pxLink);
+uint32_t ulFaultLinkSend(FaultLink_t *pxLink, const uint8_t *pucData,
+                         uint32_t ulBytes);
+uint32_t ulFaultLinkDeliver(FaultLink_t *pxLink, uint8_t *pucOut,
+                            uint32_t ulMaxBytes);
+
+
+#endif /* FAULT_LINK_H_ */
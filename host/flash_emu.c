@@ -0,0 +1,233 @@
+/*
+ * flash_emu.c
+ * File-backed emulation of the TM4C123's internal flash (see flash_emu.h).
+ * The flash contents live in a file, so a test can stop and reopen it to
+ * simulate a reset. Erases set a 1 KB block to 0xFF, and programming can
+ * only clear bits, as on the real part. Each operation adds its simulated
+ * time to a total, and can also sleep for it to reproduce the stalls in
+ * real time. This file is not part of the firmware build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+/* For nanosleep() and struct timespec under -std=c99 */
+#define _POSIX_C_SOURCE                 199309L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "flash_emu.h"
+
+
+#define FLASH_EMU_BLOCK_COUNT           ( FLASH_EMU_BYTES / \
+                                          FLASH_EMU_BLOCK_BYTES )
+
+
+static uint8_t pucFlash[FLASH_EMU_BYTES];
+static FILE *pxFile = NULL;
+
+static uint32_t pulEraseCounts[FLASH_EMU_BLOCK_COUNT];
+static FlashEmuStats_t xStats;
+
+static uint32_t ulEraseTimeUS = FLASH_EMU_ERASE_US;
+static uint32_t ulProgramWordTimeUS = FLASH_EMU_PROGRAM_WORD_US;
+static bool bSleep = false;
+
+/* Operations left before every operation fails, or 0 to never fail */
+static uint32_t ulFailCountdown = 0;
+
+
+/*
+ * Accounts for an operation taking ulUS microseconds.
+ */
+static void FlashEmuElapse(uint32_t ulUS) {
+    struct timespec xDelay;
+
+    xStats.ullElapsedUS += ulUS;
+
+    if (bSleep) {
+        xDelay.tv_sec = ulUS / 1000000;
+        xDelay.tv_nsec = (ulUS % 1000000) * 1000;
+        nanosleep(&xDelay, NULL);
+    }
+}
+
+/*
+ * Returns true if the next operation should fail, as after a power loss.
+ */
+static bool FlashEmuFailing(void) {
+    if (!ulFailCountdown) {
+        return false;
+    }
+
+    if (ulFailCountdown > 1) {
+        ulFailCountdown--;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Writes a range of the emulated flash back to the file.
+ */
+static bool FlashEmuWriteBack(uint32_t ulAddress, uint32_t ulCount) {
+    return !fseek(pxFile, ulAddress, SEEK_SET) &&
+           fwrite(pucFlash + ulAddress, 1, ulCount, pxFile) == ulCount &&
+           !fflush(pxFile);
+}
+
+/*
+ * Opens the file holding the flash contents, creating it erased if it
+ * doesn't exist. Returns false if the file can't be used.
+ */
+bool bFlashEmuOpen(const char *pcPath) {
+
+    vFlashEmuClose();
+    memset(pulEraseCounts, 0, sizeof(pulEraseCounts));
+    memset(&xStats, 0, sizeof(xStats));
+    ulFailCountdown = 0;
+
+    pxFile = fopen(pcPath, "r+b");
+    if (pxFile) {
+        if (fread(pucFlash, 1, FLASH_EMU_BYTES, pxFile) == FLASH_EMU_BYTES) {
+            return true;
+        }
+        fclose(pxFile);
+        pxFile = NULL;
+        return false;
+    }
+
+    pxFile = fopen(pcPath, "w+b");
+    if (!pxFile) {
+        return false;
+    }
+
+    memset(pucFlash, 0xFF, FLASH_EMU_BYTES);
+    if (!FlashEmuWriteBack(0, FLASH_EMU_BYTES)) {
+        vFlashEmuClose();
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Closes the flash file. Everything written is already in it.
+ */
+void vFlashEmuClose(void) {
+    if (pxFile) {
+        fclose(pxFile);
+        pxFile = NULL;
+    }
+}
+
+/*
+ * Sets the simulated time of an erase and of programming one word, and
+ * whether each operation also sleeps for that long.
+ */
+void vFlashEmuSetTiming(uint32_t ulEraseUS, uint32_t ulProgramWordUS,
+                        bool bRealTime) {
+    ulEraseTimeUS = ulEraseUS;
+    ulProgramWordTimeUS = ulProgramWordUS;
+    bSleep = bRealTime;
+}
+
+/*
+ * Makes every flash operation after the next ulOperations fail without
+ * changing the flash, as if power were lost. 0 turns this off.
+ */
+void vFlashEmuFailAfter(uint32_t ulOperations) {
+    ulFailCountdown = ulOperations ? ulOperations + 1 : 0;
+}
+
+/*
+ * Returns a pointer to the emulated flash at a device address.
+ */
+const uint8_t *pucFlashEmuPointer(uint32_t ulAddress) {
+    return pucFlash + (ulAddress % FLASH_EMU_BYTES);
+}
+
+/*
+ * Returns the number of times the block containing ulAddress was erased
+ * since the emulator was opened.
+ */
+uint32_t ulFlashEmuEraseCount(uint32_t ulAddress) {
+    return pulEraseCounts[(ulAddress % FLASH_EMU_BYTES) /
+                          FLASH_EMU_BLOCK_BYTES];
+}
+
+/*
+ * Copies the totals since the emulator was opened into *pxStats.
+ */
+void vFlashEmuGetStats(FlashEmuStats_t *pxStats) {
+    memcpy(pxStats, &xStats, sizeof(xStats));
+}
+
+/*
+ * Erases the 1 KB block at ui32Address, which must be block aligned.
+ * Returns 0 on success or -1 on failure, like the TivaWare function.
+ */
+int32_t FlashErase(uint32_t ui32Address) {
+
+    if (!pxFile || ui32Address % FLASH_EMU_BLOCK_BYTES ||
+        ui32Address >= FLASH_EMU_BYTES || FlashEmuFailing()) {
+        return -1;
+    }
+
+    memset(pucFlash + ui32Address, 0xFF, FLASH_EMU_BLOCK_BYTES);
+    pulEraseCounts[ui32Address / FLASH_EMU_BLOCK_BYTES]++;
+    xStats.ulErases++;
+    FlashEmuElapse(ulEraseTimeUS);
+
+    return FlashEmuWriteBack(ui32Address, FLASH_EMU_BLOCK_BYTES) ? 0 : -1;
+}
+
+/*
+ * Programs ui32Count bytes (a multiple of 4) from pui32Data at ui32Address,
+ * which must be word aligned. Programming ANDs the data into the flash.
+ * Returns 0 on success or -1 on failure, like the TivaWare function.
+ */
+int32_t FlashProgram(uint32_t *pui32Data, uint32_t ui32Address,
+                     uint32_t ui32Count) {
+    uint32_t ulWord;
+    uint32_t i;
+
+    if (!pxFile || ui32Address % 4 || ui32Count % 4 ||
+        ui32Address + ui32Count > FLASH_EMU_BYTES || FlashEmuFailing()) {
+        return -1;
+    }
+
+    for (i = 0; i < ui32Count / 4; i++) {
+        memcpy(&ulWord, pucFlash + ui32Address + i * 4, 4);
+
+        if (pui32Data[i] & ~ulWord) {
+            xStats.ulOverwrites++;
+        }
+
+        ulWord &= pui32Data[i];
+        memcpy(pucFlash + ui32Address + i * 4, &ulWord, 4);
+        xStats.ulWordsProgrammed++;
+        FlashEmuElapse(ulProgramWordTimeUS);
+    }
+
+    return FlashEmuWriteBack(ui32Address, ui32Count) ? 0 : -1;
+}
@@ -0,0 +1,71 @@
+/*
+ * flash_emu.h
+ * File-backed emulation of the TM4C123's internal flash, for running the
+ * flash log (store.c) on a host.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLASH_EMU_H_
+#define FLASH_EMU_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Size and erase block of the TM4C123GH6PM's flash */
+#define FLASH_EMU_BYTES                 0x00040000
+#define FLASH_EMU_BLOCK_BYTES           1024
+
+/* Default simulated operation times, in microseconds. These are worst-case
+ * figures for the part; vFlashEmuSetTiming() changes them. */
+#define FLASH_EMU_ERASE_US              15000
+#define FLASH_EMU_PROGRAM_WORD_US       50
+
+/* store.c reads flash in place through this mapping. */
+#define STORE_FLASH_POINTER( ulAddress ) pucFlashEmuPointer( ulAddress )
+
+
+/* Totals since the emulator was opened */
+typedef struct {
+    uint64_t ullElapsedUS;
+    uint32_t ulErases;
+    uint32_t ulWordsProgrammed;
+    /* Words programmed with a 1 where the flash already held a 0, which real
+     * flash can't do without an erase */
+    uint32_t ulOverwrites;
+} FlashEmuStats_t;
+
+
+bool bFlashEmuOpen(const char *pcPath);
+void vFlashEmuClose(void);
+void vFlashEmuSetTiming(uint32_t ulEraseUS, uint32_t ulProgramWordUS,
+                        bool bRealTime);
+void vFlashEmuFailAfter(uint32_t ulOperations);
+const uint8_t *pucFlashEmuPointer(uint32_t ulAddress);
+uint32_t ulFlashEmuEraseCount(uint32_t ulAddress);
+void vFlashEmuGetStats(FlashEmuStats_t *pxStats);
+
+/* Stand-ins for the TivaWare driverlib/flash.h functions */
+int32_t FlashErase(uint32_t ui32Address);
+int32_t FlashProgram(uint32_t *pui32Data, uint32_t ui32Address,
+                     uint32_t ui32Count);
+
+
+#endif /* FLASH_EMU_H_ */
@@ -0,0 +1,247 @@
+/*
+ * frame_decode.c
+ * Host-side decoding of the records sent by ExplorerLink. Records all start
+ * with the same rate and size fields. A host takes them out of the TCP
+ * stream's packets with host/stream_decode.c (or splits a decompressed block
+ * with ulFrameRecordLength()), then picks a decoder by usFrameRecordRate().
+ * This file is not part of the firmware build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include "frame_decode.h"
+
+
+/*
+ * Reads little-endian fields regardless of the host's byte order.
+ */
+static uint16_t FrameGet16(const uint8_t *pucBytes) {
+    return (uint16_t)(pucBytes[0] | (pucBytes[1] << 8));
+}
+
+static uint32_t FrameGet32(const uint8_t *pucBytes) {
+    return (uint32_t)pucBytes[0] | ((uint32_t)pucBytes[1] << 8) |
+           ((uint32_t)pucBytes[2] << 16) | ((uint32_t)pucBytes[3] << 24);
+}
+
+/*
+ * Returns the length of the record starting at pucRecord, which must hold at
+ * least FRAME_RECORD_HEADER_BYTES.
+ */
+uint32_t ulFrameRecordLength(const uint8_t *pucRecord) {
+    return FrameGet16(pucRecord + 2);
+}
+
+/*
+ * Returns the rate of the record starting at pucRecord, without the layout
+ * ID. FRAME_BURST_RATE, FRAME_SCHEMA_RATE, FRAME_EVENT_RATE, FRAME_LZ_RATE,
+ * FRAME_GAP_RATE, FRAME_REPLY_RATE and FRAME_URGENT_RATE mark records that
+ * aren't frames; any other value is a frame of samples at that rate.
+ */
+uint16_t usFrameRecordRate(const uint8_t *pucRecord) {
+    return FrameGet16(pucRecord) & FRAME_RATE_MASK;
+}
+
+/*
+ * Returns the hash of the schema a frame references, or 0 if it references
+ * none. pucRecord must hold at least FRAME_HEADER_BYTES.
+ */
+uint16_t usFrameSchemaHash(const uint8_t *pucRecord) {
+    return FrameGet16(pucRecord + 12);
+}
+
+/*
+ * Reconstructs the delta encoded payloads of a frame (see frame.h) into
+ * pucValues, which receives ulCount payloads of the layout's total width.
+ * Values are rebuilt modulo each channel's width, exactly as they were
+ * sampled. Returns false if the payloads don't match the layout.
+ */
+static int FrameDeltaDecode(const uint8_t *pucIn, uint32_t ulInBytes,
+                            const FrameLayout_t *pxLayout, uint32_t ulCount,
+                            uint32_t ulPayloadBytes, uint8_t *pucValues) {
+    const uint8_t *pucPrevious;
+    uint8_t *pucCurrent;
+    uint32_t ulPos = ulPayloadBytes;
+    uint32_t ulOffset;
+    uint32_t ulWidth;
+    uint32_t ulZigzag;
+    uint32_t ulShift;
+    uint32_t ulValue;
+    uint32_t i, j, k;
+
+    if (ulInBytes < ulPayloadBytes) {
+        return 0;
+    }
+
+    /* The keyframe is at full width. */
+    for (k = 0; k < ulPayloadBytes; k++) {
+        pucValues[k] = pucIn[k];
+    }
+
+    for (i = 1; i < ulCount; i++) {
+        pucPrevious = pucValues + (i - 1) * ulPayloadBytes;
+        pucCurrent = pucValues + i * ulPayloadBytes;
+        ulOffset = 0;
+
+        for (j = 0; j < pxLayout->ulChannelCount; j++) {
+            ulWidth = pxLayout->pucWidths[j];
+
+            ulZigzag = 0;
+            ulShift = 0;
+            do {
+                if (ulPos >= ulInBytes || ulShift > 28) {
+                    return 0;
+                }
+                ulZigzag |= (uint32_t)(pucIn[ulPos] & 0x7F) << ulShift;
+                ulShift += 7;
+            } while (pucIn[ulPos++] & 0x80);
+
+            ulValue = 0;
+            for (k = 0; k < ulWidth; k++) {
+                ulValue |= (uint32_t)pucPrevious[ulOffset + k] << (k * 8);
+            }
+            /* Undo the zigzag and add the delta, wrapping at the width
+             * (the bytes above the width are dropped below). */
+            ulValue += (ulZigzag >> 1) ^ (0 - (ulZigzag & 1));
+            for (k = 0; k < ulWidth; k++) {
+                pucCurrent[ulOffset + k] = (uint8_t)(ulValue >> (k * 8));
+            }
+
+            ulOffset += ulWidth;
+        }
+    }
+
+    return ulPos == ulInBytes;
+}
+
+/*
+ * Unpacks the samples of one frame into pxSamples, giving each its own
+ * timestamp, with the channel values at full width in pucValues (which must
+ * hold ulValuesBytes). pxLayout is the layout the frame was sampled with
+ * (from lSchemaGetLayout()); it may be NULL for raw frames. Returns the
+ * number of samples, or -1 if the record isn't a frame, is of an unknown
+ * layout, doesn't fit the outputs or is inconsistent with its length or
+ * layout.
+ */
+int32_t lFrameDecode(const uint8_t *pucRecord, uint32_t ulLength,
+                     const FrameLayout_t *pxLayout, uint8_t *pucValues,
+                     uint32_t ulValuesBytes, FrameSample_t *pxSamples,
+                     uint32_t ulMaxSamples) {
+    uint16_t usRateField;
+    uint16_t usRateHz;
+    uint32_t ulBaseS;
+    uint32_t ulBaseSS;
+    uint8_t ucVersion;
+    uint32_t ulCount;
+    uint32_t ulPayloadBytes;
+    uint32_t ulPayloadsBytes;
+    uint32_t ulOffsetsBytes = 0;
+    const uint8_t *pucOffsets = 0;
+    uint32_t ulOffsetSS;
+    uint32_t i;
+
+    if (ulLength < FRAME_HEADER_BYTES ||
+        ulFrameRecordLength(pucRecord) != ulLength) {
+        return -1;
+    }
+
+    usRateField = FrameGet16(pucRecord);
+    usRateHz = usRateField & FRAME_RATE_MASK;
+    if (usRateHz == FRAME_BURST_RATE || usRateHz == FRAME_SCHEMA_RATE ||
+        usRateHz == FRAME_EVENT_RATE || usRateHz == FRAME_LZ_RATE ||
+        usRateHz == FRAME_GAP_RATE || usRateHz == FRAME_REPLY_RATE ||
+        usRateHz == FRAME_URGENT_RATE) {
+        return -1;
+    }
+
+    ucVersion = pucRecord[10];
+    ulCount = pucRecord[11];
+    if (ulCount == 0 || ulCount > ulMaxSamples) {
+        return -1;
+    }
+
+    if (ucVersion & FRAME_FLAG_JITTER) {
+        ulOffsetsBytes = ulCount * 2;
+    }
+    if (ulLength < FRAME_HEADER_BYTES + ulOffsetsBytes) {
+        return -1;
+    }
+    ulPayloadsBytes = ulLength - FRAME_HEADER_BYTES - ulOffsetsBytes;
+    if (ulOffsetsBytes) {
+        pucOffsets = pucRecord + ulLength - ulOffsetsBytes;
+    }
+
+    switch (ucVersion & FRAME_VERSION_MASK) {
+    case FRAME_LAYOUT_RAW:
+        /* Every sample in a raw frame has the same payload length. */
+        if (ulPayloadsBytes % ulCount ||
+            ulPayloadsBytes > ulValuesBytes) {
+            return -1;
+        }
+        ulPayloadBytes = ulPayloadsBytes / ulCount;
+        for (i = 0; i < ulPayloadsBytes; i++) {
+            pucValues[i] = pucRecord[FRAME_HEADER_BYTES + i];
+        }
+        break;
+
+    case FRAME_LAYOUT_DELTA:
+        if (!pxLayout) {
+            return -1;
+        }
+        ulPayloadBytes = 0;
+        for (i = 0; i < pxLayout->ulChannelCount; i++) {
+            ulPayloadBytes += pxLayout->pucWidths[i];
+        }
+        if (ulPayloadBytes == 0 ||
+            ulPayloadBytes * ulCount > ulValuesBytes ||
+            !FrameDeltaDecode(pucRecord + FRAME_HEADER_BYTES, ulPayloadsBytes,
+                              pxLayout, ulCount, ulPayloadBytes, pucValues)) {
+            return -1;
+        }
+        break;
+
+    default:
+        return -1;
+    }
+
+    ulBaseS = FrameGet32(pucRecord + 4);
+    ulBaseSS = FrameGet16(pucRecord + 8);
+
+    for (i = 0; i < ulCount; i++) {
+        /* Without the jitter flag, times are implied by the rate exactly as
+         * the device computes them. */
+        if (pucOffsets) {
+            ulOffsetSS = FrameGet16(pucOffsets + i * 2);
+        }
+        else {
+            ulOffsetSS = (i * FRAME_RTC_SS_PER_S) / usRateHz;
+        }
+
+        pxSamples[i].usRateHz = usRateHz;
+        pxSamples[i].ucLayoutID = usRateField >> FRAME_LAYOUT_SHIFT;
+        pxSamples[i].ulS = ulBaseS +
+                           (ulBaseSS + ulOffsetSS) / FRAME_RTC_SS_PER_S;
+        pxSamples[i].ulSS = (ulBaseSS + ulOffsetSS) % FRAME_RTC_SS_PER_S;
+        pxSamples[i].pucPayload = pucValues + i * ulPayloadBytes;
+        pxSamples[i].usPayloadBytes = ulPayloadBytes;
+    }
+
+    return ulCount;
+}
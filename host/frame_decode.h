@@ -0,0 +1,85 @@
+/*
+ * frame_decode.h
+ * Host-side decoding of the records sent by ExplorerLink.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_DECODE_H_
+#define FRAME_DECODE_H_
+
+
+#include <stdint.h>
+
+
+/* These mirror the device's definitions in frame.h and sample.h. The host
+ * doesn't build against the firmware headers, which pull in FreeRTOS. */
+#define FRAME_RECORD_HEADER_BYTES       10
+#define FRAME_HEADER_BYTES              14
+#define FRAME_LAYOUT_RAW                1
+#define FRAME_LAYOUT_DELTA              2
+#define FRAME_FLAG_JITTER               0x80
+#define FRAME_VERSION_MASK              0x7F
+#define FRAME_LAYOUT_SHIFT              12
+#define FRAME_RATE_MASK                 0x0FFF
+#define FRAME_RTC_SS_PER_S              32768
+
+/* Rate field values of records that aren't frames. Compressed blocks are
+ * expanded with host/lz_decode.c into more records, and schemas are read
+ * with host/schema_decode.c. Replies answer "YYYz<token>" heartbeats, and
+ * urgent records hold one channel's new value (see urgent.h). */
+#define FRAME_BURST_RATE                0
+#define FRAME_SCHEMA_RATE               0x0FFC
+#define FRAME_EVENT_RATE                0x0FFE
+#define FRAME_LZ_RATE                   0x0FFD
+#define FRAME_GAP_RATE                  0x0FFF
+#define FRAME_REPLY_RATE                0x0FFB
+#define FRAME_URGENT_RATE               0x0FFA
+
+
+/* The channel widths (in bytes, in sample order) of a sample layout, which
+ * lSchemaGetLayout() finds for a frame. Only needed for delta encoded
+ * frames. */
+typedef struct {
+    const uint8_t *pucWidths;
+    uint32_t ulChannelCount;
+} FrameLayout_t;
+
+/* One sample unpacked from a frame. The payload holds the channel values at
+ * full width, as the device sampled them. */
+typedef struct {
+    uint16_t usRateHz;
+    uint8_t ucLayoutID;
+    /* Sample time as RTC seconds and subseconds (1/32768ths) */
+    uint32_t ulS;
+    uint32_t ulSS;
+    const uint8_t *pucPayload;
+    uint16_t usPayloadBytes;
+} FrameSample_t;
+
+
+uint32_t ulFrameRecordLength(const uint8_t *pucRecord);
+uint16_t usFrameRecordRate(const uint8_t *pucRecord);
+uint16_t usFrameSchemaHash(const uint8_t *pucRecord);
+int32_t lFrameDecode(const uint8_t *pucRecord, uint32_t ulLength,
+                     const FrameLayout_t *pxLayout, uint8_t *pucValues,
+                     uint32_t ulValuesBytes, FrameSample_t *pxSamples,
+                     uint32_t ulMaxSamples);
+
+
+#endif /* FRAME_DECODE_H_ */
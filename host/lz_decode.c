@@ -0,0 +1,97 @@
+/*
+ * lz_decode.c
+ * Host-side decompression of the uplink's compressed blocks (see lz.h). The
+ * output of each block is a run of ordinary records, to be split and decoded
+ * like the rest of the stream. This file is not part of the firmware build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "lz_decode.h"
+
+
+/*
+ * Returns whether a compressed block starts partway through a record, which
+ * a host must drop if it lost the block before.
+ */
+bool bLZContinued(const uint8_t *pucRecord) {
+    return (pucRecord[5] << 8) & LZ_FLAG_CONTINUED;
+}
+
+/*
+ * Decompresses one compressed block record into pucOut, which must hold
+ * ulOutBytes. Returns the number of bytes produced, or -1 if the record is
+ * malformed or doesn't fit.
+ */
+int32_t lLZDecompress(const uint8_t *pucRecord, uint32_t ulLength,
+                      uint8_t *pucOut, uint32_t ulOutBytes) {
+    uint32_t ulRawSize;
+    uint32_t ulIn = LZ_HEADER_BYTES;
+    uint32_t ulOut = 0;
+    uint32_t ulCount;
+    uint32_t ulDistance;
+    uint8_t ucToken;
+
+    if (ulLength < LZ_HEADER_BYTES ||
+        (uint32_t)(pucRecord[2] | (pucRecord[3] << 8)) != ulLength) {
+        return -1;
+    }
+
+    ulRawSize = (pucRecord[4] | (pucRecord[5] << 8)) & ~LZ_FLAG_CONTINUED;
+    if (ulRawSize > ulOutBytes || ulRawSize > LZ_BLOCK_BYTES) {
+        return -1;
+    }
+
+    while (ulIn < ulLength) {
+        ucToken = pucRecord[ulIn++];
+
+        if (ucToken < 0x80) {
+            ulCount = ucToken + 1;
+            if (ulIn + ulCount > ulLength || ulOut + ulCount > ulRawSize) {
+                return -1;
+            }
+            while (ulCount--) {
+                pucOut[ulOut++] = pucRecord[ulIn++];
+            }
+        }
+        else {
+            if (ulIn >= ulLength) {
+                return -1;
+            }
+            ulCount = ucToken - 0x80 + LZ_MIN_MATCH;
+            ulDistance = pucRecord[ulIn++] + 1;
+            if (ulDistance > ulOut || ulOut + ulCount > ulRawSize) {
+                return -1;
+            }
+            /* Byte by byte, since a match may overlap its own output. */
+            while (ulCount--) {
+                pucOut[ulOut] = pucOut[ulOut - ulDistance];
+                ulOut++;
+            }
+        }
+    }
+
+    if (ulOut != ulRawSize) {
+        return -1;
+    }
+
+    return ulOut;
+}
@@ -0,0 +1,43 @@
+/*
+ * lz_decode.h
+ * Host-side decompression of the uplink's compressed blocks.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZ_DECODE_H_
+#define LZ_DECODE_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* These mirror the device's definitions in lz.h. */
+#define LZ_HEADER_BYTES                 6
+#define LZ_MIN_MATCH                    3
+#define LZ_BLOCK_BYTES                  256
+#define LZ_FLAG_CONTINUED               0x8000
+
+
+bool bLZContinued(const uint8_t *pucRecord);
+int32_t lLZDecompress(const uint8_t *pucRecord, uint32_t ulLength,
+                      uint8_t *pucOut, uint32_t ulOutBytes);
+
+
+#endif /* LZ_DECODE_H_ */
@@ -0,0 +1,318 @@
+/*
+ * sample_latency_model.c
+ * Host model of the sampling ISR's latency (see SampleJitterRecord() in
+ * data_task.c) under two interrupt priority plans: the old one (sampling at
+ * 7) and the new one in priorities.h (sampling at 5, CAN0 and ADC at 6).
+ * Every interrupt source is given an arrival pattern and a handler time, and
+ * the NVIC's preemption is simulated: a handler only preempts one of a lower
+ * priority (a higher number), equal priorities are taken in exception number
+ * order, and kernel critical sections in tasks hold off everything at
+ * configMAX_SYSCALL_INTERRUPT_PRIORITY and below. The histogram printed has
+ * the same bins as the Data task's. This file is not part of the firmware
+ * build. From the top of the tree:
+ *
+ *   gcc -std=c99 -O2 -o sample_latency_model host/sample_latency_model.c
+ *   ./sample_latency_model
+ *
+ * The handler times are estimates from reading the handlers at 80MHz, not
+ * measurements, and the load is a busy case: a loaded 500kbit/s CAN bus,
+ * UART6 sending continuously at 115200 baud (a bulk transfer) and the debug
+ * runtime stats timer off, as in a release build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+
+/* Simulated time, in microseconds, and the exception entry time (12
+ * cycles at 80MHz) */
+#define MODEL_RUN_US                    60000000.0
+#define MODEL_ENTRY_US                  0.15
+
+/* Priority of the thread, and the priority a critical section runs at: it
+ * blocks configMAX_SYSCALL_INTERRUPT_PRIORITY (5) and below */
+#define MODEL_THREAD_PRIORITY           8
+#define MODEL_CRITICAL_PRIORITY         4
+
+/* As in data_task.c */
+#define SAMPLE_JITTER_BINS              12
+
+/* Indexes in pxSources of the sources the output names */
+#define MODEL_SAMPLING                  0
+#define MODEL_CAN0                      1
+#define MODEL_UART6                     2
+#define MODEL_ADC0SS1                   5
+
+
+typedef enum {
+    ARRIVAL_PERIODIC,
+    /* Periodic, but rounded to the RTC's 1/32768s as the sample matches
+     * are, so its phase against the system clock wanders */
+    ARRIVAL_RTC,
+    /* At least dPeriodUS apart, plus a random wait averaging dMeanExtraUS */
+    ARRIVAL_RANDOM,
+    /* As ARRIVAL_RANDOM, but only started from thread mode */
+    ARRIVAL_CRITICAL
+} Arrival_t;
+
+typedef struct {
+    const char *pcName;
+    /* Exception number, which orders equal priorities */
+    uint32_t ulException;
+    Arrival_t eArrival;
+    double dPeriodUS;
+    double dMeanExtraUS;
+    /* Handler time, uniform between these */
+    double dMinHandlerUS;
+    double dMaxHandlerUS;
+    /* Old and new priorities */
+    uint8_t pucPriority[2];
+} Source_t;
+
+typedef struct {
+    uint8_t ucPriority;
+    uint32_t ulArrivals;
+    double dPhase;
+    double dNextArrival;
+    bool bPending;
+    double dPendingSince;
+    double dRemaining;
+} SourceState_t;
+
+static const Source_t pxSources[] = {
+    /* 100Hz sample buffer matches, snapshotting every channel */
+    { "sampling", 59, ARRIVAL_RTC, 10000.0, 0.0, 25.0, 35.0, { 7, 5 } },
+    /* A frame every 230us or more, about 2000 a second. Each takes a status
+     * interrupt and then a message object interrupt, tail-chained. */
+    { "CAN0", 55, ARRIVAL_RANDOM, 230.0, 270.0, 5.0, 8.0, { 6, 6 } },
+    /* TX FIFO refills of 14 bytes at 11520 bytes a second */
+    { "UART6", 92, ARRIVAL_PERIODIC, 1215.0, 0.0, 8.0, 11.0, { 7, 7 } },
+    /* Range sensor replies at 9600 baud */
+    { "UART3", 75, ARRIVAL_RANDOM, 20000.0, 30000.0, 3.0, 6.0, { 7, 7 } },
+    { "ADC0SS0", 30, ARRIVAL_PERIODIC, 50000.0, 0.0, 3.0, 4.0, { 7, 6 } },
+    { "ADC0SS1", 31, ARRIVAL_PERIODIC, 1000.0, 0.0, 3.0, 4.0, { 7, 6 } },
+    /* The kernel runs at configKERNEL_INTERRUPT_PRIORITY */
+    { "SysTick", 15, ARRIVAL_PERIODIC, 1000.0, 0.0, 2.0, 4.0, { 7, 7 } },
+    { "PendSV", 14, ARRIVAL_RANDOM, 100.0, 567.0, 1.5, 2.5, { 7, 7 } },
+    /* Queue, notification and stream buffer calls in tasks */
+    { "critical", 0, ARRIVAL_CRITICAL, 20.0, 80.0, 0.5, 4.0,
+      { MODEL_CRITICAL_PRIORITY, MODEL_CRITICAL_PRIORITY } }
+};
+
+#define MODEL_SOURCE_COUNT              ( sizeof(pxSources) / \
+                                          sizeof(pxSources[0]) )
+
+static SourceState_t pxStates[MODEL_SOURCE_COUNT];
+static uint32_t ulRandom = 12345;
+
+
+/*
+ * Returns a uniform random number in [0, 1).
+ */
+static double ModelRandom(void) {
+    ulRandom ^= ulRandom << 13;
+    ulRandom ^= ulRandom >> 17;
+    ulRandom ^= ulRandom << 5;
+
+    return (ulRandom >> 8) / 16777216.0;
+}
+
+/*
+ * Returns a random wait averaging dMean. The sum of 12 uniform draws is
+ * less bursty than an exponential wait, which is close enough for a load
+ * model and needs no libm.
+ */
+static double ModelWait(double dMean) {
+    double dSum = 0.0;
+    uint32_t i;
+
+    for (i = 0; i < 12; i++) {
+        dSum += ModelRandom();
+    }
+
+    return dSum / 6.0 * dMean;
+}
+
+/*
+ * Returns the time of a source's next arrival after the one at dLast.
+ */
+static double ModelNextArrival(const Source_t *pxSource,
+                               SourceState_t *pxState, double dLast) {
+    uint64_t ullCounts;
+
+    pxState->ulArrivals++;
+
+    if (pxSource->eArrival == ARRIVAL_PERIODIC) {
+        return dLast + pxSource->dPeriodUS;
+    }
+
+    if (pxSource->eArrival == ARRIVAL_RTC) {
+        ullCounts = pxState->ulArrivals * pxSource->dPeriodUS * 0.032768 +
+                    0.5;
+        return pxState->dPhase + ullCounts / 0.032768;
+    }
+
+    return dLast + pxSource->dPeriodUS + ModelWait(pxSource->dMeanExtraUS);
+}
+
+/*
+ * Returns the most urgent pending source that can preempt the running
+ * handler (or the thread), or -1 if there is none.
+ */
+static int32_t ModelTake(const uint32_t *pulStack, uint32_t ulDepth) {
+    uint8_t ucRunning = MODEL_THREAD_PRIORITY;
+    int32_t lBest = -1;
+    uint32_t i;
+
+    if (ulDepth) {
+        ucRunning = pxStates[pulStack[ulDepth - 1]].ucPriority;
+    }
+
+    for (i = 0; i < MODEL_SOURCE_COUNT; i++) {
+        if (!pxStates[i].bPending || pxStates[i].ucPriority >= ucRunning ||
+            (pxSources[i].eArrival == ARRIVAL_CRITICAL && ulDepth)) {
+            continue;
+        }
+
+        if (lBest < 0 || pxStates[i].ucPriority < pxStates[lBest].ucPriority ||
+            (pxStates[i].ucPriority == pxStates[lBest].ucPriority &&
+             pxSources[i].ulException < pxSources[lBest].ulException)) {
+            lBest = i;
+        }
+    }
+
+    return lBest;
+}
+
+/*
+ * Runs the model with the priorities in column ulColumn of each source, and
+ * prints the sampling latency histogram.
+ */
+static void ModelRun(uint32_t ulColumn) {
+    uint32_t pulStack[MODEL_SOURCE_COUNT];
+    uint32_t ulDepth = 0;
+    uint32_t pulHistogram[SAMPLE_JITTER_BINS] = { 0 };
+    uint32_t ulSamples = 0;
+    double dMaxUS = 0.0;
+    double dNow = 0.0;
+    double dNext;
+    double dLatency;
+    SourceState_t *pxState;
+    SourceState_t *pxTop;
+    int32_t lTaken;
+    uint32_t ulBin;
+    uint32_t i;
+
+    /* Each source starts at a random phase */
+    for (i = 0; i < MODEL_SOURCE_COUNT; i++) {
+        pxState = &pxStates[i];
+        pxState->ucPriority = pxSources[i].pucPriority[ulColumn];
+        pxState->ulArrivals = 0;
+        pxState->bPending = false;
+        pxState->dPhase = ModelRandom() * pxSources[i].dPeriodUS;
+        pxState->dNextArrival = pxState->dPhase;
+    }
+
+    while (dNow < MODEL_RUN_US) {
+        lTaken = ModelTake(pulStack, ulDepth);
+        if (lTaken >= 0) {
+            pxState = &pxStates[lTaken];
+            pxState->bPending = false;
+            pxState->dRemaining = pxSources[lTaken].dMinHandlerUS +
+                ModelRandom() * (pxSources[lTaken].dMaxHandlerUS -
+                                 pxSources[lTaken].dMinHandlerUS);
+            if (pxSources[lTaken].eArrival != ARRIVAL_CRITICAL) {
+                pxState->dRemaining += MODEL_ENTRY_US;
+            }
+            pulStack[ulDepth++] = lTaken;
+
+            /* The ISR reads the counter as soon as it is entered */
+            if (lTaken == MODEL_SAMPLING) {
+                dLatency = dNow + MODEL_ENTRY_US - pxState->dPendingSince;
+                ulBin = 0;
+                while (((uint32_t)dLatency >> ulBin) &&
+                       ulBin < SAMPLE_JITTER_BINS - 1) {
+                    ulBin++;
+                }
+                pulHistogram[ulBin]++;
+                ulSamples++;
+                if (dLatency > dMaxUS) {
+                    dMaxUS = dLatency;
+                }
+            }
+            continue;
+        }
+
+        /* Run until the next arrival or until the running handler
+         * finishes, whichever is first */
+        dNext = MODEL_RUN_US;
+        for (i = 0; i < MODEL_SOURCE_COUNT; i++) {
+            if (pxStates[i].dNextArrival < dNext) {
+                dNext = pxStates[i].dNextArrival;
+            }
+        }
+
+        if (ulDepth) {
+            pxTop = &pxStates[pulStack[ulDepth - 1]];
+            if (dNow + pxTop->dRemaining <= dNext) {
+                dNext = dNow + pxTop->dRemaining;
+                ulDepth--;
+            }
+            else {
+                pxTop->dRemaining -= dNext - dNow;
+            }
+        }
+        dNow = dNext;
+
+        /* An interrupt that is already pending stays a single pend */
+        for (i = 0; i < MODEL_SOURCE_COUNT; i++) {
+            pxState = &pxStates[i];
+            if (pxState->dNextArrival <= dNow) {
+                if (!pxState->bPending) {
+                    pxState->bPending = true;
+                    pxState->dPendingSince = pxState->dNextArrival;
+                }
+                pxState->dNextArrival = ModelNextArrival(&pxSources[i],
+                                                         pxState,
+                                                         pxState->dNextArrival);
+            }
+        }
+    }
+
+    printf("%s priorities: sampling at %d, CAN0 at %d, ADC at %d, "
+           "UARTs at %d\n", ulColumn ? "new" : "old",
+           pxSources[MODEL_SAMPLING].pucPriority[ulColumn],
+           pxSources[MODEL_CAN0].pucPriority[ulColumn],
+           pxSources[MODEL_ADC0SS1].pucPriority[ulColumn],
+           pxSources[MODEL_UART6].pucPriority[ulColumn]);
+    for (i = 0; i < SAMPLE_JITTER_BINS; i++) {
+        printf(">=%dus: %u\n", i ? 1 << (i - 1) : 0, pulHistogram[i]);
+    }
+    printf("samples %u, max %.1fus\n\n", ulSamples, dMaxUS);
+}
+
+int main(void) {
+    ModelRun(0);
+    ModelRun(1);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * schema_decode.c
+ * Host-side parsing of schema records (see schema.h in the firmware). A
+ * host keeps every schema it receives by hash, and finds the layout of each
+ * frame with lSchemaGetLayout() from the schema its hash names. This file is
+ * not part of the firmware build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdint.h>
+#include "frame_decode.h"
+#include "schema_decode.h"
+
+
+static uint16_t SchemaGet16(const uint8_t *pucBytes) {
+    return (uint16_t)(pucBytes[0] | (pucBytes[1] << 8));
+}
+
+/*
+ * Hashes the schema contents after the hash field, exactly as the device
+ * does: 32-bit FNV-1a, folded to 16 bits, with 0 replaced by 1.
+ */
+static uint16_t SchemaHash(const uint8_t *pucData, uint32_t ulLength) {
+    uint32_t ulHash = 2166136261u;
+    uint16_t usHash;
+    uint32_t i;
+
+    for (i = 0; i < ulLength; i++) {
+        ulHash ^= pucData[i];
+        ulHash *= 16777619u;
+    }
+
+    usHash = (uint16_t)((ulHash >> 16) ^ (ulHash & 0xFFFF));
+
+    return usHash ? usHash : 1;
+}
+
+/*
+ * Parses a schema record into pxSchema. Returns 0, or -1 if the record isn't
+ * a schema, fails its hash, is inconsistent with its length or describes
+ * more channels or buffers than pxSchema holds.
+ */
+int32_t lSchemaDecode(const uint8_t *pucRecord, uint32_t ulLength,
+                      Schema_t *pxSchema) {
+    SchemaBuffer_t *pxBuffer;
+    uint32_t ulPos = SCHEMA_HEADER_BYTES;
+    uint32_t ulID;
+    uint32_t i, j;
+
+    if (ulLength < SCHEMA_HEADER_BYTES ||
+        ulFrameRecordLength(pucRecord) != ulLength ||
+        usFrameRecordRate(pucRecord) != FRAME_SCHEMA_RATE) {
+        return -1;
+    }
+
+    pxSchema->usHash = SchemaGet16(pucRecord + 4);
+    if (SchemaHash(pucRecord + 6, ulLength - 6) != pxSchema->usHash) {
+        return -1;
+    }
+
+    pxSchema->usFirmwareVersion = SchemaGet16(pucRecord + 6);
+    pxSchema->ucProfile = pucRecord[8];
+    pxSchema->ucLayoutID = pucRecord[9];
+    pxSchema->ulChannelCount = pucRecord[10];
+    pxSchema->ulBufferCount = pucRecord[11];
+    if (pxSchema->ulChannelCount > SCHEMA_MAX_CHANNELS ||
+        pxSchema->ulBufferCount > SCHEMA_MAX_BUFFERS ||
+        ulLength < ulPos + pxSchema->ulChannelCount * SCHEMA_CHANNEL_BYTES) {
+        return -1;
+    }
+
+    for (i = 0; i < pxSchema->ulChannelCount; i++) {
+        pxSchema->pxChannels[i].ucID = pucRecord[ulPos];
+        pxSchema->pxChannels[i].ucWidth = pucRecord[ulPos + 1];
+        pxSchema->pxChannels[i].ucType = pucRecord[ulPos + 2];
+        pxSchema->pxChannels[i].usRateHz = SchemaGet16(pucRecord + ulPos + 3);
+        ulPos += SCHEMA_CHANNEL_BYTES;
+    }
+
+    for (i = 0; i < pxSchema->ulBufferCount; i++) {
+        pxBuffer = &(pxSchema->pxBuffers[i]);
+
+        if (ulLength < ulPos + SCHEMA_BUFFER_BYTES) {
+            return -1;
+        }
+        pxBuffer->usRateHz = SchemaGet16(pucRecord + ulPos);
+        pxBuffer->ulChannelCount = pucRecord[ulPos + 2];
+        ulPos += SCHEMA_BUFFER_BYTES;
+
+        if (pxBuffer->ulChannelCount > SCHEMA_MAX_CHANNELS ||
+            ulLength < ulPos + pxBuffer->ulChannelCount) {
+            return -1;
+        }
+
+        for (j = 0; j < pxBuffer->ulChannelCount; j++) {
+            ulID = pucRecord[ulPos++];
+            /* Channel entries are in ID order, so an ID is its index. */
+            if (ulID >= pxSchema->ulChannelCount) {
+                return -1;
+            }
+            pxBuffer->pucIDs[j] = ulID;
+            pxBuffer->pucWidths[j] = pxSchema->pxChannels[ulID].ucWidth;
+        }
+    }
+
+    if (ulPos != ulLength) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Fills in pxLayout with the layout of a frame's samples from pxSchema,
+ * which must be the schema the frame references. Returns the number of
+ * channels, or -1 if the frame references another schema (or none) or the
+ * schema has no buffer at the frame's rate. pxLayout points into pxSchema.
+ */
+int32_t lSchemaGetLayout(const Schema_t *pxSchema, const uint8_t *pucFrame,
+                         FrameLayout_t *pxLayout) {
+    uint16_t usRateHz = usFrameRecordRate(pucFrame);
+    uint32_t i;
+
+    if (usFrameSchemaHash(pucFrame) != pxSchema->usHash) {
+        return -1;
+    }
+
+    for (i = 0; i < pxSchema->ulBufferCount; i++) {
+        if (pxSchema->pxBuffers[i].usRateHz == usRateHz) {
+            pxLayout->pucWidths = pxSchema->pxBuffers[i].pucWidths;
+            pxLayout->ulChannelCount = pxSchema->pxBuffers[i].ulChannelCount;
+            return pxLayout->ulChannelCount;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,81 @@
+/*
+ * schema_decode.h
+ * Host-side parsing of the schema records sent by ExplorerLink.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEMA_DECODE_H_
+#define SCHEMA_DECODE_H_
+
+
+#include <stdint.h>
+#include "frame_decode.h"
+
+
+/* These mirror the device's definitions in schema.h and channel.h. */
+#define SCHEMA_HEADER_BYTES             12
+#define SCHEMA_CHANNEL_BYTES            5
+#define SCHEMA_BUFFER_BYTES             3
+#define SCHEMA_MAX_CHANNELS             48
+#define SCHEMA_MAX_BUFFERS              8
+
+#define SCHEMA_TYPE_UNSIGNED            0
+#define SCHEMA_TYPE_SIGNED              1
+#define SCHEMA_TYPE_FLAGS               2
+
+
+/* One channel as described by a schema */
+typedef struct {
+    /* Position of the channel on the device, which burst and other records
+     * use to identify it */
+    uint8_t ucID;
+    uint8_t ucWidth;
+    uint8_t ucType;
+    /* Rate the channel is sampled at, or 0 if it isn't */
+    uint16_t usRateHz;
+} SchemaChannel_t;
+
+/* The channels of one sample buffer, in the order their values appear in a
+ * sample */
+typedef struct {
+    uint16_t usRateHz;
+    uint32_t ulChannelCount;
+    uint8_t pucIDs[SCHEMA_MAX_CHANNELS];
+    uint8_t pucWidths[SCHEMA_MAX_CHANNELS];
+} SchemaBuffer_t;
+
+typedef struct {
+    uint16_t usHash;
+    uint16_t usFirmwareVersion;
+    uint8_t ucProfile;
+    uint8_t ucLayoutID;
+    uint32_t ulChannelCount;
+    SchemaChannel_t pxChannels[SCHEMA_MAX_CHANNELS];
+    uint32_t ulBufferCount;
+    SchemaBuffer_t pxBuffers[SCHEMA_MAX_BUFFERS];
+} Schema_t;
+
+
+int32_t lSchemaDecode(const uint8_t *pucRecord, uint32_t ulLength,
+                      Schema_t *pxSchema);
+int32_t lSchemaGetLayout(const Schema_t *pxSchema, const uint8_t *pucFrame,
+                         FrameLayout_t *pxLayout);
+
+
+#endif /* SCHEMA_DECODE_H_ */
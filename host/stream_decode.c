@@ -0,0 +1,133 @@
+/*
+ * stream_decode.c
+ * Host-side parsing of the packets that wrap every record on the TCP stream
+ * (see modem_uart_task.h). Records taken out of packets are then handled
+ * with host/frame_decode.c and the other decoders. This file is not part of
+ * the firmware build.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "stream_decode.h"
+
+
+static uint16_t StreamGet16(const uint8_t *pucBytes) {
+    return (uint16_t)(pucBytes[0] | (pucBytes[1] << 8));
+}
+
+/*
+ * Continues a CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+ * over ulLength bytes, bit by bit. The device uses a table for the same CRC.
+ */
+static uint16_t StreamCRC16(const uint8_t *pucData, uint32_t ulLength,
+                            uint16_t usCRC) {
+    uint32_t i;
+
+    while (ulLength--) {
+        usCRC ^= (uint16_t)(*pucData++ << 8);
+        for (i = 0; i < 8; i++) {
+            usCRC = (usCRC & 0x8000) ? (uint16_t)((usCRC << 1) ^ 0x1021) :
+                                       (uint16_t)(usCRC << 1);
+        }
+    }
+
+    return usCRC;
+}
+
+/*
+ * Resets the parser for a new connection. The sequence isn't checked until
+ * the first packet is accepted.
+ */
+void vStreamInit(StreamState_t *pxState) {
+    pxState->bSynced = false;
+    pxState->usNextSeq = 0;
+    pxState->ulSkippedBytes = 0;
+}
+
+/*
+ * Looks for the next intact packet at the start of pucData, which holds
+ * ulBytes of received stream. Bytes before it that aren't a packet (or are
+ * one that fails its CRC) are skipped one at a time, so the parser
+ * resynchronizes at the first good packet after any corruption.
+ *
+ * Returns true if a packet was found and filled in pxPacket. Either way,
+ * *pulConsumed is the number of bytes at the start of pucData that are done
+ * with; the rest must be passed again, with more data appended, in the next
+ * call. pxPacket points into pucData, so the packet must be used first.
+ */
+bool bStreamNextPacket(StreamState_t *pxState, const uint8_t *pucData,
+                       uint32_t ulBytes, StreamPacket_t *pxPacket,
+                       uint32_t *pulConsumed) {
+    uint32_t ulPos = 0;
+    uint32_t ulLength;
+    uint32_t ulTotal;
+    uint16_t usCRC;
+    uint16_t usSeq;
+
+    while (ulPos + STREAM_HEADER_BYTES + STREAM_MIN_RECORD_BYTES <= ulBytes) {
+        if (pucData[ulPos] != STREAM_SYNC_0 ||
+            pucData[ulPos + 1] != STREAM_SYNC_1) {
+            ulPos++;
+            continue;
+        }
+
+        ulLength = StreamGet16(pucData + ulPos + STREAM_HEADER_BYTES + 2);
+        if (ulLength < STREAM_MIN_RECORD_BYTES ||
+            ulLength > STREAM_MAX_RECORD_BYTES) {
+            ulPos++;
+            continue;
+        }
+
+        /* Wait for the rest of a candidate packet before judging it. */
+        ulTotal = STREAM_HEADER_BYTES + ulLength + STREAM_CRC_BYTES;
+        if (ulPos + ulTotal > ulBytes) {
+            break;
+        }
+
+        usCRC = StreamCRC16(pucData + ulPos + 2,
+                            STREAM_HEADER_BYTES - 2 + ulLength, 0xFFFF);
+        if (usCRC != StreamGet16(pucData + ulPos + ulTotal -
+                                 STREAM_CRC_BYTES)) {
+            ulPos++;
+            continue;
+        }
+
+        usSeq = StreamGet16(pucData + ulPos + 2);
+
+        pxPacket->usSeq = usSeq;
+        pxPacket->pucRecord = pucData + ulPos + STREAM_HEADER_BYTES;
+        pxPacket->ulLength = ulLength;
+        pxPacket->ulSkippedBytes = pxState->ulSkippedBytes + ulPos;
+        pxPacket->ulLostPackets = pxState->bSynced ?
+                                  (uint16_t)(usSeq - pxState->usNextSeq) : 0;
+
+        pxState->bSynced = true;
+        pxState->usNextSeq = usSeq + 1;
+        pxState->ulSkippedBytes = 0;
+
+        *pulConsumed = ulPos + ulTotal;
+        return true;
+    }
+
+    pxState->ulSkippedBytes += ulPos;
+    *pulConsumed = ulPos;
+    return false;
+}
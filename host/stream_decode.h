@@ -0,0 +1,74 @@
+/*
+ * stream_decode.h
+ * Host-side splitting of the TCP stream into packets.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAM_DECODE_H_
+#define STREAM_DECODE_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* These mirror the device's definitions in modem_uart_task.h. */
+#define STREAM_SYNC_0                   0x55
+#define STREAM_SYNC_1                   0xEC
+#define STREAM_HEADER_BYTES             4
+#define STREAM_CRC_BYTES                2
+
+/* Shortest record (rate and size fields only), and a record length larger
+ * than any the device sends. Lengths outside these bounds are taken as a
+ * false sync without waiting for the CRC. */
+#define STREAM_MIN_RECORD_BYTES         4
+#define STREAM_MAX_RECORD_BYTES         1024
+
+
+/* Parser state for one connection */
+typedef struct {
+    /* Whether a packet has been accepted yet, and the sequence number the
+     * next one should have */
+    bool bSynced;
+    uint16_t usNextSeq;
+    /* Bytes discarded since the last packet */
+    uint32_t ulSkippedBytes;
+} StreamState_t;
+
+/* One packet found in the stream */
+typedef struct {
+    uint16_t usSeq;
+    /* The record the packet carries, within the data passed to the parser */
+    const uint8_t *pucRecord;
+    uint32_t ulLength;
+    /* Bytes discarded while looking for this packet (garbage, or packets
+     * that failed their CRC) */
+    uint32_t ulSkippedBytes;
+    /* Packets missing between the previous packet and this one */
+    uint32_t ulLostPackets;
+} StreamPacket_t;
+
+
+void vStreamInit(StreamState_t *pxState);
+bool bStreamNextPacket(StreamState_t *pxState, const uint8_t *pucData,
+                       uint32_t ulBytes, StreamPacket_t *pxPacket,
+                       uint32_t *pulConsumed);
+
+
+#endif /* STREAM_DECODE_H_ */
@@ -0,0 +1,276 @@
+/*
+ * window_fault_run.c
+ * Sends a fixed set of records through the upload window (window.c) over
+ * the simulated link (fault_link.c) to the stand-in server (ack_server.c),
+ * and prints how many of them the server unpacked. Without the window, each
+ * record is sent once, as without the upload window (window.c). This file is
+ * not part of the firmware build. From the top of the tree:
+ *
+ *   gcc -std=c99 -O2 -I. -Ihost -o window_fault_run host/window_fault_run.c \
+ *       window.c crc.c host/ack_server.c host/fault_link.c \
+ *       host/stream_decode.c host/lz_decode.c
+ *   ./window_fault_run <window 0|1> <drop PPM> <corrupt PPM>
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc.h"
+#include "window.h"
+#include "ack_server.h"
+#include "fault_link.h"
+
+
+/* Records to deliver, one made every RUN_PRODUCE_TICKS ticks. The run lasts
+ * three times as long as production, to leave time for resends. */
+#define RUN_RECORDS                     20000
+#define RUN_PRODUCE_TICKS               2
+#define RUN_TICKS                       ( 3 * RUN_PRODUCE_TICKS * \
+                                          RUN_RECORDS )
+
+/* Each record is a frame-like 16 bytes: rate, size, its index and filler */
+#define RUN_RECORD_RATE                 100
+#define RUN_RECORD_BYTES                16
+#define RUN_PACKET_BYTES                ( STREAM_HEADER_BYTES + \
+                                          RUN_RECORD_BYTES + STREAM_CRC_BYTES )
+
+/* Link in-flight capacity, bytes the server receives per tick, and ticks
+ * spent reconnecting after a drop */
+#define RUN_LINK_CAPACITY               1500
+#define RUN_DELIVER_BYTES               40
+#define RUN_RECONNECT_TICKS             50
+#define RUN_SEED                        12345
+
+
+/* Whether the server has unpacked each record */
+static bool pbReceived[RUN_RECORDS];
+
+/* Records waiting to be sent, in order: new ones, and ones the window had
+ * to give up (the flash log on the device). Each record is in here at most
+ * once. */
+static uint32_t pulPending[RUN_RECORDS];
+static uint32_t ulPendingRead = 0;
+static uint32_t ulPendingCount = 0;
+
+static FaultLink_t xLink;
+static AckServer_t xServer;
+static uint16_t usSeq = 0;
+static bool bUseWindow;
+/* The device only uses the window once the server has acknowledged */
+static bool bAcked = false;
+
+
+/*
+ * Adds a record to the back of the pending list.
+ */
+static void RunPend(uint32_t ulIndex) {
+    pulPending[(ulPendingRead + ulPendingCount++) % RUN_RECORDS] = ulIndex;
+}
+
+/*
+ * Marks each record the server unpacks.
+ */
+static void RunReceive(const uint8_t *pucRecord, uint32_t ulLength,
+                       void *pvContext) {
+    uint32_t ulIndex;
+
+    (void)pvContext;
+
+    if (ulLength == RUN_RECORD_BYTES) {
+        memcpy(&ulIndex, pucRecord + 4, 4);
+        if (ulIndex < RUN_RECORDS) {
+            pbReceived[ulIndex] = true;
+        }
+    }
+}
+
+/*
+ * Sends record ulIndex as one packet, keeping it in the window if that is
+ * in use. The window's oldest records go back on the pending list if it has
+ * no room. Returns false if the link can't take the packet.
+ */
+static bool RunSend(uint32_t ulIndex) {
+    uint8_t pucPacket[RUN_PACKET_BYTES];
+    uint8_t *pucRecord = pucPacket + STREAM_HEADER_BYTES;
+    uint16_t usRate = RUN_RECORD_RATE;
+    uint16_t usSize = RUN_RECORD_BYTES;
+    uint16_t usCRC;
+    const uint8_t *pucOldest;
+    uint32_t ulLength;
+    uint32_t ulOldest;
+
+    if (xLink.xConfig.ulCapacity - xLink.ulCount < RUN_PACKET_BYTES) {
+        return false;
+    }
+
+    pucPacket[0] = STREAM_SYNC_0;
+    pucPacket[1] = STREAM_SYNC_1;
+    memcpy(pucPacket + 2, &usSeq, 2);
+    memcpy(pucRecord, &usRate, 2);
+    memcpy(pucRecord + 2, &usSize, 2);
+    memcpy(pucRecord + 4, &ulIndex, 4);
+    memset(pucRecord + 8, ulIndex & 0xFF, RUN_RECORD_BYTES - 8);
+    usCRC = usCRC16(pucPacket + 2, 2 + RUN_RECORD_BYTES, CRC16_INIT);
+    memcpy(pucRecord + RUN_RECORD_BYTES, &usCRC, 2);
+
+    ulFaultLinkSend(&xLink, pucPacket, RUN_PACKET_BYTES);
+
+    if (bUseWindow && bAcked) {
+        while (!bWindowAdd(pucRecord, RUN_RECORD_BYTES, usSeq, usSeq)) {
+            pucOldest = pucWindowPeek(&ulLength);
+            memcpy(&ulOldest, pucOldest + 4, 4);
+            RunPend(ulOldest);
+            vWindowDrop();
+        }
+    }
+
+    usSeq++;
+    return true;
+}
+
+/*
+ * Sends the records the window wants sent again: all of them after a
+ * reconnect, otherwise those the server skipped over.
+ */
+static void RunResend(bool bReconnected) {
+    const uint8_t *pucRecord;
+    uint32_t ulLength;
+    uint32_t ulIndex;
+    uint32_t ulCount;
+
+    if (bReconnected) {
+        vWindowRestart();
+    }
+
+    for (ulCount = ulWindowCount(); ulCount; ulCount--) {
+        if (!bReconnected && !bWindowMissed()) {
+            break;
+        }
+
+        pucRecord = pucWindowPeek(&ulLength);
+        memcpy(&ulIndex, pucRecord + 4, 4);
+        vWindowDrop();
+        if (!RunSend(ulIndex)) {
+            RunPend(ulIndex);
+        }
+    }
+}
+
+/*
+ * Passes the server's acknowledgement lines to the window, parsed as the
+ * Modem UART task does.
+ */
+static void RunTakeAcks(void) {
+    char pcLine[ACK_MAX_LINE_BYTES];
+    char *pcEnd;
+    uint16_t usCumulative;
+    uint16_t pusSelective[WINDOW_MAX_SELECTIVE];
+    uint32_t ulSelectiveCount;
+
+    while (ulAckServerGetAck(&xServer, pcLine)) {
+        usCumulative = strtoul(pcLine + 4, &pcEnd, 10);
+        ulSelectiveCount = 0;
+        while (*pcEnd == ',' && ulSelectiveCount < WINDOW_MAX_SELECTIVE) {
+            pusSelective[ulSelectiveCount++] = strtoul(pcEnd + 1, &pcEnd, 10);
+        }
+
+        bAcked = true;
+        vWindowAck(usCumulative, pusSelective, ulSelectiveCount);
+    }
+}
+
+int main(int argc, char **argv) {
+    FaultLinkConfig_t xConfig = {
+        .ulSeed = RUN_SEED,
+        .ulCapacity = RUN_LINK_CAPACITY
+    };
+    uint8_t pucDelivered[RUN_DELIVER_BYTES];
+    uint32_t ulNext = 0;
+    uint32_t ulDownTicks = 0;
+    bool bReconnected = false;
+    uint32_t ulReceived = 0;
+    uint32_t ulTick;
+    uint32_t i;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <window 0|1> <drop PPM> <corrupt PPM>\n",
+                argv[0]);
+        return 1;
+    }
+
+    bUseWindow = (atoi(argv[1]) != 0);
+    xConfig.ulDropPPM = strtoul(argv[2], NULL, 10);
+    xConfig.ulCorruptPPM = strtoul(argv[3], NULL, 10);
+
+    vFaultLinkInit(&xLink, &xConfig);
+    vAckServerInit(&xServer, RunReceive, NULL);
+
+    for (ulTick = 0; ulTick < RUN_TICKS; ulTick++) {
+        if (ulNext < RUN_RECORDS && ulTick % RUN_PRODUCE_TICKS == 0) {
+            RunPend(ulNext++);
+        }
+
+        if (!bFaultLinkConnected(&xLink)) {
+            if (++ulDownTicks > RUN_RECONNECT_TICKS) {
+                ulDownTicks = 0;
+                vFaultLinkConnect(&xLink);
+                vAckServerConnect(&xServer);
+                bReconnected = true;
+            }
+            continue;
+        }
+
+        if (bUseWindow) {
+            RunResend(bReconnected);
+        }
+        bReconnected = false;
+
+        /* The device stops reading its queue while the window is full */
+        while (ulPendingCount && bFaultLinkConnected(&xLink) &&
+               (!bUseWindow || !bAcked || bWindowRoom(RUN_RECORD_BYTES)) &&
+               RunSend(pulPending[ulPendingRead])) {
+            ulPendingRead = (ulPendingRead + 1) % RUN_RECORDS;
+            ulPendingCount--;
+        }
+
+        vAckServerReceive(&xServer, pucDelivered,
+                          ulFaultLinkDeliver(&xLink, pucDelivered,
+                                             RUN_DELIVER_BYTES));
+        RunTakeAcks();
+    }
+
+    for (i = 0; i < RUN_RECORDS; i++) {
+        ulReceived += pbReceived[i];
+    }
+
+    printf("window %d, drop %u ppm, corrupt %u ppm: %u/%u received\n",
+           bUseWindow, xConfig.ulDropPPM, xConfig.ulCorruptPPM, ulReceived,
+           RUN_RECORDS);
+    printf("  drops %u, bytes lost %u, bytes corrupted %u, "
+           "unusable packets %u, left pending %u, left in window %u\n",
+           xLink.xStats.ulDrops, xLink.xStats.ulLostBytes,
+           xLink.xStats.ulCorruptedBytes, xServer.xStats.ulUnusablePackets,
+           ulPendingCount, ulWindowCount());
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * lz.c
+ * A small LZ77-style compressor for the cellular uplink. Blocks of at most
+ * LZ_BLOCK_BYTES are compressed independently with a greedy matcher and a
+ * small hash table, which keeps RAM use to a few hundred bytes and the work
+ * per byte low. See lz.h for the format.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "debug_helper.h"
+#include "lz.h"
+#include "sample.h"
+#include "timestamp.h"
+
+
+/* Number of bits in a hash, giving the number of entries in the match hash
+ * table. Each entry holds the last position in the block where a 3-byte
+ * sequence with that hash started. */
+#define LZ_HASH_BITS                    7
+#define LZ_HASH_ENTRIES                 ( 1 << LZ_HASH_BITS )
+
+
+/* Totals since startup for measuring the stage: raw and compressed bytes,
+ * and timestamp counter ticks (system clock cycles) spent compressing */
+static uint32_t ulStatRawBytes = 0;
+static uint32_t ulStatCompressedBytes = 0;
+static uint64_t ullStatCycles = 0;
+
+
+/*
+ * Hashes the 3 bytes at pucIn into a table index.
+ */
+static uint32_t LZHash(const uint8_t *pucIn) {
+    uint32_t ulKey = pucIn[0] | (pucIn[1] << 8) | (pucIn[2] << 16);
+
+    return (ulKey * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/*
+ * Writes ulCount literal bytes as one or more literal runs. Returns the
+ * number of bytes written.
+ */
+static uint32_t LZLiterals(const uint8_t *pucIn, uint32_t ulCount,
+                           uint8_t *pucOut) {
+    uint32_t ulPos = 0;
+    uint32_t ulRun;
+
+    while (ulCount) {
+        ulRun = (ulCount > LZ_MAX_LITERALS) ? LZ_MAX_LITERALS : ulCount;
+        pucOut[ulPos++] = ulRun - 1;
+        memcpy(pucOut + ulPos, pucIn, ulRun);
+        ulPos += ulRun;
+        pucIn += ulRun;
+        ulCount -= ulRun;
+    }
+
+    return ulPos;
+}
+
+/*
+ * Compresses a block of at most LZ_BLOCK_BYTES into a complete record in
+ * pucRecord, which must hold LZ_MAX_RECORD_BYTES. bContinued marks a block
+ * that starts partway through a record. Returns the record length.
+ */
+uint32_t ulLZCompress(const uint8_t *pucIn, uint32_t ulInBytes,
+                      bool bContinued, uint8_t *pucRecord) {
+    /* Positions are below LZ_BLOCK_BYTES (256), so a byte each is enough.
+     * Stale entries are harmless, since every candidate is verified. */
+    static uint8_t pucTable[LZ_HASH_ENTRIES];
+    uint64_t ullStart = ullTimestampCounter();
+    uint32_t ulOut = LZ_HEADER_BYTES;
+    uint32_t ulPos = 0;
+    uint32_t ulLiteralStart = 0;
+    uint32_t ulHash;
+    uint32_t ulCandidate;
+    uint32_t ulMatch;
+    uint16_t usRate = SAMPLE_LZ_RATE;
+    uint16_t usSize;
+    uint16_t usRawSize;
+
+    if (ulInBytes > LZ_BLOCK_BYTES) {
+        ulInBytes = LZ_BLOCK_BYTES;
+    }
+    usRawSize = ulInBytes | (bContinued ? LZ_FLAG_CONTINUED : 0);
+
+    memset(pucTable, 0, sizeof(pucTable));
+
+    while (ulPos + LZ_MIN_MATCH <= ulInBytes) {
+        ulHash = LZHash(pucIn + ulPos);
+        ulCandidate = pucTable[ulHash];
+        pucTable[ulHash] = ulPos;
+
+        if (ulCandidate < ulPos &&
+            pucIn[ulCandidate] == pucIn[ulPos] &&
+            pucIn[ulCandidate + 1] == pucIn[ulPos + 1] &&
+            pucIn[ulCandidate + 2] == pucIn[ulPos + 2]) {
+
+            ulMatch = LZ_MIN_MATCH;
+            while (ulPos + ulMatch < ulInBytes && ulMatch < LZ_MAX_MATCH &&
+                   pucIn[ulCandidate + ulMatch] == pucIn[ulPos + ulMatch]) {
+                ulMatch++;
+            }
+
+            ulOut += LZLiterals(pucIn + ulLiteralStart, ulPos - ulLiteralStart,
+                                pucRecord + ulOut);
+            pucRecord[ulOut++] = 0x80 + (ulMatch - LZ_MIN_MATCH);
+            pucRecord[ulOut++] = ulPos - ulCandidate - 1;
+
+            ulPos += ulMatch;
+            ulLiteralStart = ulPos;
+        }
+        else {
+            ulPos++;
+        }
+    }
+
+    ulOut += LZLiterals(pucIn + ulLiteralStart, ulInBytes - ulLiteralStart,
+                        pucRecord + ulOut);
+
+    usSize = ulOut;
+    memcpy(pucRecord, &usRate, 2);
+    memcpy(pucRecord + 2, &usSize, 2);
+    memcpy(pucRecord + 4, &usRawSize, 2);
+
+    ulStatRawBytes += ulInBytes;
+    ulStatCompressedBytes += ulOut;
+    ullStatCycles += ullTimestampCounter() - ullStart;
+
+    return ulOut;
+}
+
+/*
+ * Prints the compression achieved so far (compressed bytes per 100 raw,
+ * including record headers) and the CPU cost in cycles per raw byte.
+ */
+void vLZPrintStats(void) {
+
+    if (ulStatRawBytes) {
+        debug_print("uplink compression: %d bytes per 100, %d cycles/byte\n",
+                    (uint32_t)(((uint64_t)ulStatCompressedBytes * 100) /
+                               ulStatRawBytes),
+                    (uint32_t)(ullStatCycles / ulStatRawBytes));
+    }
+}
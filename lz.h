@@ -0,0 +1,72 @@
+/*
+ * lz.h
+ * Definitions and public functions for the uplink compression stage.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef LZ_H_
+#define LZ_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Compressed blocks are sent as records of their own:
+ *
+ *   rate (2 bytes)        SAMPLE_LZ_RATE
+ *   size (2 bytes)        total record length in bytes
+ *   raw size (2 bytes)    length of the data once decompressed, plus
+ *                         LZ_FLAG_CONTINUED if the block starts partway
+ *                         through a record
+ *   tokens
+ *
+ * A token byte below 0x80 is followed by (token + 1) literal bytes. A token
+ * byte of 0x80 or above is followed by one distance byte, and copies
+ * (token - 0x80 + LZ_MIN_MATCH) bytes starting (distance + 1) bytes back in
+ * the decompressed data. Matches may overlap the bytes they produce.
+ *
+ * Each block is compressed on its own, so a block never refers back into an
+ * earlier one. The decompressed blocks concatenate into the same stream of
+ * records that is sent without compression. Records start a new block when
+ * they don't fit in the current one, so only records larger than a block
+ * are split. A host that loses a block can then pick the stream back up at
+ * the next block without LZ_FLAG_CONTINUED. The host-side decompressor is in
+ * host/lz_decode.c. */
+#define LZ_HEADER_BYTES                 6
+#define LZ_MIN_MATCH                    3
+#define LZ_MAX_MATCH                    ( 0x7F + LZ_MIN_MATCH )
+#define LZ_MAX_LITERALS                 0x80
+#define LZ_FLAG_CONTINUED               0x8000
+
+/* Largest block of raw data compressed at once. Distances are one byte, so
+ * this is also the window. */
+#define LZ_BLOCK_BYTES                  256
+/* Largest compressed record: the header plus one token per LZ_MAX_LITERALS
+ * raw bytes in the worst case (no matches at all) */
+#define LZ_MAX_RECORD_BYTES             ( LZ_HEADER_BYTES + LZ_BLOCK_BYTES + \
+                                          ( LZ_BLOCK_BYTES / LZ_MAX_LITERALS ) )
+
+
+uint32_t ulLZCompress(const uint8_t *pucIn, uint32_t ulInBytes,
+                      bool bContinued, uint8_t *pucRecord);
+void vLZPrintStats(void);
+
+
+#endif /* LZ_H_ */
@@ -68,10 +68,15 @@ const ModemResponse_t rspATNETCLOSESuccess = {.pucData = "+NETCLOSE: 0\r\n",};
 
 const ModemCommand_t cmdATCIPOPENQuery = {.pucData = "AT+CIPOPEN?\r\n",};
 const ModemResponse_t rspATCIPOPENTrue = {.pucData = "+CIPOPEN: 0,\"TCP\",\"208.113.167.211\",21234,-1\r\r\n",};
+/* The UDP forms here and below follow the SIM5320 AT command manual (link 0,
+ * local port 21234), but haven't yet been tried with transparent mode on a
+ * modem. */
+const ModemResponse_t rspATCIPOPENUDPTrue = {.pucData = "+CIPOPEN: 0,\"UDP\",\"208.113.167.211\",21234,-1\r\r\n",};
 const ModemResponse_t rspATCIPOPENFalse = {.pucData = "+CIPOPEN: 0\r\r\n",};
 const ModemResponse_t rspATCIPOPENRest = {.pucData = "+CIPOPEN: ", .ulCheckLength = 10};
 
 const ModemCommand_t cmdATCIPOPEN = {.pucData = "AT+CIPOPEN=0,\"TCP\",\"208.113.167.211\",21234\r\n",};
+const ModemCommand_t cmdATCIPOPENUDP = {.pucData = "AT+CIPOPEN=0,\"UDP\",\"208.113.167.211\",21234,21234\r\n",};
 const ModemResponse_t rspATCIPOPENConnect = {.pucData = "CONNECT 115200\r\n",};
 const ModemResponse_t rspATCIPOPENSuccess = {.pucData = "+CIPOPEN: 0,0\r\n",};
 const ModemResponse_t rspATCIPOPENFail = {.pucData = "+CIPOPEN: 0,", .ulCheckLength = 12};
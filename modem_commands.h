@@ -84,10 +84,12 @@ extern const ModemResponse_t rspATNETCLOSESuccess;
 
 extern const ModemCommand_t cmdATCIPOPENQuery;
 extern const ModemResponse_t rspATCIPOPENTrue;
+extern const ModemResponse_t rspATCIPOPENUDPTrue;
 extern const ModemResponse_t rspATCIPOPENFalse;
 extern const ModemResponse_t rspATCIPOPENRest;
 
 extern const ModemCommand_t cmdATCIPOPEN;
+extern const ModemCommand_t cmdATCIPOPENUDP;
 extern const ModemResponse_t rspATCIPOPENConnect;
 extern const ModemResponse_t rspATCIPOPENSuccess;
 extern const ModemResponse_t rspATCIPOPENFail;
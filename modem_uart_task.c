@@ -42,22 +42,40 @@
 #include "driverlib/sysctl.h"
 #include "driverlib/uart.h"
 #include "utils/uartstdio.h"
+#include "budget.h"
+#include "burst.h"
 #include "channel.h"
+#include "clock_sync.h"
+#include "crc.h"
 #include "debug_helper.h"
 #include "hibernate_rtc.h"
+#include "lz.h"
 #include "modem_commands.h"
 #include "modem_mgmt_task.h"
 #include "modem_uart_task.h"
 #include "priorities.h"
+#include "profile.h"
 #include "remote_start_task.h"
 #include "ring_buffer.h"
 #include "sample.h"
+#include "schema.h"
 #include "stack_sizes.h"
+#include "store.h"
+#include "store_task.h"
+#include "timestamp.h"
+#include "uplink.h"
+#include "urgent.h"
+#include "window.h"
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
 #include "semphr.h"
 
+/* UART6 baud rate, and the bytes per second it can carry with 8-n-1
+ * framing */
+#define UART6_BAUD                      115200
+#define UART6_BYTES_PER_S               ( UART6_BAUD / 10 )
+
 /* Sizes of UART ring buffers */
 #define TX_BUFFER_SIZE                  256
 #define RX_BUFFER_SIZE                  256
@@ -91,7 +109,8 @@ volatile ModemStatus_t xModemStatus = {
     COMMAND_MODE,   /* networkMode */
     false,          /* networkOpen */
     false,          /* tcpConnectionOpen */
-    COMMAND_MODE    /* tcpConnectionMode */
+    COMMAND_MODE,   /* tcpConnectionMode */
+    false           /* linkUDP */
 };
 
 /* Required memory for ring buffers */
@@ -114,6 +133,77 @@ volatile RingBuffer_t xRxBuffer = {
                              .ulWriteIndex = 0
 };
 
+/* Server lines completed in the RX buffer while in data mode (counted by the
+ * ISR, blank lines excluded), the bytes of the line now arriving, the tick
+ * the oldest unread line completed, and how many lines the task has read.
+ * Lines are read as soon as they are complete, even between the records of
+ * a long send, so commands don't wait behind bulk data. */
+static volatile uint32_t ulRxLines = 0;
+static volatile uint32_t ulRxLineBytes = 0;
+static volatile TickType_t xRxLineTick = 0;
+static volatile uint32_t ulRxLinesRead = 0;
+
+/* Whether the TCP data stream is compressed (set by the server), the
+ * stream data waiting to be compressed as one block, and whether that block
+ * starts partway through a record */
+static bool bUplinkCompress = false;
+static uint8_t pucUplinkBlock[LZ_BLOCK_BYTES];
+static uint32_t ulUplinkBlockBytes = 0;
+static bool bUplinkBlockContinued = false;
+
+/* Sequence number of the next TCP stream packet */
+static uint16_t usStreamSeq = 0;
+
+/* Whether the server acknowledges packets, so records are kept in the
+ * upload window (see window.h) until it does. Set by its first
+ * acknowledgement. */
+static bool bUplinkAcked = false;
+
+/* Whether the server wants the next connection to be UDP (see
+ * modem_uart_task.h), and when the schema was last sent */
+static bool bLinkUDPRequested = false;
+static TickType_t xSchemaSentTick = 0;
+
+/* Records sent over UDP that the server reported missing and were logged to
+ * flash, and those pushed out of the upload window unacknowledged */
+static uint32_t ulUDPMissedRecords = 0;
+static uint32_t ulUDPUnackedRecords = 0;
+
+/* Times the task has been woken to send queued records, bytes written to
+ * UART6, and their values and the tick at the last vModemUARTPrintStats() */
+static uint32_t ulSendWakeups = 0;
+static uint32_t ulUART6TxBytes = 0;
+static uint32_t ulLastSendWakeups = 0;
+static uint32_t ulLastUART6TxBytes = 0;
+static TickType_t xLastStatsTick = 0;
+
+/* Cycles spent sending stream packets (CRC and copying into the transmit
+ * buffer, excluding waits for room in it), the bytes in those packets, and
+ * the cycles spent waiting */
+static uint64_t ullPacketCycles = 0;
+static uint32_t ulPacketBytes = 0;
+static uint64_t ullTxWaitCycles = 0;
+
+/* Milliseconds and UART6 bytes with clients watching (index 0) and in
+ * archive mode with none (index 1), counted up to xViewerMarkTick */
+static uint32_t pulViewerMS[2] = { 0, 0 };
+static uint32_t pulViewerBytes[2] = { 0, 0 };
+static TickType_t xViewerMarkTick = 0;
+static uint32_t ulViewerMarkBytes = 0;
+
+/* Server lines read, and the milliseconds from the oldest line of each batch
+ * being complete to the batch being read (the last batch's is kept for
+ * replies) */
+static uint32_t ulCommandLines = 0;
+static uint32_t ulCommandWaits = 0;
+static uint64_t ullCommandWaitSumMS = 0;
+static uint32_t ulCommandWaitMaxMS = 0;
+static uint32_t ulCommandWaitMS = 0;
+
+/* A whole record being sent, resent or read from the uplink queue. Static
+ * to keep it off the task's stack. */
+static uint8_t pucSendRecord[UPLINK_MAX_RECORD_BYTES];
+
 
 /*
  * The UART6 ISR transfers data between the TX and RX ring buffers and the
@@ -127,6 +217,8 @@ void UART6IntHandler(void) {
     uint32_t ulStatus;
     /* Temp variable for byte read from buffer and placed in UART FIFO */
     uint8_t uctxByte;
+    /* Byte read from the UART FIFO and placed in the RX buffer */
+    uint8_t ucRxByte;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
     debug_set_bus( 13 );
@@ -166,8 +258,27 @@ void UART6IntHandler(void) {
         /* Loop until the RX FIFO is empty. Data will not arrive fast enough
          * to keep this loop running indefinitely. UARTCharGetNonBlocking()
          * will always succeed because UARTCharsAvail() is true. */
-        while(UARTCharsAvail(UART6_BASE) && eRingBufferWrite(&xRxBuffer,
-              UARTCharGetNonBlocking(UART6_BASE)) != BUFFER_FULL) {
+        while(UARTCharsAvail(UART6_BASE)) {
+            ucRxByte = UARTCharGetNonBlocking(UART6_BASE);
+            if (eRingBufferWrite(&xRxBuffer, ucRxByte) == BUFFER_FULL) {
+                break;
+            }
+
+            /* Count the server lines completed (see ModemServiceLines()).
+             * A line of just "\r" is blank. */
+            if (ucRxByte != '\n') {
+                ulRxLineBytes++;
+            }
+            else {
+                if (ulRxLineBytes > 1 &&
+                    xModemStatus.tcpConnectionMode == DATA_MODE) {
+                    if (ulRxLines == ulRxLinesRead) {
+                        xRxLineTick = xTaskGetTickCountFromISR();
+                    }
+                    ulRxLines++;
+                }
+                ulRxLineBytes = 0;
+            }
         }
 
         /* TODO: remove this conditional and use MODEM_NOTIFY_RX only */
@@ -223,13 +334,43 @@ static void UART6Prime(void) {
 }
 
 /*
- * Sends a sequence of characters on UART6 to the modem.
+ * Copies a sequence of characters into the UART6 transmit buffer in bulk. The
+ * transmission is only started here if the buffer fills up, in which case
+ * this waits for it to drain rather than dropping characters, so sequences
+ * longer than the buffer can be written. The caller must start the
+ * transmission of what is left with UART6Prime() and the TX interrupt.
  */
-static void UART6Send(uint8_t *pucSend, uint32_t ulLength, uint32_t ulDelayMS) {
+static void UART6Write(const uint8_t *pucSend, uint32_t ulLength) {
+    uint32_t ulWritten;
+    uint64_t ullWaitStart;
+
+    ulUART6TxBytes += ulLength;
 
-    while (ulLength--) {
-        eRingBufferWrite(&xTxBuffer, *pucSend++);
+    while (1) {
+        ulWritten = ulRingBufferWriteBulk(&xTxBuffer, pucSend, ulLength);
+        pucSend += ulWritten;
+        ulLength -= ulWritten;
+
+        if (!ulLength) {
+            break;
+        }
+
+        ullWaitStart = ullTimestampCounter();
+        UART6Prime();
+        UARTIntEnable(UART6_BASE, UART_INT_TX);
+        vTaskDelay(1);
+        ullTxWaitCycles += ullTimestampCounter() - ullWaitStart;
     }
+}
+
+/*
+ * Sends a sequence of characters on UART6 to the modem, waiting for room in
+ * the transmit buffer as needed (see UART6Write()).
+ */
+static void UART6Send(uint8_t *pucSend, uint32_t ulLength, uint32_t ulDelayMS) {
+
+    vBudgetCountCommand(ulLength);
+    UART6Write(pucSend, ulLength);
 
     UART6Prime();
 
@@ -240,7 +381,9 @@ static void UART6Send(uint8_t *pucSend, uint32_t ulLength, uint32_t ulDelayMS) {
      * response because the program is halted. This call delays execution
      * immediately after sending so that the ISR is able to handle responses.
      * TODO: debug compile ifdef */
-    vTaskDelay(pdMS_TO_TICKS(ulDelayMS));
+    if (ulDelayMS) {
+        vTaskDelay(pdMS_TO_TICKS(ulDelayMS));
+    }
 }
 
 /*
@@ -334,6 +477,24 @@ static bool UART6RcvLine(uint8_t *pucBuffer, uint32_t ulWaitTimeMS,
  */
 static void UART6RcvBufferClear(void) {
     vRingBufferClear(&xRxBuffer);
+    ulRxLineBytes = 0;
+    ulRxLinesRead = ulRxLines;
+}
+
+/*
+ * Returns true if a server line has completed in the RX buffer and not been
+ * read yet.
+ */
+static bool ModemLinePending(void) {
+    return ulRxLines != ulRxLinesRead;
+}
+
+/*
+ * Returns true if a long send should stop between records, for a server
+ * line or an urgent record (see urgent.h).
+ */
+static bool ModemSendPreempted(void) {
+    return ModemLinePending() || bUrgentPending();
 }
 
 /*
@@ -390,8 +551,9 @@ static bool ModemEchoOff(void) {
 }
 
 /*
- * Obtains the current local time from the modem and sets the real-time clock
- * to Unix time based on the modem's response.
+ * Obtains the current local time from the modem and passes it to the clock
+ * discipline loop as a coarse reference. This sets the real-time clock to
+ * Unix time the first time it is called (or if the clock is far off).
  *
  * Returns false if an unexpected response arrived.
  */
@@ -436,18 +598,8 @@ static bool ModemUpdateRTCTime(void) {
             /* mktime() gives seconds since a 1900 epoch. Subtracting the first
              * offset gives seconds since the 1970 epoch (Unix time). The
              * second offset is subtracted to bring the local time to GMT. */
-            HibernateRTCSet(mktime(&xTime) - EPOCH_ADJUST_S - lZoneOffsetS);
-
-            /* In addition to setting the RTC to Unix time, we set a match in
-             * the near future to kick off the RTC interrupt sampling cycle.
-             * 2 seconds are added to ensure that the match time isn't in the
-             * past by the time the interrupt is enabled. */
-            HibernateRTCMatchSet(0, HibernateRTCGetS() + 2);
-            HibernateRTCSSMatchSet(0, 0);
-            /* Enable the match interrupt at the peripheral. */
-            HibernateIntEnable(HIBERNATE_INT_RTC_MATCH_0);
-            /* Enable the real-time clock (begin counting). */
-            HibernateRTCEnable();
+            vClockSyncUpdate(mktime(&xTime) - EPOCH_ADJUST_S - lZoneOffsetS,
+                             0, true);
             return true;
         }
     }
@@ -765,6 +917,11 @@ static bool ModemCheckTCPConnection(void) {
     if ( UART6RcvLine(pucRcvdLine, RSP_WAIT_1000_MS, &ulByteCount) &&
          ModemCheckRspLine(pucRcvdLine, &rspATCIPOPENTrue) ) {
         xModemStatus.tcpConnectionOpen = true;
+        xModemStatus.linkUDP = false;
+    }
+    else if (ModemCheckRspLine(pucRcvdLine, &rspATCIPOPENUDPTrue)) {
+        xModemStatus.tcpConnectionOpen = true;
+        xModemStatus.linkUDP = true;
     }
     else {
         xModemStatus.tcpConnectionOpen = false;
@@ -799,7 +956,8 @@ static bool ModemTCPConnect(void) {
     /* Temp variable for length of received lines */
     uint32_t ulByteCount;
 
-    ModemSendCommand(&cmdATCIPOPEN);
+    ModemSendCommand(bLinkUDPRequested ? &cmdATCIPOPENUDP : &cmdATCIPOPEN);
+    xModemStatus.linkUDP = bLinkUDPRequested;
 
     if (xModemStatus.networkMode == DATA_MODE) {
         /* Wait up to 5s for the TCP connection to open. */
@@ -843,29 +1001,236 @@ static bool ModemTCPConnect(void) {
 }
 
 /*
- * Sends on an existing TCP connection.
+ * Sends one record on the TCP stream, wrapped in a packet with a sync word,
+ * sequence number and CRC (see modem_uart_task.h). The three parts are copied
+ * into the transmit buffer in bulk, straight from where they are, and the
+ * transmission is started once for the whole packet.
+ */
+static void ModemTCPSendPacket(uint8_t *pucRecord, uint32_t ulLength) {
+    uint8_t pucHeader[STREAM_HEADER_BYTES];
+    uint16_t usCRC;
+    uint64_t ullStart = ullTimestampCounter();
+    uint64_t ullWaitCycles = ullTxWaitCycles;
+
+    pucHeader[0] = STREAM_SYNC_0;
+    pucHeader[1] = STREAM_SYNC_1;
+    memcpy(pucHeader + 2, &usStreamSeq, 2);
+    usCRC = usCRC16(pucHeader + 2, 2, CRC16_INIT);
+    usCRC = usCRC16(pucRecord, ulLength, usCRC);
+
+    UART6Write(pucHeader, STREAM_HEADER_BYTES);
+    UART6Write(pucRecord, ulLength);
+    UART6Write((uint8_t *)&usCRC, STREAM_CRC_BYTES);
+
+    UART6Prime();
+    UARTIntEnable(UART6_BASE, UART_INT_TX);
+
+    usStreamSeq++;
+
+    /* Time spent waiting for room in the transmit buffer isn't CPU time. */
+    ullPacketCycles += ullTimestampCounter() - ullStart -
+                       (ullTxWaitCycles - ullWaitCycles);
+    ulPacketBytes += STREAM_HEADER_BYTES + ulLength + STREAM_CRC_BYTES;
+    vBudgetCountLink(STREAM_HEADER_BYTES + ulLength + STREAM_CRC_BYTES);
+}
+
+/*
+ * Compresses and sends any TCP stream data waiting in the uplink block. This
+ * is called after every round of sends, so data never waits for a block to
+ * fill and each round can be decompressed on its own.
+ */
+static void ModemTCPFlush(void) {
+    /* Static to keep the record off the task's stack */
+    static uint8_t pucRecord[LZ_MAX_RECORD_BYTES];
+    uint32_t ulLength;
+
+    if (ulUplinkBlockBytes) {
+        ulLength = ulLZCompress(pucUplinkBlock, ulUplinkBlockBytes,
+                                bUplinkBlockContinued, pucRecord);
+        ModemTCPSendPacket(pucRecord, ulLength);
+        ulUplinkBlockBytes = 0;
+        bUplinkBlockContinued = false;
+    }
+}
+
+/*
+ * Keeps a record that was sent in the packets usFirstSeq to usLastSeq until
+ * the server acknowledges it. If the window is full, the oldest records are
+ * moved to the flash log to be sent again later. Over UDP they are dropped
+ * instead: they have most likely arrived, and logging them would send them
+ * twice.
+ */
+static void ModemTCPRetain(uint8_t *pucRecord, uint32_t ulLength,
+                           uint16_t usFirstSeq, uint16_t usLastSeq) {
+    const uint8_t *pucOldest;
+    uint32_t ulOldestLength;
+
+    if (!bUplinkAcked) {
+        return;
+    }
+
+    while (!bWindowAdd(pucRecord, ulLength, usFirstSeq, usLastSeq)) {
+        pucOldest = pucWindowPeek(&ulOldestLength);
+        if (!pucOldest) {
+            break;
+        }
+
+        if (xModemStatus.linkUDP) {
+            ulUDPUnackedRecords++;
+        }
+        else if (!bStoreTaskLog(pucOldest, ulOldestLength)) {
+            debug_print("unacknowledged record dropped\n");
+        }
+        vWindowDrop();
+    }
+}
+
+/*
+ * Sends one whole record on the TCP data stream (a frame, burst, schema or
+ * event). With compression on, records are collected into blocks which are
+ * compressed as they fill up and when ModemTCPFlush() is called. A block
+ * still being filled is sent as the next packet, which gives the sequence
+ * numbers the record is retained under.
+ */
+static void ModemTCPWrite(uint8_t *pucData, uint32_t ulLength) {
+    uint8_t *pucRecord = pucData;
+    uint32_t ulRecordLength = ulLength;
+    uint16_t usFirstSeq;
+    uint32_t ulChunk;
+
+    /* Over UDP, each packet must decode by itself. */
+    if (!bUplinkCompress || xModemStatus.linkUDP) {
+        usFirstSeq = usStreamSeq;
+        ModemTCPSendPacket(pucData, ulLength);
+        ModemTCPRetain(pucRecord, ulRecordLength, usFirstSeq, usFirstSeq);
+        return;
+    }
+
+    /* A record that doesn't fit in the rest of the block starts a new one,
+     * so a lost block only loses the records in it. */
+    if (ulUplinkBlockBytes + ulLength > LZ_BLOCK_BYTES) {
+        ModemTCPFlush();
+    }
+
+    usFirstSeq = usStreamSeq;
+
+    while (ulLength) {
+        ulChunk = LZ_BLOCK_BYTES - ulUplinkBlockBytes;
+        if (ulChunk > ulLength) {
+            ulChunk = ulLength;
+        }
+
+        memcpy(pucUplinkBlock + ulUplinkBlockBytes, pucData, ulChunk);
+        ulUplinkBlockBytes += ulChunk;
+        pucData += ulChunk;
+        ulLength -= ulChunk;
+
+        if (ulUplinkBlockBytes == LZ_BLOCK_BYTES) {
+            ModemTCPFlush();
+            bUplinkBlockContinued = (ulLength != 0);
+        }
+    }
+
+    ModemTCPRetain(pucRecord, ulRecordLength, usFirstSeq,
+                   ulUplinkBlockBytes ? usStreamSeq : usStreamSeq - 1);
+}
+
+/*
+ * Sends records in the upload window again: all of them on a new connection,
+ * otherwise only those the server missed. Each goes back into the window
+ * under its new sequence numbers. Missed records stop early if a server line
+ * or urgent record is waiting. Over UDP, missed records are logged to flash
+ * for TCP to fill in later rather than sent again, and the rest of the
+ * window is left as it is.
+ */
+static void ModemTCPResend(bool bAll) {
+    const uint8_t *pucRecord;
+    uint32_t ulLength;
+    uint32_t ulCount = ulWindowCount();
+
+    if (xModemStatus.linkUDP) {
+        while (bWindowMissed() && !ModemSendPreempted() &&
+               (pucRecord = pucWindowPeek(&ulLength)) != NULL) {
+            bStoreTaskLog(pucRecord, ulLength);
+            vWindowDrop();
+            ulUDPMissedRecords++;
+        }
+        return;
+    }
+
+    if (bAll) {
+        vWindowRestart();
+        if (ulCount) {
+            debug_print("resending %d records\n", ulCount);
+        }
+    }
+
+    while (ulCount-- &&
+           (bAll || (bWindowMissed() && !ModemSendPreempted())) &&
+           (pucRecord = pucWindowPeek(&ulLength)) != NULL) {
+        memcpy(pucSendRecord, pucRecord, ulLength);
+        vWindowDrop();
+        ModemTCPWrite(pucSendRecord, ulLength);
+        vBudgetCountRecord(UPLINK_STREAM_NONE, ulLength);
+    }
+}
+
+/*
+ * Sends the records waiting in the uplink queue (see store_task.c) on an
+ * existing connection, one whole record at a time. Frames that waited past
+ * their stream's deadline (see uplink.h) are logged to flash instead.
+ * Sending stops between records when a server line or urgent record is
+ * waiting, so that either is dealt with within one record of arriving.
  *
  * Returns false if the modem wasn't already in data mode.
  */
-static bool ModemTCPSend(SampleRateBuffer_t *pxBuffer) {
-    /* Temp variable for bytes being moved from sample buffer to UART6Send() */
-    uint8_t ucByteToSend;
+static bool ModemTCPSendQueued(void) {
+    uint8_t *pucRecord = pucSendRecord;
+    uint8_t pucHeader[UPLINK_QUEUE_HEADER_BYTES];
+    TickType_t xQueuedTick;
+    uint16_t usSize;
 
     /* In data mode, the modem is already ready to accept sample data for TCP
      * transmission, so we send it directly. Command mode is not supported. */
     if (xModemStatus.tcpConnectionMode == DATA_MODE) {
-        /* Read from the ring buffer and send bytes until it is empty. This is
-         * the only place ring buffers may be read from, which keeps the
-         * read approximately thread-safe (BUFFER_EMPTY may be incorrectly
-         * returned at times; this is compensated for by having a long enough
-         * buffer to hold sample chunks until the next call). Also, because
-         * entire sample chunks are written within a critical section in the
-         * sampling ISR, it is not possible for this loop to send an incomplete
-         * chunk and then return. It isn't required that complete chunks always
-         * be sent by this function, but worth noting that they always are. */
-        while (eRingBufferRead(&(pxBuffer->xData), &ucByteToSend)
-               != BUFFER_EMPTY) {
-            UART6Send(&ucByteToSend, 1, 0);
+        /* This is the only place the queue is read from. Records are
+         * written whole with the scheduler suspended, so a header is never
+         * read without the rest of its record being available.
+         *
+         * Nothing more is sent over TCP while the upload window is too full
+         * to keep it. The queue backs up, and the Store task logs new
+         * records to flash until the server catches up. Over UDP, live
+         * records push the oldest out of the window instead. */
+        while ((!bUplinkAcked || xModemStatus.linkUDP ||
+                bWindowRoom(UPLINK_MAX_RECORD_BYTES)) &&
+               !ModemSendPreempted() &&
+               eRingBufferReadN(&xUplinkBuffer, pucHeader,
+                                UPLINK_QUEUE_HEADER_BYTES) != BUFFER_EMPTY) {
+            eRingBufferReadN(&xUplinkBuffer, pucRecord,
+                             SAMPLE_METADATA_BYTES);
+            memcpy(&usSize, pucRecord + 2, 2);
+
+            /* A size that can't be right means the queue is corrupt, and
+             * nothing after this point can be trusted. */
+            if (usSize < SAMPLE_METADATA_BYTES ||
+                usSize > UPLINK_MAX_RECORD_BYTES) {
+                vRingBufferClear(&xUplinkBuffer);
+                debug_print("ModemTCPSendQueued dropped a corrupt queue\n");
+                break;
+            }
+
+            eRingBufferReadN(&xUplinkBuffer, pucRecord + SAMPLE_METADATA_BYTES,
+                             usSize - SAMPLE_METADATA_BYTES);
+
+            memcpy(&xQueuedTick, pucHeader + 1, 4);
+            if (!bUplinkSendLive(pucHeader[0], xQueuedTick)) {
+                bStoreTaskLog(pucRecord, usSize);
+                continue;
+            }
+
+            ModemTCPWrite(pucRecord, usSize);
+            vUplinkNoteSent(usSize);
+            vBudgetCountRecord(pucHeader[0], usSize);
         }
         return true;
     }
@@ -873,10 +1238,112 @@ static bool ModemTCPSend(SampleRateBuffer_t *pxBuffer) {
     /* If something other than the expected responses showed up, tell the main
      * loop that it should reset. */
     xModemStatus.knownState = false;
-    debug_print("ModemTCPSend failed\n");
+    debug_print("ModemTCPSendQueued failed\n");
     return false;
 }
 
+/*
+ * Sends the current schema record (see schema.h), which a new connection
+ * needs before any frames, and which is repeated over UDP. Records already
+ * queued may have been encoded with it, so it goes ahead of them.
+ */
+static void ModemTCPSendSchema(void) {
+    uint8_t *pucSchema;
+    uint32_t ulLength;
+
+    /* The Store task may rebuild the schema, so it is copied while that
+     * task can't run. */
+    vTaskSuspendAll();
+    ulLength = ulSchemaGetRecord(&pucSchema);
+    memcpy(pucSendRecord, pucSchema, ulLength);
+    xTaskResumeAll();
+
+    if (ulLength) {
+        ModemTCPWrite(pucSendRecord, ulLength);
+        vBudgetCountRecord(UPLINK_STREAM_NONE, ulLength);
+    }
+
+    xSchemaSentTick = xTaskGetTickCount();
+}
+
+/*
+ * Sends one pending burst record, but only if the previous samples have
+ * already left the TX buffer. Bursts are uploaded lazily this way, one small
+ * record at a time, so that live samples never wait behind more than one
+ * record.
+ */
+static void ModemTCPSendBurst(void) {
+    /* Static to keep the record off the task's stack */
+    static uint8_t pucBurstRecord[BURST_RECORD_MAX_BYTES];
+    uint32_t ulLength;
+
+    if (xModemStatus.tcpConnectionMode == DATA_MODE &&
+            eRingBufferStatus(&xTxBuffer) == BUFFER_EMPTY) {
+        ulLength = ulBurstGetRecord(pucBurstRecord);
+        if (ulLength) {
+            ModemTCPWrite(pucBurstRecord, ulLength);
+            vBudgetCountRecord(UPLINK_STREAM_NONE, ulLength);
+        }
+    }
+}
+
+/*
+ * Sends the records waiting in the urgent queue (see urgent.h) ahead of
+ * everything else, each in a packet of its own. As with replies, a block
+ * still being compressed is sent first. Urgent records are kept in the
+ * upload window like any other.
+ */
+static void ModemTCPSendUrgent(void) {
+    uint8_t pucRecord[URGENT_MAX_RECORD_BYTES];
+    TickType_t xPostedTick;
+    uint32_t ulLength;
+    uint16_t usSeq;
+
+    if (xModemStatus.tcpConnectionMode != DATA_MODE) {
+        return;
+    }
+
+    while ((ulLength = ulUrgentGetRecord(pucRecord, &xPostedTick)) != 0) {
+        ModemTCPFlush();
+        usSeq = usStreamSeq;
+        ModemTCPSendPacket(pucRecord, ulLength);
+        ModemTCPRetain(pucRecord, ulLength, usSeq, usSeq);
+        vUrgentNoteSent(xPostedTick);
+        vBudgetCountRecord(UPLINK_STREAM_NONE, ulLength);
+    }
+}
+
+/*
+ * Sends a reply record (see sample.h) at once in a packet of its own, ahead
+ * of anything queued. A block still being compressed is sent first, so the
+ * records in it keep the sequence number they were retained under.
+ */
+static void ModemTCPSendReply(uint8_t ucCommand, uint32_t ulToken) {
+    uint8_t pucReply[SAMPLE_REPLY_BYTES];
+    uint16_t usRateField = SAMPLE_REPLY_RATE;
+    uint16_t usSize = SAMPLE_REPLY_BYTES;
+    uint16_t usWaitMS = ulCommandWaitMS > 0xFFFF ? 0xFFFF : ulCommandWaitMS;
+    uint32_t ulS;
+    uint32_t ulSS;
+
+    if (xModemStatus.tcpConnectionMode != DATA_MODE) {
+        return;
+    }
+
+    vTimestampToRTC(ullTimestampNow(), &ulS, &ulSS);
+    memcpy(pucReply, &usRateField, 2);
+    memcpy(pucReply + 2, &usSize, 2);
+    memcpy(pucReply + 4, &ulS, 4);
+    memcpy(pucReply + 8, &ulSS, 2);
+    pucReply[10] = ucCommand;
+    memcpy(pucReply + 11, &ulToken, 4);
+    memcpy(pucReply + 15, &usWaitMS, 2);
+
+    ModemTCPFlush();
+    ModemTCPSendPacket(pucReply, SAMPLE_REPLY_BYTES);
+    vBudgetCountRecord(UPLINK_STREAM_NONE, SAMPLE_REPLY_BYTES);
+}
+
 /*
  * Sends the '+++' sequence to return the modem to command mode when a TCP
  * connection is active. If 'test' is true, this function will not indicate
@@ -979,9 +1446,28 @@ static bool ModemTCPDisconnect(void) {
     return false;
 }
 
+/*
+ * Counts the time and UART6 bytes since the last call towards the current
+ * archive mode. Called before the mode is changed and when stats are printed.
+ */
+static void ModemCountViewerTime(void) {
+    TickType_t xNow = xTaskGetTickCount();
+    uint32_t ulMode = bProfileArchiveActive() ? 1 : 0;
+
+    /* Ticks are milliseconds (see FreeRTOSConfig.h). */
+    pulViewerMS[ulMode] += xNow - xViewerMarkTick;
+    pulViewerBytes[ulMode] += ulUART6TxBytes - ulViewerMarkBytes;
+    xViewerMarkTick = xNow;
+    ulViewerMarkBytes = ulUART6TxBytes;
+}
+
 /*
  * Parse a command sent from the server. This may be a remote start command,
- * a client count update, or a heartbeat.
+ * a client count update (which also switches archive mode), a CAN event mode
+ * change, an uplink compression change, a flash log drain order, an
+ * acknowledgement, an uplink stream setting, a flush policy, a data budget,
+ * a history query, a live transport change, a time reference, or a heartbeat
+ * (which is answered with a reply record if it carries a token).
  *
  * Returns false if the command cannot be parsed.
  */
@@ -994,6 +1480,29 @@ static bool ModemParseCommand(uint8_t *pucBuffer) {
     /* pdPASS/FAIL depending on whether the task that is notified has an
      * already pending notification */
     BaseType_t xNotifySuccessVal;
+    /* Parsed fields of a time reference */
+    uint32_t ulRefS;
+    uint32_t ulRefMS;
+    char *pcEnd;
+    /* Parsed fields of an uplink stream setting */
+    uint32_t ulStreamRate;
+    uint32_t ulStreamPriority;
+    uint32_t ulStreamDeadlineMS;
+    /* Parsed fields of a flush policy */
+    uint32_t ulFlushWatermark;
+    uint32_t ulFlushLatencyMS;
+    /* Parsed fields of a history query */
+    uint32_t ulQueryStartS;
+    uint32_t ulQueryEndS;
+    /* Parsed fields of an acknowledgement */
+    uint16_t usCumulative;
+    uint16_t pusSelective[WINDOW_MAX_SELECTIVE];
+    uint32_t ulSelectiveCount = 0;
+    char *pcStart;
+    /* Whether every field parsed so far has digits and fits its type */
+    bool bFieldsValid;
+    /* Parsed token of a heartbeat, or a sequence of an acknowledgement */
+    uint32_t ulToken;
 
     /* The first 3 characters are just for checking that this isn't garbage
      * data. The fourth is the command character. */
@@ -1045,12 +1554,183 @@ static bool ModemParseCommand(uint8_t *pucBuffer) {
                                                         &ulPreviousValue);
             }
 
+            /* Nobody is watching, so only archive-grade data is sent until
+             * someone is. The switch back is made on the next whole second,
+             * and the schema record it produces is flushed immediately. */
+            ModemCountViewerTime();
+            vProfileSetArchive(pucBuffer[4] < 1);
+
             /* Store the count to allow comparing when it changes. */
             ulLastClientCount = pucBuffer[4];
 
             break;
-        /* heartbeat */
+        /* CAN event mode: on if the byte is nonzero */
+        case 'e' :
+            debug_print("CAN event mode = %d\n", pucBuffer[4]);
+            vProfileSetCANEvents(pucBuffer[4] != 0);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* time reference: "YYYt<unix seconds>,<milliseconds>" */
+        case 't' :
+            ulRefS = strtoul((char *)&pucBuffer[4], &pcEnd, 10);
+
+            /* Both fields must have digits, and the milliseconds must be
+             * under a second. */
+            if (pcEnd == (char *)&pucBuffer[4] || *pcEnd != ',' ||
+                pcEnd[1] < '0' || pcEnd[1] > '9') {
+                debug_print("Error: malformed time reference\n");
+                return false;
+            }
+
+            ulRefMS = strtoul(pcEnd + 1, NULL, 10);
+            if (ulRefMS >= 1000) {
+                debug_print("Error: malformed time reference\n");
+                return false;
+            }
+
+            vClockSyncUpdate(ulRefS, ulRefMS * 32768 / 1000, false);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* uplink compression: on if the byte is nonzero. Data already
+         * waiting is sent under the old setting first. */
+        case 'l' :
+            debug_print("uplink compression = %d\n", pucBuffer[4]);
+            ModemTCPFlush();
+            bUplinkCompress = (pucBuffer[4] != 0);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* acknowledgement: "YYYk<cumulative>[,<sequence>...]" (window.h) */
+        case 'k' :
+            ulToken = strtoul((char *)&pucBuffer[4], &pcEnd, 10);
+            bFieldsValid = (pcEnd != (char *)&pucBuffer[4] &&
+                            ulToken <= 0xFFFF);
+            usCumulative = ulToken;
+
+            while (bFieldsValid && *pcEnd == ',' &&
+                   ulSelectiveCount < WINDOW_MAX_SELECTIVE) {
+                pcStart = pcEnd + 1;
+                ulToken = strtoul(pcStart, &pcEnd, 10);
+                bFieldsValid = (pcEnd != pcStart && ulToken <= 0xFFFF);
+                pusSelective[ulSelectiveCount++] = ulToken;
+            }
+
+            /* The line must end after the last sequence, and a list longer
+             * than WINDOW_MAX_SELECTIVE can't be taken in part. */
+            if (!bFieldsValid || (*pcEnd != '\r' && *pcEnd != '\0')) {
+                debug_print("Error: malformed acknowledgement\n");
+                return false;
+            }
+
+            bUplinkAcked = true;
+            vWindowAck(usCumulative, pusSelective, ulSelectiveCount);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* uplink stream: "YYYp<rate Hz>,<priority>,<deadline ms>" */
+        case 'p' :
+            pcStart = (char *)&pucBuffer[4];
+            ulStreamRate = strtoul(pcStart, &pcEnd, 10);
+            bFieldsValid = (pcEnd != pcStart && ulStreamRate <= 0xFFFF &&
+                            *pcEnd == ',');
+
+            if (bFieldsValid) {
+                pcStart = pcEnd + 1;
+                ulStreamPriority = strtoul(pcStart, &pcEnd, 10);
+                bFieldsValid = (pcEnd != pcStart && ulStreamPriority <= 0xFF &&
+                                *pcEnd == ',');
+            }
+
+            if (bFieldsValid) {
+                pcStart = pcEnd + 1;
+                ulStreamDeadlineMS = strtoul(pcStart, &pcEnd, 10);
+                bFieldsValid = (pcEnd != pcStart &&
+                                ulStreamDeadlineMS <= 0xFFFF &&
+                                (*pcEnd == '\r' || *pcEnd == '\0'));
+            }
+
+            /* A field out of range would otherwise be truncated into a
+             * different setting, such as another stream's rate. */
+            if (!bFieldsValid ||
+                !bUplinkSetStream(ulStreamRate, ulStreamPriority,
+                                  ulStreamDeadlineMS)) {
+                debug_print("Error: malformed uplink stream setting\n");
+                return false;
+            }
+
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* flush policy: "YYYf<watermark bytes>,<latency ms>" */
+        case 'f' :
+            pcStart = (char *)&pucBuffer[4];
+            ulFlushWatermark = strtoul(pcStart, &pcEnd, 10);
+            bFieldsValid = (pcEnd != pcStart && ulFlushWatermark <= 0xFFFF &&
+                            *pcEnd == ',');
+
+            if (bFieldsValid) {
+                pcStart = pcEnd + 1;
+                ulFlushLatencyMS = strtoul(pcStart, &pcEnd, 10);
+                bFieldsValid = (pcEnd != pcStart &&
+                                ulFlushLatencyMS <= 0xFFFF &&
+                                (*pcEnd == '\r' || *pcEnd == '\0'));
+            }
+
+            /* An empty field would otherwise read as 0 (flush every round)
+             * and a large latency would wrap to a small one. */
+            if (!bFieldsValid) {
+                debug_print("Error: malformed flush policy\n");
+                return false;
+            }
+
+            vStoreTaskSetFlush(ulFlushWatermark, ulFlushLatencyMS);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* data budget: "YYYm<KB per day>" */
+        case 'm' :
+            debug_print("daily data budget = %d KB\n",
+                        strtoul((char *)&pucBuffer[4], NULL, 10));
+            vBudgetSetDaily(strtoul((char *)&pucBuffer[4], NULL, 10));
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* history query: "YYYh<start s>,<end s>,<rate Hz>" */
+        case 'h' :
+            ulQueryStartS = strtoul((char *)&pucBuffer[4], &pcEnd, 10);
+
+            if (*pcEnd != ',') {
+                debug_print("Error: malformed history query\n");
+                return false;
+            }
+
+            ulQueryEndS = strtoul(pcEnd + 1, &pcEnd, 10);
+
+            if (*pcEnd != ',') {
+                debug_print("Error: malformed history query\n");
+                return false;
+            }
+
+            debug_print("history query %d to %d\n", ulQueryStartS,
+                        ulQueryEndS);
+            vStoreTaskQuery(ulQueryStartS, ulQueryEndS,
+                            strtoul(pcEnd + 1, NULL, 10));
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* flash log drain order: newest first if the byte is nonzero */
+        case 'o' :
+            debug_print("drain newest first = %d\n", pucBuffer[4]);
+            vStoreSetDrainOrder(pucBuffer[4] ? STORE_DRAIN_NEWEST :
+                                               STORE_DRAIN_OLDEST);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* live transport: "YYYu<0|1>", where 1 is UDP (modem_uart_task.h) */
+        case 'u' :
+            bLinkUDPRequested = (pucBuffer[4] != 0);
+            xNotifySuccessVal = pdPASS;
+            break;
+        /* heartbeat: "YYYz[<token>]", answered with a reply record if a
+         * token is given, so the server can time the round trip */
         case 'z' :
+            ulToken = strtoul((char *)&pucBuffer[4], &pcEnd, 10);
+            if (pcEnd != (char *)&pucBuffer[4]) {
+                ModemTCPSendReply('z', ulToken);
+            }
             xNotifySuccessVal = xTaskNotifyAndQuery(xModemMgmtTaskHandle,
                                                     MGMT_NOTIFY_HEARTBEAT,
                                                     eSetValueWithoutOverwrite,
@@ -1124,6 +1804,34 @@ static bool ModemReadUnsolicited(void) {
     return false;
 }
 
+/*
+ * Reads the server lines that have completed in the RX buffer, timing how
+ * long the oldest of them waited. Partial lines are left until they
+ * complete, so this never waits on the modem.
+ */
+static void ModemServiceLines(void) {
+
+    if (!ModemLinePending()) {
+        return;
+    }
+
+    /* Ticks are milliseconds (see FreeRTOSConfig.h). */
+    ulCommandWaitMS = xTaskGetTickCount() - xRxLineTick;
+    ulCommandWaits++;
+    ullCommandWaitSumMS += ulCommandWaitMS;
+    if (ulCommandWaitMS > ulCommandWaitMaxMS) {
+        ulCommandWaitMaxMS = ulCommandWaitMS;
+    }
+
+    /* A closed connection ends the read, as the RX buffer is cleared before
+     * the next one. */
+    while (ModemLinePending() && xModemStatus.tcpConnectionOpen) {
+        ulRxLinesRead++;
+        ulCommandLines++;
+        ModemReadUnsolicited();
+    }
+}
+
 
 /*
  * The Modem UART task serves as a gatekeeper task for UART6, which
@@ -1144,11 +1852,8 @@ static void ModemUARTTask(void *pvParameters) {
     /* Mode to operate the network connection in (either data or transparent
      * mode, see SIM5320 datasheet) */
     bool bMode = DATA_MODE;
-    /* Iteration variable for sample buffer array */
-    uint32_t i;
-    /* Flag indicating if this is the first loop run or if there's already been
-     * a reset recovery. The RTC is only updated on the first run. */
-    bool bFirstRun = true;
+    /* Whether the schema still has to be sent on this connection */
+    bool bSchemaNeeded;
 
     /* This will fail if the modem is already on, which is fine. */
     ModemPowerOn();
@@ -1169,11 +1874,10 @@ static void ModemUARTTask(void *pvParameters) {
 
             ModemEchoOff();
 
-            if (bFirstRun) {
-                if (ModemUpdateRTCTime()) {
-                    bFirstRun = false;
-                }
-            }
+            /* The network time only sets the RTC if it has never been set.
+             * Once it has, the server's time keeps it disciplined and the
+             * network time is only reported. */
+            ModemUpdateRTCTime();
 
             ModemCheckBattery();
 
@@ -1238,6 +1942,9 @@ static void ModemUARTTask(void *pvParameters) {
             }
         }
 
+        /* A new connection needs the schema before any frames. */
+        bSchemaNeeded = true;
+
         /* Only proceed if the TCP connection is established. */
         while ( xModemStatus.knownState && xModemStatus.networkOpen &&
                 xModemStatus.tcpConnectionOpen ) {
@@ -1252,25 +1959,72 @@ static void ModemUARTTask(void *pvParameters) {
                             MODEM_NOTIFY_SAMPLE | MODEM_NOTIFY_UNSOLICITED,
                             &ulNotificationValue, portMAX_DELAY);
 
+            /* Server lines are read first, as commands and
+             * acknowledgements shouldn't wait behind the samples, and
+             * urgent records are sent next. Either arriving during a send
+             * stops it between records; they are dealt with here and the
+             * send carries on. */
+            ModemServiceLines();
+
+            /* A change of transport takes a new connection, which the
+             * outer loop opens. */
+            if (bLinkUDPRequested != xModemStatus.linkUDP) {
+                debug_print("reconnecting over %s\n",
+                            bLinkUDPRequested ? "udp" : "tcp");
+                ModemTCPFlush();
+                UART6RcvBufferClear();
+                if (ModemSwitchToCommandMode(false)) {
+                    ModemTCPDisconnect();
+                }
+                continue;
+            }
+
+            /* A new connection needs the schema before any urgent record
+             * that refers to its channels. */
+            if (!bSchemaNeeded) {
+                ModemTCPSendUrgent();
+            }
+
             if (ulNotificationValue & MODEM_NOTIFY_SAMPLE) {
 
-                /* Send data from all sample buffers. Because writes to sample
-                 * buffers occur in a critical section, buffers are guaranteed
-                 * to contain only complete sample chunks at all times. This,
-                 * combined with the order guarantee TCP provides, ensures that
-                 * sample chunks arrive at the server intact. Some buffers may
-                 * be empty, but ModemTCPSend() checks for buffer emptiness. */
-                for (i = 0; i < ucSampleGetBufferCount(); i++) {
-                    ModemTCPSend(pxSampleRateBuffers[i]);
+                ulSendWakeups++;
+
+                /* Burst records go out only when the link is idle. */
+                ModemTCPSendBurst();
+
+                /* Records the server never acknowledged on the last
+                 * connection follow the schema, ahead of anything new. */
+                if (bSchemaNeeded &&
+                    xModemStatus.tcpConnectionMode == DATA_MODE) {
+                    ModemTCPSendSchema();
+                    ModemTCPResend(true);
+                    bSchemaNeeded = false;
+                }
+                else if (xModemStatus.linkUDP &&
+                         xTaskGetTickCount() - xSchemaSentTick >=
+                         pdMS_TO_TICKS(MODEM_UDP_SCHEMA_INTERVAL_MS)) {
+                    ModemTCPSendSchema();
                 }
-            }
 
-            if (ulNotificationValue & MODEM_NOTIFY_UNSOLICITED) {
-                /* Read the unsolicited data, which could be a command or
-                 * indication that the connection was lost.
-                 * ModemReadUnsolicited() returns false if it could not
-                 * interpret the data, but we don't act on that currently. */
-                ModemReadUnsolicited();
+                do {
+                    ModemServiceLines();
+                    ModemTCPSendUrgent();
+
+                    /* Records the server has missed go again before new
+                     * ones. */
+                    ModemTCPResend(false);
+
+                    /* Send the frames, events and schema records queued by
+                     * the Store task. The queue only ever holds whole
+                     * records, and TCP keeps them in order, so they arrive
+                     * intact. */
+                    ModemTCPSendQueued();
+                } while (ModemSendPreempted() &&
+                         xModemStatus.tcpConnectionOpen &&
+                         xModemStatus.tcpConnectionMode == DATA_MODE);
+
+                /* Send anything still waiting to be compressed. */
+                ModemTCPFlush();
             }
 
         } /* while (knownState && networkOpen && tcpConnectionOpen) */
@@ -1317,7 +2071,7 @@ UART6Configure(void) {
     }
 
     /* Configure the UART communication parameters. (8-n-1) */
-    UARTConfigSetExpClk(UART6_BASE, SysCtlClockGet(), 115200,
+    UARTConfigSetExpClk(UART6_BASE, SysCtlClockGet(), UART6_BAUD,
                         UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
                         UART_CONFIG_PAR_NONE);
 
@@ -1328,6 +2082,71 @@ UART6Configure(void) {
     UARTEnable(UART6_BASE);
 }
 
+/*
+ * Prints how often the task has been woken to send queued records, and how
+ * busy UART6 has been, since the last call, the CPU cycles per byte of
+ * stream packets sent so far, how long server lines have waited to be read,
+ * the bytes archive mode has saved, and what became of UDP records the
+ * server didn't acknowledge. Savings are estimated from the byte
+ * rate while clients were watching, and scaled to a day with the same share
+ * of unwatched time.
+ */
+void vModemUARTPrintStats(void) {
+    TickType_t xNow = xTaskGetTickCount();
+    /* Ticks are milliseconds (see FreeRTOSConfig.h). */
+    uint32_t ulElapsedMS = xNow - xLastStatsTick;
+    uint32_t ulWakeups = ulSendWakeups - ulLastSendWakeups;
+    uint32_t ulTxBytes = ulUART6TxBytes - ulLastUART6TxBytes;
+    /* Wakeups per 10 seconds, for one decimal place per second */
+    uint32_t ulWakeupsPer10S;
+    /* Bytes archive mode has kept off the link */
+    uint64_t ullSavedBytes;
+
+    if (ulElapsedMS) {
+        ulWakeupsPer10S = (uint64_t)ulWakeups * 10000 / ulElapsedMS;
+        debug_print("uart6: %d.%d wakeups/s, %d bytes, %d%% busy\n",
+                    ulWakeupsPer10S / 10, ulWakeupsPer10S % 10, ulTxBytes,
+                    (uint32_t)((uint64_t)ulTxBytes * 100000 /
+                               ((uint64_t)UART6_BYTES_PER_S * ulElapsedMS)));
+    }
+
+    if (ulPacketBytes) {
+        debug_print("stream packets: %d cycles/byte\n",
+                    (uint32_t)(ullPacketCycles / ulPacketBytes));
+    }
+
+    ModemCountViewerTime();
+    if (pulViewerMS[0] && pulViewerMS[1]) {
+        ullSavedBytes = (uint64_t)pulViewerBytes[0] * pulViewerMS[1] /
+                        pulViewerMS[0];
+        ullSavedBytes = ullSavedBytes > pulViewerBytes[1] ?
+                        ullSavedBytes - pulViewerBytes[1] : 0;
+        debug_print("archive mode: %d of %d s, %d bytes saved, ~%d KB/day\n",
+                    pulViewerMS[1] / 1000,
+                    (pulViewerMS[0] + pulViewerMS[1]) / 1000,
+                    (uint32_t)ullSavedBytes,
+                    (uint32_t)(ullSavedBytes * 86400 /
+                               (((uint64_t)pulViewerMS[0] + pulViewerMS[1]) /
+                                1000 + 1) / 1024));
+    }
+
+    if (ulCommandWaits) {
+        debug_print("server lines: %d, waited %d avg %d max ms\n",
+                    ulCommandLines,
+                    (uint32_t)(ullCommandWaitSumMS / ulCommandWaits),
+                    ulCommandWaitMaxMS);
+    }
+
+    if (ulUDPMissedRecords || ulUDPUnackedRecords) {
+        debug_print("udp: %d missed records logged, %d unacknowledged "
+                    "dropped\n", ulUDPMissedRecords, ulUDPUnackedRecords);
+    }
+
+    xLastStatsTick = xNow;
+    ulLastSendWakeups = ulSendWakeups;
+    ulLastUART6TxBytes = ulUART6TxBytes;
+}
+
 /*
  * Initializes the Modem UART task by configuring the hardware and creating the
  * task from its function.
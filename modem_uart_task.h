@@ -34,6 +34,36 @@
 #define MODEM_NOTIFY_UNSOLICITED        0x00000004
 #define MODEM_NOTIFY_ALL                0xffffffff
 
+/* Every record sent on the TCP stream (or compressed block of records) is
+ * wrapped in a packet:
+ *
+ *   sync (2 bytes)        STREAM_SYNC_0, STREAM_SYNC_1
+ *   sequence (2 bytes)    one more than the previous packet's, wrapping
+ *   record                the record, whose size field gives its length
+ *   CRC (2 bytes)         CRC-16 (see crc.h) of the sequence and record
+ *
+ * A receiver that loses its place scans for the sync bytes and accepts the
+ * first packet whose CRC checks, so it resynchronizes within a record. The
+ * sequence counts from startup, and a jump in it is the exact number of
+ * packets lost. The host-side parser is in host/stream_decode.c. */
+#define STREAM_SYNC_0                   0x55
+#define STREAM_SYNC_1                   0xEC
+#define STREAM_HEADER_BYTES             4
+#define STREAM_CRC_BYTES                2
+
+/* The server can ask for the live data to be sent over UDP instead, with
+ * "YYYu<0|1>", which takes effect on a new connection. Over UDP, a lost
+ * packet doesn't hold up the ones after it, and nothing is sent again. Each
+ * record goes in a packet of its own, uncompressed, so every packet that
+ * arrives decodes by itself, and the schema is sent again every
+ * MODEM_UDP_SCHEMA_INTERVAL_MS for receivers that missed it. Records are
+ * kept in the upload window (see window.h) as over TCP. Those the server
+ * reports missing are logged to flash, and draining and history queries
+ * wait for TCP, which then fills them in. Records pushed out of a full
+ * window unacknowledged are dropped, and so is everything lost if the
+ * server doesn't acknowledge at all. */
+#define MODEM_UDP_SCHEMA_INTERVAL_MS    5000
+
 /*
  * Modem status flags.
  */
@@ -58,11 +88,14 @@ typedef struct ModemStatus_t {
     /* Whether the TCP connection to the server is in data mode. Otherwise,
      * command mode (value 0/false). */
     bool tcpConnectionMode : 1;
+    /* Whether the connection to the server is UDP rather than TCP. */
+    bool linkUDP : 1;
 } ModemStatus_t;
 
 extern TaskHandle_t xModemUARTTaskHandle;
 extern volatile ModemStatus_t xModemStatus;
 
+void vModemUARTPrintStats(void);
 uint32_t ModemUARTTaskInit(void);
 
 #endif /* MODEM_UART_TASK_H_ */
@@ -37,16 +37,26 @@
 #define PRIORITY_JSN_TASK               2
 #define PRIORITY_SRF_TASK               2
 #define PRIORITY_REMOTE_START_TASK      3
+#define PRIORITY_STORE_TASK             2
 
 /* Priorities for interrupts whose ISRs contain FreeRTOS API calls. These must
  * be >= configMAX_SYSCALL_INTERRUPT_PRIORITY. These interrupts will be
  * maskable by the kernel. 0 is the highest priority (0-7). Other interrupt
  * priorities (with ISRs not containing API calls) are left at their
- * defaults. */
+ * defaults.
+ *
+ * Sampling has the highest kernel-aware priority so that sample instants are
+ * only delayed by kernel critical sections, the (rare) ignition timer and
+ * the short ISRs above the kernel, never by UART or CAN bursts. Its latency
+ * is measured by the ISR itself (chSampleJitter). The ADC ISRs store channel
+ * values, which must not preempt the sampling snapshot, so they share CAN's
+ * level. The UARTs have hardware FIFOs and can wait the longest. */
 #define PRIORITY_MODEM_UART_INT         7
 #define PRIORITY_SRF_UART_INT           7
-#define PRIORITY_DATA_SAMPLING_INT      7
+#define PRIORITY_SINK_UART_INT          7
+#define PRIORITY_DATA_SAMPLING_INT      5
 #define PRIORITY_CAN0_INT               6
+#define PRIORITY_ADC_INT                6
 #define PRIORITY_IGNITION_TIMER_INT     5
 
 
@@ -0,0 +1,356 @@
+/*
+ * profile.c
+ * Sampling profiles. Each profile remaps channel sample rates and deadbands
+ * to suit a vehicle state (driving, idling, parked or remote started). The
+ * profile is chosen automatically from CAN activity, RPM and speed, and is
+ * switched by the sampling ISR on a whole-second boundary so that no sample
+ * is ever written with a mix of two layouts.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "budget.h"
+#include "channel.h"
+#include "debug_helper.h"
+#include "profile.h"
+#include "remote_start_task.h"
+#include "sample.h"
+
+
+#define ARRAY_LENGTH(x)                 (sizeof(x) / sizeof(x[0]))
+/* The speed channel is raw CAN data in 0.01km/h with an offset of 10000, so
+ * this is 5km/h. */
+#define PROFILE_DRIVING_SPEED           10500
+/* Number of consecutive updates (seconds) a new vehicle state must persist
+ * before its profile is switched to. This keeps brief stops or RPM dips from
+ * flapping between layouts. */
+#define PROFILE_SETTLE_COUNT            3
+/* At BUDGET_LEVEL_COARSE, archive deadbands are shifted left by this much */
+#define PROFILE_COARSE_SHIFT            2
+
+
+/* While idling the vehicle isn't moving, so speeds drop to 1Hz. */
+static const ProfileChannel_t pxIdlingChannels[] = {
+    { &chSpeed, RATE_1HZ, 0 },
+    { &chThrottlePositionROC, RATE_1HZ, 0 },
+    { &chWheelSpeedFL, RATE_1HZ, 0 },
+    { &chWheelSpeedFR, RATE_1HZ, 0 },
+    { &chWheelSpeedRL, RATE_1HZ, 0 },
+    { &chWheelSpeedRR, RATE_1HZ, 0 }
+};
+
+/* While parked the CAN bus is silent, so CAN channels would only repeat stale
+ * values and are not sampled. Everything else drops to 1Hz with a deadband,
+ * so a sample is only sent when something actually changes. ADC channels use
+ * deadbands of a few codes (about 3.7mV per code) to ride out noise. */
+static const ProfileChannel_t pxParkedChannels[] = {
+    { &chAVTEMP1Raw, RATE_1HZ, 64 },
+    { &chAVTEMP2Raw, RATE_1HZ, 64 },
+    { &chAVTEMP3Raw, RATE_1HZ, 64 },
+    { &chAVTEMP4Raw, RATE_1HZ, 64 },
+    { &chAVGP2Raw, RATE_1HZ, 16 },
+    { &chCabinTemp, RATE_1HZ, 500 },
+    { &chClockDrift, RATE_1HZ, 1 },
+    { &chClockOffset, RATE_1HZ, 1 },
+    { &chCoolantTemp, RATE_NONE, 0 },
+    { &chDataLevel, RATE_1HZ, 1 },
+    { &chDataUsage, RATE_1HZ, 16 },
+    { &chDeviceBatt, RATE_1HZ, 50 },
+    { &chDeviceCurrent, RATE_1HZ, 16 },
+    { &chFuelLevelInst, RATE_NONE, 0 },
+    { &chFuelLevelMean, RATE_NONE, 0 },
+    { &chGearPosition, RATE_NONE, 0 },
+    { &chNotifications, RATE_1HZ, 1 },
+    { &chRPM, RATE_NONE, 0 },
+    { &chSampleGaps, RATE_1HZ, 1 },
+    { &chSampleJitter, RATE_1HZ, 50 },
+    { &chSpeed, RATE_NONE, 0 },
+    { &chTempKnob, RATE_1HZ, 500 },
+    { &chTempKnobRaw, RATE_1HZ, 16 },
+    { &chTestDist0, RATE_1HZ, 2 },
+    { &chTestDist1, RATE_1HZ, 2 },
+    { &chThrottlePosition, RATE_NONE, 0 },
+    { &chThrottlePositionROC, RATE_NONE, 0 },
+    { &chVehicleBatt, RATE_1HZ, 27 },
+    { &chWheelSpeedFL, RATE_NONE, 0 },
+    { &chWheelSpeedFR, RATE_NONE, 0 },
+    { &chWheelSpeedRL, RATE_NONE, 0 },
+    { &chWheelSpeedRR, RATE_NONE, 0 }
+};
+
+/* A remote start has nobody driving, but the engine and cabin temperatures
+ * are what a remote user is watching. Motion channels drop to 1Hz. */
+static const ProfileChannel_t pxRemoteStartChannels[] = {
+    { &chSpeed, RATE_1HZ, 0 },
+    { &chThrottlePosition, RATE_1HZ, 0 },
+    { &chThrottlePositionROC, RATE_1HZ, 0 },
+    { &chWheelSpeedFL, RATE_1HZ, 0 },
+    { &chWheelSpeedFR, RATE_1HZ, 0 },
+    { &chWheelSpeedRL, RATE_1HZ, 0 },
+    { &chWheelSpeedRR, RATE_1HZ, 0 }
+};
+
+/* With no clients watching, data is only kept for the archive, so every
+ * channel is capped at 1Hz and given at least these deadbands on top of the
+ * active profile. Channels the profile doesn't sample stay off. Speeds are in
+ * 0.01km/h and RPM is unscaled. The data budget (see budget.h) applies the
+ * same limits in steps: the deadbands alone, then the rates too, then the
+ * deadbands made coarser. */
+static const ProfileChannel_t pxArchiveChannels[] = {
+    { &chAVTEMP1Raw, RATE_1HZ, 64 },
+    { &chAVTEMP2Raw, RATE_1HZ, 64 },
+    { &chAVTEMP3Raw, RATE_1HZ, 64 },
+    { &chAVTEMP4Raw, RATE_1HZ, 64 },
+    { &chAVGP2Raw, RATE_1HZ, 16 },
+    { &chCabinTemp, RATE_1HZ, 500 },
+    { &chClockDrift, RATE_1HZ, 1 },
+    { &chClockOffset, RATE_1HZ, 1 },
+    { &chCoolantTemp, RATE_1HZ, 1 },
+    { &chDataLevel, RATE_1HZ, 1 },
+    { &chDataUsage, RATE_1HZ, 16 },
+    { &chDeviceBatt, RATE_1HZ, 50 },
+    { &chDeviceCurrent, RATE_1HZ, 16 },
+    { &chFuelLevelInst, RATE_1HZ, 2 },
+    { &chFuelLevelMean, RATE_1HZ, 1 },
+    { &chGearPosition, RATE_1HZ, 1 },
+    { &chNotifications, RATE_1HZ, 1 },
+    { &chRPM, RATE_1HZ, 50 },
+    { &chSampleGaps, RATE_1HZ, 1 },
+    { &chSampleJitter, RATE_1HZ, 50 },
+    { &chSpeed, RATE_1HZ, 100 },
+    { &chTempKnob, RATE_1HZ, 500 },
+    { &chTempKnobRaw, RATE_1HZ, 16 },
+    { &chTestDist0, RATE_1HZ, 2 },
+    { &chTestDist1, RATE_1HZ, 2 },
+    { &chThrottlePosition, RATE_1HZ, 2 },
+    { &chThrottlePositionROC, RATE_1HZ, 2 },
+    { &chVehicleBatt, RATE_1HZ, 27 },
+    { &chWheelSpeedFL, RATE_1HZ, 100 },
+    { &chWheelSpeedFR, RATE_1HZ, 100 },
+    { &chWheelSpeedRL, RATE_1HZ, 100 },
+    { &chWheelSpeedRR, RATE_1HZ, 100 }
+};
+
+/* Profiles indexed by ProfileID_t. Driving uses the default rates, so it has
+ * no changes. */
+static const Profile_t xProfiles[] = {
+    { NULL, 0 },
+    { pxIdlingChannels, ARRAY_LENGTH(pxIdlingChannels) },
+    { pxParkedChannels, ARRAY_LENGTH(pxParkedChannels) },
+    { pxRemoteStartChannels, ARRAY_LENGTH(pxRemoteStartChannels) }
+};
+
+/* The profile whose layout is currently used by the sampling ISR. Channels
+ * start at their defaults, which is the driving profile. */
+static volatile ProfileID_t eActiveProfile = PROFILE_DRIVING;
+/* The profile the ISR should switch to at the next whole second */
+static volatile ProfileID_t eRequestedProfile = PROFILE_DRIVING;
+/* CAN event mode (see vChannelStoreCANEvent()) changes the layout too, so it
+ * is switched the same way as profiles */
+static bool bActiveCANEvents = false;
+static volatile bool bRequestedCANEvents = false;
+/* Archive mode and the data budget's throttle level (see
+ * pxArchiveChannels) are switched the same way */
+static volatile bool bActiveArchive = false;
+static volatile bool bRequestedArchive = false;
+static volatile uint8_t ucActiveBudgetLevel = BUDGET_LEVEL_NONE;
+static volatile uint8_t ucRequestedBudgetLevel = BUDGET_LEVEL_NONE;
+
+
+/*
+ * Returns the throttle level the archive limits are applied at: archive mode
+ * is the same as the budget's rate level, and the higher of the two wins.
+ */
+static uint8_t ProfileLimit(bool bArchive, uint8_t ucBudgetLevel) {
+    uint8_t ucLimit = bArchive ? BUDGET_LEVEL_RATES : BUDGET_LEVEL_NONE;
+
+    return (ucBudgetLevel > ucLimit) ? ucBudgetLevel : ucLimit;
+}
+
+/*
+ * Decides which profile fits the current vehicle state.
+ */
+static ProfileID_t ProfileClassify(void) {
+
+    /* No CAN traffic means the vehicle is off. */
+    if (!xIgnitionStatus.running) {
+        return PROFILE_PARKED;
+    }
+
+    /* The ignition was turned on by this device rather than a key. */
+    if (bRemoteStartActive()) {
+        return PROFILE_REMOTE_START;
+    }
+
+    if (usChannelValueGet(&chSpeed) > PROFILE_DRIVING_SPEED) {
+        return PROFILE_DRIVING;
+    }
+
+    /* Key on, stationary, with or without the engine running */
+    return PROFILE_IDLING;
+}
+
+/*
+ * Evaluates the vehicle state and requests a profile change once a new state
+ * has persisted for PROFILE_SETTLE_COUNT calls. Called once per second by the
+ * Data task; the switch itself is made by the sampling ISR.
+ */
+void vProfileUpdate(void) {
+    static ProfileID_t eCandidate = PROFILE_DRIVING;
+    static uint32_t ulCandidateCount = 0;
+    ProfileID_t eCurrent = ProfileClassify();
+
+    if (eCurrent != eCandidate) {
+        eCandidate = eCurrent;
+        ulCandidateCount = 0;
+    }
+
+    if (ulCandidateCount < PROFILE_SETTLE_COUNT) {
+        ulCandidateCount++;
+    }
+
+    if (ulCandidateCount == PROFILE_SETTLE_COUNT &&
+            eRequestedProfile != eCandidate) {
+        debug_print("requesting profile %d\n", eCandidate);
+        eRequestedProfile = eCandidate;
+    }
+}
+
+/*
+ * Requests that CAN event mode be turned on or off. Like a profile change, the
+ * switch is made by the sampling ISR on the next whole second.
+ */
+void vProfileSetCANEvents(bool bEnable) {
+    bRequestedCANEvents = bEnable;
+}
+
+/*
+ * Requests that archive mode be turned on or off, for when the server has no
+ * clients watching. The switch is made on the next whole second.
+ */
+void vProfileSetArchive(bool bEnable) {
+    bRequestedArchive = bEnable;
+}
+
+/*
+ * Requests the data budget's throttle level, up to BUDGET_LEVEL_COARSE. The
+ * switch is made on the next whole second.
+ */
+void vProfileSetBudgetLevel(uint8_t ucLevel) {
+    ucRequestedBudgetLevel = ucLevel;
+}
+
+/*
+ * Returns true if archive mode is in use by the sampling ISR.
+ */
+bool bProfileArchiveActive(void) {
+    return bActiveArchive;
+}
+
+/*
+ * Returns the throttle level (see budget.h) that archive mode and the budget
+ * call for, as last applied by the sampling ISR.
+ */
+uint8_t ucProfileGetLimit(void) {
+    return ProfileLimit(bActiveArchive, ucActiveBudgetLevel);
+}
+
+/*
+ * Switches to the requested profile (and CAN event mode, archive mode and
+ * budget level) if any differs from the active one: every channel is reset
+ * to its default rate, the profile's changes are applied, archive limits are
+ * applied over them as far as either archive mode or the budget calls for
+ * (except in LOCAL_SINK builds), and the sample layout is rebuilt. This must
+ * only be called by the sampling ISR, within its critical section, on a
+ * match where every sample buffer is due, so that all buffers change layout
+ * on the same sample. Returns true if the profile changed.
+ */
+bool bProfileApplyPending(void) {
+    ProfileID_t eRequested = eRequestedProfile;
+    bool bRequestedEvents = bRequestedCANEvents;
+    bool bArchive = bRequestedArchive;
+    uint8_t ucBudgetLevel = ucRequestedBudgetLevel;
+    const Profile_t *pxProfile;
+    const ProfileChannel_t *pxArchive;
+    uint8_t ucLimit;
+    uint32_t ulDeadband;
+    uint32_t i;
+
+    if (eRequested == eActiveProfile && bRequestedEvents == bActiveCANEvents &&
+            bArchive == bActiveArchive &&
+            ucBudgetLevel == ucActiveBudgetLevel) {
+        return false;
+    }
+
+    pxProfile = &xProfiles[eRequested];
+
+    vChannelRestoreDefaults();
+
+    for (i = 0; i < pxProfile->ulChannelCount; i++) {
+        pxProfile->pxChannels[i].pxCh->usSampleRateHz =
+            pxProfile->pxChannels[i].usSampleRateHz;
+        pxProfile->pxChannels[i].pxCh->ulDeadband =
+            pxProfile->pxChannels[i].ulDeadband;
+    }
+
+    ucLimit = ProfileLimit(bArchive, ucBudgetLevel);
+#ifdef LOCAL_SINK
+    /* The local sink takes the profile's full rates whatever the uplink can
+     * carry, so the limits are applied to the uplink's frames instead (see
+     * sink.h). */
+    ucLimit = BUDGET_LEVEL_NONE;
+#endif
+
+    for (i = 0; ucLimit && i < ARRAY_LENGTH(pxArchiveChannels); i++) {
+        pxArchive = &pxArchiveChannels[i];
+        if (ucLimit >= BUDGET_LEVEL_RATES &&
+            pxArchive->pxCh->usSampleRateHz > pxArchive->usSampleRateHz) {
+            pxArchive->pxCh->usSampleRateHz = pxArchive->usSampleRateHz;
+        }
+        ulDeadband = pxArchive->ulDeadband;
+        if (ucLimit >= BUDGET_LEVEL_COARSE) {
+            ulDeadband <<= PROFILE_COARSE_SHIFT;
+        }
+        if (pxArchive->pxCh->ulDeadband < ulDeadband) {
+            pxArchive->pxCh->ulDeadband = ulDeadband;
+        }
+    }
+
+    vChannelSetCANEventMode(bRequestedEvents);
+
+    vChannelLayout();
+    vInitSampleRateBuffers();
+
+    eActiveProfile = eRequested;
+    bActiveCANEvents = bRequestedEvents;
+    bActiveArchive = bArchive;
+    ucActiveBudgetLevel = ucBudgetLevel;
+
+    return true;
+}
+
+/*
+ * Get the ID of the profile in use by the sampling ISR.
+ */
+uint8_t ucProfileGetActive(void) {
+    return eActiveProfile;
+}
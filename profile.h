@@ -0,0 +1,69 @@
+/*
+ * profile.h
+ * Types and public functions for sampling profiles.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "channel.h"
+#include "sample.h"
+
+
+/* Profile IDs. These are sent in the schema (see schema.h), so the server
+ * must use the same numbering. */
+typedef enum {
+    PROFILE_DRIVING = 0,
+    PROFILE_IDLING = 1,
+    PROFILE_PARKED = 2,
+    PROFILE_REMOTE_START = 3
+} ProfileID_t;
+
+/* A change a profile makes to one channel relative to its defaults */
+typedef struct {
+    volatile Channel_t *pxCh;
+    /* New sample rate, or RATE_NONE to stop sampling the channel */
+    SampleRateHz_t usSampleRateHz;
+    /* Deadband in raw channel units (0 for none) */
+    uint32_t ulDeadband;
+} ProfileChannel_t;
+
+/* A sampling profile: a set of channel changes applied on top of the default
+ * rates defined in channel.c */
+typedef struct {
+    const ProfileChannel_t *pxChannels;
+    uint32_t ulChannelCount;
+} Profile_t;
+
+
+void vProfileUpdate(void);
+void vProfileSetCANEvents(bool bEnable);
+void vProfileSetArchive(bool bEnable);
+void vProfileSetBudgetLevel(uint8_t ucLevel);
+bool bProfileArchiveActive(void);
+uint8_t ucProfileGetLimit(void);
+bool bProfileApplyPending(void);
+uint8_t ucProfileGetActive(void);
+
+
+#endif /* PROFILE_H_ */
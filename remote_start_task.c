@@ -649,6 +649,14 @@ static void RemoteStartTimerConfigure(void) {
     TimerIntEnable( WTIMER1_BASE, TIMER_TIMA_TIMEOUT );
 }
 
+/*
+ * Whether the ignition is currently held on by this device's RUN output
+ * (i.e. a remote start) rather than by a key.
+ */
+bool bRemoteStartActive( void ) {
+    return GPIOPinRead( GPIO_PORTB_BASE, RUN_PIN ) != 0;
+}
+
 /*
  * Initialize the remote start task by configuring the timers and GPIOs
  * necessary for the control outputs. Then create the task itself for the
@@ -56,6 +56,7 @@ typedef struct IgnitionStatus_t {
 extern TaskHandle_t xRemoteStartTaskHandle;
 extern IgnitionStatus_t xIgnitionStatus;
 
+bool bRemoteStartActive(void);
 uint32_t RemoteStartTaskInit(void);
 
 #endif /* __REMOTE_START_TASK_H__ */
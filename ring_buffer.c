@@ -24,6 +24,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "ring_buffer.h"
 
 
@@ -124,6 +125,37 @@ RingBufferStatus_t eRingBufferWriteN(volatile RingBuffer_t *pxBuffer,
     return BUFFER_OK;
 }
 
+/*
+ * Write as many of ulNBytes as fit to a given buffer, and return how many
+ * were written. The bytes are copied in at most two spans and the write index
+ * is updated once at the end, so a reader (such as an ISR) never sees part of
+ * the copy, and the same thread-safety as eRingBufferWrite() applies.
+ */
+uint32_t ulRingBufferWriteBulk(volatile RingBuffer_t *pxBuffer,
+                               const uint8_t *pucBytes, uint32_t ulNBytes) {
+    uint32_t ulWriteIndex = pxBuffer->ulWriteIndex;
+    uint32_t ulFree = ulRingBufferFree(pxBuffer);
+    uint32_t ulSpan;
+
+    if (ulNBytes > ulFree) {
+        ulNBytes = ulFree;
+    }
+
+    /* The first span runs to the end of the data array, and the second wraps
+     * around to its start. */
+    ulSpan = pxBuffer->ulSize - ulWriteIndex;
+    if (ulSpan > ulNBytes) {
+        ulSpan = ulNBytes;
+    }
+
+    memcpy((uint8_t *)pxBuffer->pucData + ulWriteIndex, pucBytes, ulSpan);
+    memcpy((uint8_t *)pxBuffer->pucData, pucBytes + ulSpan, ulNBytes - ulSpan);
+
+    pxBuffer->ulWriteIndex = (ulWriteIndex + ulNBytes) % pxBuffer->ulSize;
+
+    return ulNBytes;
+}
+
 /*
  * Clear a ring buffer. This is a reset of read/write indices and does not
  * imply erasure of garbage data in memory.
@@ -132,6 +164,15 @@ void vRingBufferClear(volatile RingBuffer_t *pxBuffer) {
     pxBuffer->ulReadIndex = pxBuffer->ulWriteIndex;
 }
 
+/*
+ * Get the number of bytes that can be written before the buffer is full. As
+ * with the other functions, a concurrent read can make this an underestimate.
+ */
+uint32_t ulRingBufferFree(volatile RingBuffer_t *pxBuffer) {
+    return (pxBuffer->ulReadIndex + pxBuffer->ulSize -
+            pxBuffer->ulWriteIndex - 1) % pxBuffer->ulSize;
+}
+
 /*
  * Get the data from the current read index without incrementing it.
  */
@@ -59,8 +59,13 @@ RingBufferStatus_t eRingBufferWrite(volatile RingBuffer_t *pxBuffer,
 RingBufferStatus_t eRingBufferWriteN(volatile RingBuffer_t *pxBuffer,
                                     uint8_t *pucBytes, uint32_t ulNBytes);
 
+uint32_t ulRingBufferWriteBulk(volatile RingBuffer_t *pxBuffer,
+                               const uint8_t *pucBytes, uint32_t ulNBytes);
+
 void vRingBufferClear(volatile RingBuffer_t *pxBuffer);
 
+uint32_t ulRingBufferFree(volatile RingBuffer_t *pxBuffer);
+
 RingBufferStatus_t xRingBufferPeek(volatile RingBuffer_t *pxBuffer,
                                   uint8_t *ucByte);
 
@@ -29,12 +29,10 @@
 
 
 #define ARRAY_LENGTH(x)                 (sizeof(x) / sizeof(x[0]))
-/* The number of bytes used for sample metadata (rate, length, timestamp) */
-#define SAMPLE_METADATA_BYTES           10
 
 
 /* Just an array of the pointers to sample rate buffers, for iteration */
-SampleRateBuffer_t *pxSampleRateBuffers[] = {
+SampleRateBuffer_t *pxSampleRateBuffers[SAMPLE_BUFFER_COUNT] = {
                          &xSampleBuffer1Hz,
                          &xSampleBuffer10Hz,
                          &xSampleBuffer100Hz
@@ -73,6 +71,21 @@ SampleRateBuffer_t xSampleBuffer100Hz = {
 };
 
 
+/* CAN event records are kept apart from the sample buffers, since they are
+ * written per received frame rather than on the sampling schedule. This buffer
+ * is intentionally not in pxSampleRateBuffers. */
+volatile uint8_t pucEventData[EVENT_BUFFER_SIZE];
+SampleRateBuffer_t xEventBuffer = {
+                    .xData = {
+                        .pucData = pucEventData,
+                        .ulSize = EVENT_BUFFER_SIZE,
+                        .ulReadIndex = 0,
+                        .ulWriteIndex = 0
+                    },
+                    .usSampleRateHz = RATE_NONE,
+};
+
+
 /*
  * Get the number of sample buffers.
  */
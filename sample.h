@@ -36,8 +36,57 @@
  * server and may accommodate multiple samples. */
 #define SAMPLE_BUFFER_SIZE              128
 
+/* The number of bytes used for sample metadata (rate, length, timestamp) */
+#define SAMPLE_METADATA_BYTES           10
+
+/* Number of sample rate buffers (the length of pxSampleRateBuffers) */
+#define SAMPLE_BUFFER_COUNT             3
+
+/* The upper 4 bits of a sample's frequency field carry the ID of the channel
+ * layout the sample was taken with: the low bits of the layout generation
+ * (see channel.c), which changes on every vChannelLayout() call, whether for
+ * a profile, archive rates, budget throttling or CAN event mode. The schema
+ * carries the same ID, so a sample is only matched with the schema of its
+ * own layout. */
+#define SAMPLE_LAYOUT_SHIFT             12
+#define SAMPLE_LAYOUT_ID_MASK           0x0F
+#define SAMPLE_RATE_MASK                0x0FFF
+
+/* Frequency field value marking a gap record rather than a sample, and the
+ * length of a gap record (header plus the 6-byte time sampling resumed) */
+#define SAMPLE_GAP_RATE                 0x0FFF
+#define SAMPLE_GAP_BYTES                16
+
+/* Frequency field value marking a CAN event record (see
+ * vChannelStoreCANEvent()), and the size of the buffer holding them. Events
+ * arrive at bus rates, so this buffer is larger than the sample buffers. */
+#define SAMPLE_EVENT_RATE               0x0FFE
+#define EVENT_BUFFER_SIZE               256
+/* Largest event record: header, CAN ID and all 8 bytes of a CAN frame */
+#define SAMPLE_EVENT_MAX_BYTES          ( SAMPLE_METADATA_BYTES + 2 + 8 )
+
+/* Frequency field value marking a compressed block of other records (see
+ * lz.h) */
+#define SAMPLE_LZ_RATE                  0x0FFD
+
+/* Frequency field value marking a schema record (see schema.h) */
+#define SAMPLE_SCHEMA_RATE              0x0FFC
+
+/* Frequency field value marking a reply to a server command, sent by the
+ * Modem UART task ahead of queued records. After the header come the command
+ * character, the token the server sent with it (4 bytes), and the
+ * milliseconds the command waited on the device before it was read (2
+ * bytes). Replies are never logged or resent. */
+#define SAMPLE_REPLY_RATE               0x0FFB
+#define SAMPLE_REPLY_BYTES              ( SAMPLE_METADATA_BYTES + 7 )
+
+/* Frequency field value marking an urgent record, which carries one
+ * channel's new value ahead of the samples (see urgent.h) */
+#define SAMPLE_URGENT_RATE              0x0FFA
+
 
 typedef enum {
+    RATE_NONE = 0,
     RATE_1HZ = 1,
     RATE_10HZ = 10,
     RATE_50HZ = 50,
@@ -55,12 +104,22 @@ typedef struct {
     uint16_t ulSampleSize;
     /* The sample rate for this buffer */
     uint16_t usSampleRateHz;
+    /* Location of this buffer's channel values within the channel snapshot
+     * (byte offset and length), set by vChannelInit() */
+    uint16_t usSnapshotOffset;
+    uint16_t usSnapshotBytes;
+    /* Range of this buffer's channels in the snapshot channel order */
+    uint8_t ucSnapshotFirst;
+    uint8_t ucSnapshotCount;
+    /* Set when the next sample must be written regardless of deadbands */
+    bool bForceSample;
 } SampleRateBuffer_t;
 
-extern SampleRateBuffer_t *pxSampleRateBuffers[];
+extern SampleRateBuffer_t *pxSampleRateBuffers[SAMPLE_BUFFER_COUNT];
 extern SampleRateBuffer_t xSampleBuffer1Hz;
 extern SampleRateBuffer_t xSampleBuffer10Hz;
 extern SampleRateBuffer_t xSampleBuffer100Hz;
+extern SampleRateBuffer_t xEventBuffer;
 
 uint8_t ucSampleGetBufferCount(void);
 float ulSampleGetMinPeriodMS(void);
@@ -0,0 +1,238 @@
+/*
+ * schema.c
+ * Builds the schema record (see schema.h) from the channel definitions and
+ * the current sample layout. The frame encoder takes each buffer's layout
+ * from the schema rather than from the channels directly, so the layout a
+ * frame is encoded with is always the one the server was sent.
+ *
+ * Only the Store task uses this module, apart from the Modem UART task
+ * copying the current record to send at connect.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "channel.h"
+#include "debug_helper.h"
+#include "explorerlink_main.h"
+#include "profile.h"
+#include "sample.h"
+#include "schema.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+/* The current schema record, and the layout generation it was built from */
+static uint8_t pucSchema[SCHEMA_MAX_BYTES];
+static uint32_t ulSchemaBytes = 0;
+static uint32_t ulSchemaGeneration = 0;
+/* Offset of the first buffer entry in pucSchema */
+static uint32_t ulBuffersOffset = 0;
+/* Whether the record must be sent before any more frames */
+static bool bSchemaPending = false;
+
+
+/*
+ * Hashes the schema contents after the hash field: 32-bit FNV-1a, folded to
+ * 16 bits. 0 is reserved for frames with no schema, so it is never returned.
+ */
+static uint16_t SchemaHash(const uint8_t *pucData, uint32_t ulLength) {
+    uint32_t ulHash = 2166136261u;
+    uint16_t usHash;
+    uint32_t i;
+
+    for (i = 0; i < ulLength; i++) {
+        ulHash ^= pucData[i];
+        ulHash *= 16777619u;
+    }
+
+    usHash = (ulHash >> 16) ^ (ulHash & 0xFFFF);
+
+    return usHash ? usHash : 1;
+}
+
+/*
+ * Rebuilds the schema record if the sample layout has changed since it was
+ * last built (or it never has been). A rebuilt schema is marked to be sent.
+ * Returns true if the schema was rebuilt.
+ */
+bool bSchemaUpdate(void) {
+    /* Static to keep the layout off the task's stack */
+    static volatile Channel_t *pxLayout[SCHEMA_MAX_CHANNELS];
+    uint8_t pucBufferCounts[SAMPLE_BUFFER_COUNT];
+    uint32_t ulChannelCount = ulChannelGetCount();
+    uint32_t ulBufferCount = ucSampleGetBufferCount();
+    uint32_t ulLayoutCount = 0;
+    uint32_t ulPos = SCHEMA_HEADER_BYTES;
+    volatile Channel_t *pxCh;
+    uint16_t usRateField = SAMPLE_SCHEMA_RATE;
+    uint16_t usSize;
+    uint16_t usHash;
+    uint16_t usVersion = EXPLORERLINK_FIRMWARE_VERSION;
+    uint16_t usRateHz;
+    uint32_t i, j;
+
+    if (ulSchemaBytes &&
+        ulSchemaGeneration == ulChannelGetLayoutGeneration()) {
+        return false;
+    }
+
+    configASSERT(ulChannelCount <= SCHEMA_MAX_CHANNELS);
+
+    /* Channel rates, the profile and the layout (and its generation) are
+     * changed together by the sampling ISR, so they are all read in one
+     * critical section. Only pointers and rates are copied here; IDs are
+     * looked up afterward. */
+    taskENTER_CRITICAL();
+    ulSchemaGeneration = ulChannelGetLayoutGeneration();
+    pucSchema[8] = ucProfileGetActive();
+    pucSchema[9] = ulSchemaGeneration & SAMPLE_LAYOUT_ID_MASK;
+
+    for (i = 0; i < ulChannelCount; i++) {
+        pxCh = pxChannelGet(i);
+        usRateHz = pxCh->usSampleRateHz;
+        pucSchema[ulPos++] = i;
+        pucSchema[ulPos++] = pxCh->ucByteCount;
+        pucSchema[ulPos++] = pxCh->eType;
+        memcpy(pucSchema + ulPos, &usRateHz, 2);
+        ulPos += 2;
+    }
+
+    for (i = 0; i < ulBufferCount; i++) {
+        pucBufferCounts[i] = ulChannelGetLayout(pxSampleRateBuffers[i],
+                                                pxLayout + ulLayoutCount,
+                                                SCHEMA_MAX_CHANNELS -
+                                                ulLayoutCount);
+        ulLayoutCount += pucBufferCounts[i];
+    }
+    taskEXIT_CRITICAL();
+
+    ulBuffersOffset = ulPos;
+    ulLayoutCount = 0;
+    for (i = 0; i < ulBufferCount; i++) {
+        usRateHz = pxSampleRateBuffers[i]->usSampleRateHz;
+        memcpy(pucSchema + ulPos, &usRateHz, 2);
+        pucSchema[ulPos + 2] = pucBufferCounts[i];
+        ulPos += SCHEMA_BUFFER_BYTES;
+
+        for (j = 0; j < pucBufferCounts[i]; j++) {
+            pucSchema[ulPos++] = ucChannelGetIndex(pxLayout[ulLayoutCount++]);
+        }
+    }
+
+    memcpy(pucSchema + 6, &usVersion, 2);
+    pucSchema[10] = ulChannelCount;
+    pucSchema[11] = ulBufferCount;
+
+    usSize = ulPos;
+    usHash = SchemaHash(pucSchema + 6, ulPos - 6);
+    memcpy(pucSchema, &usRateField, 2);
+    memcpy(pucSchema + 2, &usSize, 2);
+    memcpy(pucSchema + 4, &usHash, 2);
+
+    ulSchemaBytes = ulPos;
+    bSchemaPending = true;
+
+    debug_print("schema %04x: profile %d, layout %d, %d bytes\n", usHash,
+                pucSchema[8], pucSchema[9], ulPos);
+
+    return true;
+}
+
+/*
+ * Returns the hash of the current schema.
+ */
+uint16_t usSchemaGetHash(void) {
+    uint16_t usHash;
+
+    memcpy(&usHash, pucSchema + 4, 2);
+
+    return usHash;
+}
+
+/*
+ * Copies the channels making up the passed buffer's samples, as described by
+ * the current schema, into ppxChannels, and the ID of that layout into
+ * *pucLayoutID. Returns the number of channels, or 0 if the schema has no
+ * channels for the buffer or there are more than ulMaxChannels.
+ */
+uint32_t ulSchemaGetLayout(SampleRateBuffer_t *pxBuffer,
+                           volatile Channel_t **ppxChannels,
+                           uint32_t ulMaxChannels, uint8_t *pucLayoutID) {
+    uint32_t ulPos = ulBuffersOffset;
+    uint16_t usRateHz;
+    uint32_t ulCount;
+    uint32_t i, j;
+
+    *pucLayoutID = pucSchema[9];
+
+    for (i = 0; i < pucSchema[11] && ulPos < ulSchemaBytes; i++) {
+        memcpy(&usRateHz, pucSchema + ulPos, 2);
+        ulCount = pucSchema[ulPos + 2];
+        ulPos += SCHEMA_BUFFER_BYTES;
+
+        if (usRateHz == pxBuffer->usSampleRateHz) {
+            if (ulCount > ulMaxChannels) {
+                return 0;
+            }
+            for (j = 0; j < ulCount; j++) {
+                ppxChannels[j] = pxChannelGet(pucSchema[ulPos + j]);
+            }
+            return ulCount;
+        }
+
+        ulPos += ulCount;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns the length of the schema record if it needs to be sent, with
+ * *ppucRecord pointing to it, and clears the need. Returns 0 otherwise.
+ */
+uint32_t ulSchemaGetPending(uint8_t **ppucRecord) {
+
+    /* The schema is normally built by the frame encoder, but may be wanted
+     * at connect before any frame has been started. */
+    if (!ulSchemaBytes) {
+        bSchemaUpdate();
+    }
+
+    if (!bSchemaPending) {
+        return 0;
+    }
+
+    bSchemaPending = false;
+    *ppucRecord = pucSchema;
+
+    return ulSchemaBytes;
+}
+
+/*
+ * Returns the length of the current schema record, with *ppucRecord pointing
+ * to it, or 0 if no schema has been built yet.
+ */
+uint32_t ulSchemaGetRecord(uint8_t **ppucRecord) {
+    *ppucRecord = pucSchema;
+
+    return ulSchemaBytes;
+}
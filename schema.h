@@ -0,0 +1,83 @@
+/*
+ * schema.h
+ * Definitions for the schema record, which describes the channels and sample
+ * layout to the server.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCHEMA_H_
+#define SCHEMA_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "channel.h"
+#include "sample.h"
+
+
+/* The schema record describes every channel and the current sample layout,
+ * so the server needs no built-in knowledge of xChannels:
+ *
+ *   rate (2 bytes)        SAMPLE_SCHEMA_RATE
+ *   size (2 bytes)        total record length in bytes
+ *   hash (2 bytes)        schema hash of the bytes that follow
+ *   version (2 bytes)     EXPLORERLINK_FIRMWARE_VERSION
+ *   profile (1 byte)      sampling profile the layout belongs to
+ *   layout (1 byte)       layout ID carried by samples taken with this
+ *                         layout (see SAMPLE_LAYOUT_SHIFT)
+ *   channels (1 byte)     number of channel entries
+ *   buffers (1 byte)      number of buffer entries
+ *   channel entries       per channel, in xChannels order: ID (its position
+ *                         in xChannels, 1 byte), width in bytes (1 byte),
+ *                         ChannelType_t (1 byte) and current rate (2 bytes)
+ *   buffer entries        per sample buffer: rate (2 bytes), number of
+ *                         channels (1 byte), then the channel IDs in the
+ *                         order their values appear in a sample
+ *
+ * It is sent after every TCP connect and again before the first frame using
+ * a new layout, and starts every sector of the flash log (see store.h).
+ * Frames carry the hash of the schema they were encoded with (0 if the
+ * layout they were sampled with isn't known; see frame.c), so a server
+ * should keep the schemas it has seen by hash. The hash is a 32-bit
+ * FNV-1a hash folded to 16 bits, and is never 0. */
+#define SCHEMA_HEADER_BYTES             12
+#define SCHEMA_CHANNEL_BYTES            5
+#define SCHEMA_BUFFER_BYTES             3
+
+/* Most channels a schema can describe (every channel in xChannels) */
+#define SCHEMA_MAX_CHANNELS             32
+
+/* Largest schema record, with every channel in some buffer */
+#define SCHEMA_MAX_BYTES                ( SCHEMA_HEADER_BYTES + \
+                                          SCHEMA_MAX_CHANNELS * \
+                                          ( SCHEMA_CHANNEL_BYTES + 1 ) + \
+                                          SAMPLE_BUFFER_COUNT * \
+                                          SCHEMA_BUFFER_BYTES )
+
+
+bool bSchemaUpdate(void);
+uint16_t usSchemaGetHash(void);
+uint32_t ulSchemaGetLayout(SampleRateBuffer_t *pxBuffer,
+                           volatile Channel_t **ppxChannels,
+                           uint32_t ulMaxChannels, uint8_t *pucLayoutID);
+uint32_t ulSchemaGetPending(uint8_t **ppucRecord);
+uint32_t ulSchemaGetRecord(uint8_t **ppucRecord);
+
+
+#endif /* SCHEMA_H_ */
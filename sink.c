@@ -0,0 +1,228 @@
+/*
+ * sink.c
+ * The local sink (see sink.h). The Store task frames records into a ring
+ * buffer, and the UART0 ISR moves them to the UART as the receiver allows.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "sink.h"
+
+#ifdef LOCAL_SINK
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "driverlib/gpio.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/pin_map.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/uart.h"
+#include "crc.h"
+#include "modem_uart_task.h"
+#include "ring_buffer.h"
+#include "sample.h"
+#include "schema.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+/* Required memory for the ring buffer */
+static uint8_t pucSinkBufferData[SINK_BUFFER_SIZE];
+
+/* Packets waiting for UART0. Only the Store task writes to it, and only the
+ * UART0 ISR reads from it. */
+static volatile RingBuffer_t xSinkBuffer = {
+                             .pucData = pucSinkBufferData,
+                             .ulSize = SINK_BUFFER_SIZE,
+                             .ulReadIndex = 0,
+                             .ulWriteIndex = 0
+};
+
+/* Whether the receiver has sent XOFF */
+static volatile bool bPaused = false;
+
+/* Sequence number of the next packet, and when the schema was last sent */
+static uint16_t usSinkSeq = 0;
+static TickType_t xSchemaSentTick = 0;
+static bool bSchemaSent = false;
+
+/* Totals since startup, for reading with a debugger (the console is
+ * unavailable in these builds) */
+static uint32_t ulSinkPackets = 0;
+static uint32_t ulSinkBytes = 0;
+static uint32_t ulSinkDropped = 0;
+static uint32_t ulSinkPauses = 0;
+
+
+/*
+ * Fills the UART0 transmit FIFO from the ring buffer. Called from the ISR,
+ * and with the UART0 interrupt disabled from the Store task.
+ */
+static void SinkFill(void) {
+    uint8_t ucTxByte;
+
+    while (!bPaused && UARTSpaceAvail(UART0_BASE) &&
+           eRingBufferRead(&xSinkBuffer, &ucTxByte) != BUFFER_EMPTY) {
+        UARTCharPutNonBlocking(UART0_BASE, ucTxByte);
+    }
+}
+
+/*
+ * Starts a transmission if one isn't already running, in the same way as
+ * UART6Prime() (see modem_uart_task.c).
+ */
+static void SinkPrime(void) {
+
+    IntDisable(INT_UART0);
+    SinkFill();
+    UARTIntEnable(UART0_BASE, UART_INT_TX);
+    IntEnable(INT_UART0);
+}
+
+/*
+ * The UART0 ISR feeds the transmit FIFO until the ring buffer is empty or
+ * the receiver sends XOFF, and picks XON and XOFF out of whatever arrives.
+ * It makes no FreeRTOS calls.
+ */
+void UART0IntHandler(void) {
+    uint32_t ulStatus;
+    uint8_t ucRxByte;
+
+    ulStatus = UARTIntStatus(UART0_BASE, 1);
+    UARTIntClear(UART0_BASE, ulStatus);
+
+    if (ulStatus & (UART_INT_RX | UART_INT_RT)) {
+        while (UARTCharsAvail(UART0_BASE)) {
+            ucRxByte = UARTCharGetNonBlocking(UART0_BASE);
+            if (ucRxByte == SINK_XOFF && !bPaused) {
+                bPaused = true;
+                ulSinkPauses++;
+            }
+            else if (ucRxByte == SINK_XON) {
+                bPaused = false;
+            }
+        }
+    }
+
+    SinkFill();
+
+    /* Nothing more can be sent until the Store task writes a packet or the
+     * receiver sends XON (which arrives as an RX interrupt). */
+    if (bPaused || eRingBufferStatus(&xSinkBuffer) == BUFFER_EMPTY) {
+        UARTIntDisable(UART0_BASE, UART_INT_TX);
+    }
+    else {
+        UARTIntEnable(UART0_BASE, UART_INT_TX);
+    }
+}
+
+/*
+ * Frames a record as a packet (see modem_uart_task.h) into the ring buffer
+ * if the whole packet fits, and drops it otherwise.
+ */
+static void SinkPacket(const uint8_t *pucRecord, uint32_t ulLength) {
+    uint8_t pucHeader[STREAM_HEADER_BYTES];
+    uint16_t usCRC;
+
+    if (ulRingBufferFree(&xSinkBuffer) <
+            STREAM_HEADER_BYTES + ulLength + STREAM_CRC_BYTES) {
+        ulSinkDropped++;
+        usSinkSeq++;
+        return;
+    }
+
+    pucHeader[0] = STREAM_SYNC_0;
+    pucHeader[1] = STREAM_SYNC_1;
+    memcpy(pucHeader + 2, &usSinkSeq, 2);
+    usCRC = usCRC16(pucHeader + 2, 2, CRC16_INIT);
+    usCRC = usCRC16(pucRecord, ulLength, usCRC);
+
+    ulRingBufferWriteBulk(&xSinkBuffer, pucHeader, STREAM_HEADER_BYTES);
+    ulRingBufferWriteBulk(&xSinkBuffer, pucRecord, ulLength);
+    ulRingBufferWriteBulk(&xSinkBuffer, (uint8_t *)&usCRC, STREAM_CRC_BYTES);
+
+    usSinkSeq++;
+    ulSinkPackets++;
+    ulSinkBytes += STREAM_HEADER_BYTES + ulLength + STREAM_CRC_BYTES;
+}
+
+/*
+ * Copies a record to the sink, after the schema if it is due. A schema
+ * record counts as the schema being sent, so it isn't sent twice. Only
+ * called by the Store task, which owns the schema, and never waits.
+ */
+void vSinkWrite(const uint8_t *pucRecord, uint32_t ulLength) {
+    uint8_t *pucSchema;
+    uint32_t ulSchemaLength;
+    uint16_t usRateField;
+
+    memcpy(&usRateField, pucRecord, 2);
+
+    if ((usRateField & SAMPLE_RATE_MASK) == SAMPLE_SCHEMA_RATE) {
+        xSchemaSentTick = xTaskGetTickCount();
+        bSchemaSent = true;
+    }
+    else if (!bSchemaSent || xTaskGetTickCount() - xSchemaSentTick >=
+                             pdMS_TO_TICKS(SINK_SCHEMA_INTERVAL_MS)) {
+        ulSchemaLength = ulSchemaGetRecord(&pucSchema);
+        if (ulSchemaLength) {
+            SinkPacket(pucSchema, ulSchemaLength);
+            xSchemaSentTick = xTaskGetTickCount();
+            bSchemaSent = true;
+        }
+    }
+
+    SinkPacket(pucRecord, ulLength);
+
+    if (!bPaused) {
+        SinkPrime();
+    }
+}
+
+/*
+ * Configures UART0 and its pins for the sink at SINK_BAUD, 8-n-1. Called
+ * before the scheduler starts, in place of the console.
+ */
+void vSinkInit(void) {
+
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA);
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);
+
+    /* Wait for UART0 to become ready. */
+    while(!SysCtlPeripheralReady(SYSCTL_PERIPH_UART0)) {
+    }
+
+    GPIOPinConfigure(GPIO_PA0_U0RX);
+    GPIOPinConfigure(GPIO_PA1_U0TX);
+    GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+
+    UARTConfigSetExpClk(UART0_BASE, SysCtlClockGet(), SINK_BAUD,
+                        UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE |
+                        UART_CONFIG_PAR_NONE);
+
+    IntEnable(INT_UART0);
+    UARTIntEnable(UART0_BASE, UART_INT_RX | UART_INT_RT);
+
+    UARTEnable(UART0_BASE);
+}
+
+#endif /* LOCAL_SINK */
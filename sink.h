@@ -0,0 +1,85 @@
+/*
+ * sink.h
+ * Definitions for the local sink, which copies the record stream to UART0
+ * for a laptop or logger wired to the board.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SINK_H_
+#define SINK_H_
+
+
+#include <stdint.h>
+
+/* The sink is only built if build variable LOCAL_SINK is defined, in the same
+ * way as the debug code (see debug_helper.h). Otherwise these macros are all
+ * that is left of it. UART0 is also the debug console, so the two can't be
+ * built together. */
+#ifdef LOCAL_SINK
+#ifdef DEBUG
+#error "LOCAL_SINK and DEBUG both need UART0"
+#endif
+#define sink_init()                     do { vSinkInit(); } while (0)
+#define sink_write( pucRecord, ulLength ) \
+            do { vSinkWrite( pucRecord, ulLength ); } while (0)
+#else
+#define sink_init()                     do { } while (0)
+#define sink_write( pucRecord, ulLength ) \
+            do { } while (0)
+#endif /* LOCAL_SINK */
+
+/* The Store task gives the sink every record it produces: frames (including
+ * those the uplink decimates), gaps, events and schemas, whether or not the
+ * modem is connected and whatever the data budget. Archive mode and budget
+ * throttling don't lower sampling rates in these builds, so the sink gets
+ * the profile's full rates, and every CAN frame in CAN event mode. The
+ * limits are applied to the uplink's frames instead: at the budget's rate
+ * level (and in archive mode), each stream sends at most one frame every
+ * SINK_UPLINK_RATES_S seconds of sample time, and at the coarse level one
+ * every SINK_UPLINK_COARSE_S. The deadband level has no
+ * equivalent for frames already encoded, so it doesn't limit the uplink.
+ * Frames held back aren't logged to flash, since draining them would spend
+ * the budget all the same.
+ *
+ * Records are framed as on the TCP stream (see modem_uart_task.h), with a
+ * sequence of their own, so host/stream_decode.c reads a capture as is. The
+ * schema is repeated every SINK_SCHEMA_INTERVAL_MS for a receiver that
+ * attaches partway through.
+ *
+ * UART0 has no flow control lines, so the receiver uses XON/XOFF. Records
+ * are only ever copied into a ring buffer that the UART0 ISR drains, so the
+ * Store task never waits on the sink. A record that doesn't fit whole
+ * (because the receiver is slow or has sent XOFF) is dropped, which shows up
+ * as a jump in the sequence. */
+#define SINK_BAUD                       921600
+#define SINK_BUFFER_SIZE                1024
+#define SINK_SCHEMA_INTERVAL_MS         1000
+#define SINK_XON                        0x11
+#define SINK_XOFF                       0x13
+#define SINK_UPLINK_RATES_S             1
+#define SINK_UPLINK_COARSE_S            4
+
+
+#ifdef LOCAL_SINK
+void vSinkInit(void);
+void vSinkWrite(const uint8_t *pucRecord, uint32_t ulLength);
+#endif /* LOCAL_SINK */
+
+
+#endif /* SINK_H_ */
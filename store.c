@@ -0,0 +1,520 @@
+/*
+ * store.c
+ * A log-structured store in on-chip flash for uplink records that can't be
+ * sent right away (see store.h for the layout). Records are appended to the
+ * newest sector and drained a sector at a time, oldest or newest first.
+ *
+ * Erasing a sector stalls flash reads, and so the CPU, for up to several
+ * milliseconds, which the sampling ISR sees as latency. Erases only happen
+ * once per STORE_SECTOR_BYTES logged.
+ *
+ * The Store task serializes access to this module (see store_task.c),
+ * apart from the Modem UART task setting the drain order on a server
+ * command.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef STORE_HOST_EMULATOR
+#include <stdio.h>
+#include "host/flash_emu.h"
+#else
+#include "driverlib/flash.h"
+#include "debug_helper.h"
+#endif
+#include "store.h"
+
+/* debug_helper.h needs TivaWare, so the emulator build prints directly. */
+#ifdef STORE_HOST_EMULATOR
+#define debug_print                     printf
+#endif
+
+
+/* Offsets of the sector header fields */
+#define STORE_SEQUENCE_OFFSET           4
+#define STORE_DRAINED_OFFSET            8
+
+/* Value of flash that has been erased but not programmed */
+#define STORE_ERASED_WORD               0xFFFFFFFF
+
+
+/* Sequence number of each sector holding records not yet drained, or 0 */
+static uint32_t pulSectorSeq[STORE_SECTOR_COUNT];
+/* Sequence number for the next sector opened */
+static uint32_t ulNextSeq = 1;
+
+/* The sector being written (or last written, if none is open) and the
+ * offset of the next entry in it */
+static uint32_t ulWriteSector = STORE_SECTOR_COUNT - 1;
+static uint32_t ulWriteOffset = 0;
+static bool bWriteOpen = false;
+
+/* The sector being drained and the offset of its next entry */
+static uint32_t ulReadSector = 0;
+static uint32_t ulReadOffset = 0;
+static bool bReadOpen = false;
+
+static StoreDrainOrder_t eDrainOrder = STORE_DRAIN_OLDEST;
+
+/* The sector being scanned, its sequence number (0 before the first), the
+ * offset of its next entry, and the first sequence number not to scan */
+static uint32_t ulScanSector = 0;
+static uint32_t ulScanSeq = 0;
+static uint32_t ulScanOffset = 0;
+static uint32_t ulScanEndSeq = 0;
+
+static StoreStats_t xStats;
+
+
+/*
+ * Returns the flash address of a sector.
+ */
+static uint32_t StoreSectorAddress(uint32_t ulSector) {
+    return STORE_FLASH_BASE + ulSector * STORE_SECTOR_BYTES;
+}
+
+/*
+ * Reads a word of flash.
+ */
+static uint32_t StoreReadWord(uint32_t ulAddress) {
+    uint32_t ulWord;
+
+    memcpy(&ulWord, STORE_FLASH_POINTER(ulAddress), 4);
+
+    return ulWord;
+}
+
+/*
+ * Returns the flash taken by an entry holding a record of ulLength bytes.
+ */
+static uint32_t StoreEntryBytes(uint32_t ulLength) {
+    return STORE_ENTRY_HEADER_BYTES + ((ulLength + 3) & ~3);
+}
+
+/*
+ * Checks for a complete entry at ulOffset in the sector at ulAddress, and
+ * stores its record length in *pulLength. Returns false at the end of the
+ * sector's entries, including at an entry that was never finished.
+ */
+static bool StoreEntryLength(uint32_t ulAddress, uint32_t ulOffset,
+                             uint32_t *pulLength) {
+    uint32_t ulHeader;
+
+    if (ulOffset + STORE_ENTRY_HEADER_BYTES > STORE_SECTOR_BYTES) {
+        return false;
+    }
+
+    ulHeader = StoreReadWord(ulAddress + ulOffset);
+    *pulLength = ulHeader & 0xFFFF;
+
+    if ((ulHeader >> 16) != (~ulHeader & 0xFFFF) || *pulLength == 0 ||
+        ulOffset + StoreEntryBytes(*pulLength) > STORE_SECTOR_BYTES) {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Erases the next sector in turn and writes its header. Any records still
+ * in it are lost. Returns false if the flash operation failed, in which case
+ * the following sector is tried on the next call.
+ */
+static bool StoreOpenSector(void) {
+    uint32_t ulSector = (ulWriteSector + 1) % STORE_SECTOR_COUNT;
+    uint32_t ulAddress = StoreSectorAddress(ulSector);
+    uint32_t pulHeader[2];
+
+    if (pulSectorSeq[ulSector]) {
+        pulSectorSeq[ulSector] = 0;
+        xStats.ulLostSectors++;
+        debug_print("store full, sector %d overwritten\n", ulSector);
+    }
+
+    if (bReadOpen && ulReadSector == ulSector) {
+        bReadOpen = false;
+    }
+
+    bWriteOpen = false;
+    ulWriteSector = ulSector;
+
+    xStats.ulErases++;
+    if (FlashErase(ulAddress) != 0) {
+        xStats.ulErrors++;
+        return false;
+    }
+
+    pulHeader[0] = STORE_MAGIC;
+    pulHeader[1] = ulNextSeq;
+    if (FlashProgram(pulHeader, ulAddress, sizeof(pulHeader)) != 0) {
+        xStats.ulErrors++;
+        return false;
+    }
+
+    pulSectorSeq[ulSector] = ulNextSeq++;
+    ulWriteOffset = STORE_SECTOR_HEADER_BYTES;
+    bWriteOpen = true;
+
+    return true;
+}
+
+/*
+ * Writes an entry at the end of the open sector, which must have room for
+ * it. The header word is programmed last, so the entry only becomes visible
+ * once it is complete. Returns false if the flash operation failed.
+ */
+static bool StoreWriteEntry(const uint8_t *pucRecord, uint32_t ulLength) {
+    uint32_t ulAddress = StoreSectorAddress(ulWriteSector) + ulWriteOffset;
+    uint32_t ulWord;
+    uint32_t ulChunk;
+    uint32_t ulPos;
+
+    for (ulPos = 0; ulPos < ulLength; ulPos += 4) {
+        ulChunk = (ulLength - ulPos < 4) ? ulLength - ulPos : 4;
+        ulWord = STORE_ERASED_WORD;
+        memcpy(&ulWord, pucRecord + ulPos, ulChunk);
+
+        if (FlashProgram(&ulWord, ulAddress + STORE_ENTRY_HEADER_BYTES + ulPos,
+                         4) != 0) {
+            return false;
+        }
+    }
+
+    ulWord = ulLength | ((~ulLength & 0xFFFF) << 16);
+    if (FlashProgram(&ulWord, ulAddress, 4) != 0) {
+        return false;
+    }
+
+    ulWriteOffset += StoreEntryBytes(ulLength);
+
+    return true;
+}
+
+/*
+ * Marks the sector being drained as drained, so it is skipped after a
+ * reset, and closes it.
+ */
+static void StoreMarkDrained(void) {
+    uint32_t ulZero = 0;
+
+    if (FlashProgram(&ulZero, StoreSectorAddress(ulReadSector) +
+                              STORE_DRAINED_OFFSET, 4) != 0) {
+        xStats.ulErrors++;
+    }
+
+    pulSectorSeq[ulReadSector] = 0;
+    bReadOpen = false;
+}
+
+/*
+ * Picks the next sector to drain by the drain order. The sector still being
+ * written is only drained once no other sector has records, so "newest"
+ * means the newest full sector. Returns false if nothing is left to drain.
+ */
+static bool StoreSelectSector(void) {
+    uint32_t ulBest = STORE_SECTOR_COUNT;
+    uint32_t i;
+
+    for (i = 0; i < STORE_SECTOR_COUNT; i++) {
+        if (!pulSectorSeq[i] || (bWriteOpen && i == ulWriteSector)) {
+            continue;
+        }
+
+        if (ulBest == STORE_SECTOR_COUNT ||
+            (eDrainOrder == STORE_DRAIN_OLDEST &&
+             pulSectorSeq[i] < pulSectorSeq[ulBest]) ||
+            (eDrainOrder == STORE_DRAIN_NEWEST &&
+             pulSectorSeq[i] > pulSectorSeq[ulBest])) {
+            ulBest = i;
+        }
+    }
+
+    if (ulBest == STORE_SECTOR_COUNT) {
+        if (!bWriteOpen) {
+            return false;
+        }
+        ulBest = ulWriteSector;
+    }
+
+    ulReadSector = ulBest;
+    ulReadOffset = STORE_SECTOR_HEADER_BYTES;
+    bReadOpen = true;
+
+    return true;
+}
+
+/*
+ * Returns the sequence number in a sector's header, or 0 if the sector has
+ * none.
+ */
+static uint32_t StoreSectorSeq(uint32_t ulSector) {
+    uint32_t ulAddress = StoreSectorAddress(ulSector);
+    uint32_t ulSeq = StoreReadWord(ulAddress + STORE_SEQUENCE_OFFSET);
+
+    if (StoreReadWord(ulAddress) != STORE_MAGIC ||
+        ulSeq == STORE_ERASED_WORD) {
+        return 0;
+    }
+
+    return ulSeq;
+}
+
+/*
+ * Moves the scan to the oldest sector opened after the one being scanned.
+ * Returns false if there is none left.
+ */
+static bool StoreScanNextSector(void) {
+    uint32_t ulBest = STORE_SECTOR_COUNT;
+    uint32_t ulBestSeq = 0;
+    uint32_t ulSeq;
+    uint32_t i;
+
+    for (i = 0; i < STORE_SECTOR_COUNT; i++) {
+        ulSeq = StoreSectorSeq(i);
+        if (ulSeq > ulScanSeq && ulSeq < ulScanEndSeq &&
+            (ulBest == STORE_SECTOR_COUNT || ulSeq < ulBestSeq)) {
+            ulBest = i;
+            ulBestSeq = ulSeq;
+        }
+    }
+
+    if (ulBest == STORE_SECTOR_COUNT) {
+        ulScanSeq = ulScanEndSeq;
+        return false;
+    }
+
+    ulScanSector = ulBest;
+    ulScanSeq = ulBestSeq;
+    ulScanOffset = STORE_SECTOR_HEADER_BYTES;
+
+    return true;
+}
+
+/*
+ * Scans the flash region for sectors left from before the last reset. Their
+ * undrained records are kept, and writing resumes in a fresh sector after
+ * the newest one.
+ */
+void vStoreInit(void) {
+    uint32_t ulMaxSeq = 0;
+    uint32_t ulAddress;
+    uint32_t ulSeq;
+    uint32_t i;
+
+    for (i = 0; i < STORE_SECTOR_COUNT; i++) {
+        ulAddress = StoreSectorAddress(i);
+        ulSeq = StoreReadWord(ulAddress + STORE_SEQUENCE_OFFSET);
+        pulSectorSeq[i] = 0;
+
+        if (StoreReadWord(ulAddress) != STORE_MAGIC || ulSeq == 0 ||
+            ulSeq == STORE_ERASED_WORD) {
+            continue;
+        }
+
+        if (ulSeq > ulMaxSeq) {
+            ulMaxSeq = ulSeq;
+            ulWriteSector = i;
+        }
+
+        if (StoreReadWord(ulAddress + STORE_DRAINED_OFFSET) ==
+            STORE_ERASED_WORD) {
+            pulSectorSeq[i] = ulSeq;
+        }
+    }
+
+    ulNextSeq = ulMaxSeq + 1;
+    bWriteOpen = false;
+    bReadOpen = false;
+
+    debug_print("store: next sector %d, sequence %d\n",
+                (ulWriteSector + 1) % STORE_SECTOR_COUNT, ulNextSeq);
+}
+
+/*
+ * Appends a record to the log. pucPrefix (the current schema record, or
+ * NULL) is written first in every new sector, so each sector can be decoded
+ * on its own. Returns false if the record was not stored.
+ */
+bool bStoreAppend(const uint8_t *pucRecord, uint32_t ulLength,
+                  const uint8_t *pucPrefix, uint32_t ulPrefixLength) {
+    uint32_t ulEntryBytes = StoreEntryBytes(ulLength);
+
+    if (!ulLength || ulLength > STORE_MAX_RECORD_BYTES ||
+        (ulPrefixLength && STORE_SECTOR_HEADER_BYTES +
+         StoreEntryBytes(ulPrefixLength) + ulEntryBytes > STORE_SECTOR_BYTES)) {
+        return false;
+    }
+
+    if (!bWriteOpen || ulWriteOffset + ulEntryBytes > STORE_SECTOR_BYTES) {
+        if (!StoreOpenSector()) {
+            return false;
+        }
+
+        if (ulPrefixLength && !StoreWriteEntry(pucPrefix, ulPrefixLength)) {
+            bWriteOpen = false;
+            xStats.ulErrors++;
+            return false;
+        }
+    }
+
+    if (!StoreWriteEntry(pucRecord, ulLength)) {
+        bWriteOpen = false;
+        xStats.ulErrors++;
+        return false;
+    }
+
+    xStats.ulAppendedBytes += ulLength;
+
+    return true;
+}
+
+/*
+ * Returns a pointer to the next record to drain, read in place from flash,
+ * and its length in *pulLength. The record stays in the log until
+ * vStoreConsume() is called. Returns NULL if there is nothing to drain.
+ */
+const uint8_t *pucStorePeek(uint32_t *pulLength) {
+    uint32_t ulAddress;
+
+    while (1) {
+        if (!bReadOpen && !StoreSelectSector()) {
+            return NULL;
+        }
+
+        ulAddress = StoreSectorAddress(ulReadSector);
+        if (StoreEntryLength(ulAddress, ulReadOffset, pulLength)) {
+            return STORE_FLASH_POINTER(ulAddress + ulReadOffset +
+                                       STORE_ENTRY_HEADER_BYTES);
+        }
+
+        /* The sector still being written may get more records. */
+        if (bWriteOpen && ulReadSector == ulWriteSector) {
+            return NULL;
+        }
+
+        StoreMarkDrained();
+    }
+}
+
+/*
+ * Removes the record last returned by pucStorePeek() from the log.
+ */
+void vStoreConsume(void) {
+    uint32_t ulLength;
+
+    if (bReadOpen && StoreEntryLength(StoreSectorAddress(ulReadSector),
+                                      ulReadOffset, &ulLength)) {
+        ulReadOffset += StoreEntryBytes(ulLength);
+        xStats.ulDrainedBytes += ulLength;
+    }
+}
+
+/*
+ * Starts a scan of every record still in flash, oldest first, whether or not
+ * it has been drained. Sectors opened after this call aren't scanned.
+ */
+void vStoreScanStart(void) {
+    ulScanSeq = 0;
+    ulScanEndSeq = ulNextSeq;
+}
+
+/*
+ * Returns a pointer to the next record of the scan, read in place from
+ * flash, and its length in *pulLength. The scan stays on the record until
+ * vStoreScanConsume() is called. Returns NULL once the scan is finished.
+ */
+const uint8_t *pucStoreScanPeek(uint32_t *pulLength) {
+    uint32_t ulAddress;
+
+    while (1) {
+        if (!ulScanSeq && !StoreScanNextSector()) {
+            return NULL;
+        }
+
+        /* A sector overwritten since the scan reached it is passed over. */
+        ulAddress = StoreSectorAddress(ulScanSector);
+        if (ulScanSeq < ulScanEndSeq &&
+            StoreSectorSeq(ulScanSector) == ulScanSeq &&
+            StoreEntryLength(ulAddress, ulScanOffset, pulLength)) {
+            return STORE_FLASH_POINTER(ulAddress + ulScanOffset +
+                                       STORE_ENTRY_HEADER_BYTES);
+        }
+
+        if (ulScanSeq >= ulScanEndSeq || !StoreScanNextSector()) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Moves the scan past the record last returned by pucStoreScanPeek().
+ */
+void vStoreScanConsume(void) {
+    uint32_t ulLength;
+
+    if (StoreEntryLength(StoreSectorAddress(ulScanSector), ulScanOffset,
+                         &ulLength)) {
+        ulScanOffset += StoreEntryBytes(ulLength);
+    }
+}
+
+/*
+ * Notes where the record last returned by pucStoreScanPeek() is.
+ */
+void vStoreScanMark(StoreScanMark_t *pxMark) {
+    pxMark->ulSector = ulScanSector;
+    pxMark->ulSeq = ulScanSeq;
+    pxMark->ulOffset = ulScanOffset;
+}
+
+/*
+ * Returns a pointer to a record noted by vStoreScanMark(), read in place
+ * from flash, and its length in *pulLength. Returns NULL if its sector has
+ * been erased or overwritten since.
+ */
+const uint8_t *pucStoreScanMarked(const StoreScanMark_t *pxMark,
+                                  uint32_t *pulLength) {
+    uint32_t ulAddress = StoreSectorAddress(pxMark->ulSector);
+
+    if (StoreSectorSeq(pxMark->ulSector) != pxMark->ulSeq ||
+        !StoreEntryLength(ulAddress, pxMark->ulOffset, pulLength)) {
+        return NULL;
+    }
+
+    return STORE_FLASH_POINTER(ulAddress + pxMark->ulOffset +
+                               STORE_ENTRY_HEADER_BYTES);
+}
+
+/*
+ * Sets the order in which sectors are drained. A sector already being
+ * drained is finished first.
+ */
+void vStoreSetDrainOrder(StoreDrainOrder_t eOrder) {
+    eDrainOrder = eOrder;
+}
+
+/*
+ * Copies the totals since startup into *pxStats.
+ */
+void vStoreGetStats(StoreStats_t *pxStats) {
+    memcpy(pxStats, &xStats, sizeof(xStats));
+}
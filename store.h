@@ -0,0 +1,117 @@
+/*
+ * store.h
+ * Definitions for the store-and-forward log, which keeps uplink records in
+ * on-chip flash while the TCP connection can't take them.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STORE_H_
+#define STORE_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* The log occupies the top STORE_SECTOR_COUNT 1 KB erase blocks of the
+ * 256 KB internal flash. The application must be linked below
+ * STORE_FLASH_BASE. Each sector starts with a header:
+ *
+ *   magic (4 bytes)       STORE_MAGIC
+ *   sequence (4 bytes)    one more than the previous sector opened, so the
+ *                         oldest sector is the one with the lowest sequence
+ *   drained (4 bytes)     erased (all ones) until every record in the sector
+ *                         has been sent, then programmed to 0
+ *
+ * followed by entries, each a header word (record length in the low half,
+ * its complement in the high half) and then the record, padded to a whole
+ * word. An entry's data is programmed before its header word, so an entry
+ * cut short by a reset reads as the end of the sector.
+ *
+ * Sectors are filled strictly in turn, wrapping at the end of the region,
+ * so every sector is erased equally often. When the log is full, the oldest
+ * sector is overwritten and its unsent records are counted as lost. A
+ * sector is only marked drained once all of it has been sent, so after a
+ * reset the records sent from a partly drained sector are sent again.
+ *
+ * Drained sectors keep their records until they are overwritten, so a scan
+ * (see vStoreScanStart()) can read back everything still in flash, which is
+ * how the server's history queries are answered. */
+#ifndef STORE_FLASH_BASE
+#define STORE_FLASH_BASE                0x00030000
+#endif
+#define STORE_SECTOR_BYTES              1024
+#define STORE_SECTOR_COUNT              64
+#define STORE_MAGIC                     0x474F4C45
+#define STORE_SECTOR_HEADER_BYTES       12
+#define STORE_ENTRY_HEADER_BYTES        4
+
+/* Largest record an entry can hold */
+#define STORE_MAX_RECORD_BYTES          ( STORE_SECTOR_BYTES - \
+                                          STORE_SECTOR_HEADER_BYTES - \
+                                          STORE_ENTRY_HEADER_BYTES )
+
+/* Flash is memory-mapped, so it is read in place. The host-side flash
+ * emulator (host/flash_emu.h) supplies its own mapping. */
+#ifndef STORE_FLASH_POINTER
+#define STORE_FLASH_POINTER( ulAddress ) \
+            ( ( const uint8_t * )( uintptr_t )( ulAddress ) )
+#endif
+
+
+/* Order in which sectors are drained */
+typedef enum {
+    STORE_DRAIN_OLDEST = 0,
+    STORE_DRAIN_NEWEST = 1
+} StoreDrainOrder_t;
+
+/* Where a record seen by a scan is, so it can be found again later (see
+ * pucStoreScanMarked()) */
+typedef struct {
+    uint32_t ulSector;
+    uint32_t ulSeq;
+    uint32_t ulOffset;
+} StoreScanMark_t;
+
+/* Totals since startup */
+typedef struct {
+    uint32_t ulAppendedBytes;
+    uint32_t ulDrainedBytes;
+    uint32_t ulLostSectors;
+    uint32_t ulErases;
+    uint32_t ulErrors;
+} StoreStats_t;
+
+
+void vStoreInit(void);
+bool bStoreAppend(const uint8_t *pucRecord, uint32_t ulLength,
+                  const uint8_t *pucPrefix, uint32_t ulPrefixLength);
+const uint8_t *pucStorePeek(uint32_t *pulLength);
+void vStoreConsume(void);
+void vStoreScanStart(void);
+const uint8_t *pucStoreScanPeek(uint32_t *pulLength);
+void vStoreScanConsume(void);
+void vStoreScanMark(StoreScanMark_t *pxMark);
+const uint8_t *pucStoreScanMarked(const StoreScanMark_t *pxMark,
+                                  uint32_t *pulLength);
+void vStoreSetDrainOrder(StoreDrainOrder_t eOrder);
+void vStoreGetStats(StoreStats_t *pxStats);
+
+
+#endif /* STORE_H_ */
@@ -0,0 +1,594 @@
+/*
+ * store_task.c
+ * FreeRTOS task that turns sampled data into uplink records (frames, CAN
+ * events and the schema) and routes them. While the TCP connection is up and
+ * keeping pace, records go straight to the uplink queue read by the Modem
+ * UART task. Otherwise they are appended to the flash log (store.c), which
+ * is drained back into the queue once the connection can take more than the
+ * live records. The Modem UART task also logs records the server never
+ * acknowledged (see window.h).
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "budget.h"
+#include "debug_helper.h"
+#include "frame.h"
+#include "hibernate_rtc.h"
+#include "modem_uart_task.h"
+#include "priorities.h"
+#include "profile.h"
+#include "ring_buffer.h"
+#include "sample.h"
+#include "schema.h"
+#include "sink.h"
+#include "stack_sizes.h"
+#include "store.h"
+#include "store_task.h"
+#include "uplink.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+
+TaskHandle_t xStoreTaskHandle;
+
+/* Required memory for the uplink queue */
+uint8_t pucUplinkBufferData[UPLINK_BUFFER_SIZE];
+
+/* Whole records waiting to be sent. Only this task writes to it, and only
+ * the Modem UART task reads from it. */
+volatile RingBuffer_t xUplinkBuffer = {
+                             .pucData = pucUplinkBufferData,
+                             .ulSize = UPLINK_BUFFER_SIZE,
+                             .ulReadIndex = 0,
+                             .ulWriteIndex = 0
+};
+
+/* Records that could neither be queued nor logged */
+static uint32_t ulDroppedRecords = 0;
+
+/* Flush policy (see store_task.h), set by a server command */
+static volatile uint16_t usFlushWatermark = UPLINK_FLUSH_WATERMARK_BYTES;
+static volatile uint16_t usFlushLatencyMS = UPLINK_FLUSH_LATENCY_MS;
+
+/* Bytes queued since the Modem UART task was last woken, when the first of
+ * them was queued, and whether any of them is urgent */
+static uint32_t ulUnflushedBytes = 0;
+static TickType_t xUnflushedTick;
+static bool bUnflushedUrgent = false;
+
+/* History query (see store_task.h), set by a server command. The Store
+ * task picks up a new one when bQueryRequested is set. */
+static volatile uint32_t ulQueryStartS;
+static volatile uint32_t ulQueryEndS;
+static volatile uint16_t usQueryRateHz;
+static volatile bool bQueryRequested = false;
+static bool bQueryActive = false;
+/* Where the latest schema record the query's scan has passed is, and
+ * whether it has been queued yet. It is found again through its sector's
+ * sequence number, since the sector may be overwritten between rounds. */
+static StoreScanMark_t xQuerySchema;
+static bool bQuerySchemaSeen = false;
+static bool bQuerySchemaQueued = false;
+/* Records and bytes queued in answer to history queries */
+static uint32_t ulQueryRecords = 0;
+static uint32_t ulQueryBytes = 0;
+
+/* Guards the flash log, which both this task and the Modem UART task write */
+static SemaphoreHandle_t xStoreMutex;
+
+
+/*
+ * Returns true if the Modem UART task is sending records from the queue.
+ * Once the day's data budget is used up, records are treated as if the link
+ * were down: logged, and drained the next day.
+ */
+static bool StoreTaskLinkUp(void) {
+    return !bBudgetExhausted() && xModemStatus.knownState &&
+           xModemStatus.networkOpen && xModemStatus.tcpConnectionOpen &&
+           xModemStatus.tcpConnectionMode;
+}
+
+/*
+ * Adds a whole record of stream ucStream (see uplink.h) to the uplink queue
+ * if it fits in the queue below ulLimit bytes. The scheduler is suspended so
+ * the Modem UART task never sees part of a record. Returns true if the
+ * record was queued.
+ */
+static bool StoreTaskQueue(const uint8_t *pucRecord, uint32_t ulLength,
+                           uint32_t ulLimit, uint8_t ucStream) {
+    uint8_t pucHeader[UPLINK_QUEUE_HEADER_BYTES];
+    TickType_t xNow;
+    uint32_t ulUsed;
+    bool bQueued;
+
+    vTaskSuspendAll();
+    ulUsed = UPLINK_BUFFER_SIZE - 1 - ulRingBufferFree(&xUplinkBuffer);
+    bQueued = (ulUsed + UPLINK_QUEUE_HEADER_BYTES + ulLength <= ulLimit);
+    if (bQueued) {
+        xNow = xTaskGetTickCount();
+        pucHeader[0] = ucStream;
+        memcpy(pucHeader + 1, &xNow, 4);
+        eRingBufferWriteN(&xUplinkBuffer, pucHeader,
+                          UPLINK_QUEUE_HEADER_BYTES);
+        eRingBufferWriteN(&xUplinkBuffer, (uint8_t *)pucRecord, ulLength);
+    }
+    xTaskResumeAll();
+
+    if (bQueued) {
+        if (!ulUnflushedBytes) {
+            xUnflushedTick = xNow;
+        }
+        ulUnflushedBytes += UPLINK_QUEUE_HEADER_BYTES + ulLength;
+    }
+
+    return bQueued;
+}
+
+/*
+ * Appends a record to the flash log. Logged sectors start with the current
+ * schema, so they can be decoded however long they wait. Returns false if
+ * the record was dropped.
+ */
+bool bStoreTaskLog(const uint8_t *pucRecord, uint32_t ulLength) {
+    uint8_t *pucSchema;
+    uint32_t ulSchemaLength;
+    bool bLogged;
+
+    xSemaphoreTake(xStoreMutex, portMAX_DELAY);
+    ulSchemaLength = ulSchemaGetRecord(&pucSchema);
+    bLogged = bStoreAppend(pucRecord, ulLength, pucSchema, ulSchemaLength);
+    xSemaphoreGive(xStoreMutex);
+
+    if (!bLogged) {
+        ulDroppedRecords++;
+    }
+
+    return bLogged;
+}
+
+/*
+ * Takes the lock on the flash log, for other users of the flash controller
+ * (see budget.c).
+ */
+void vStoreTaskLockFlash(void) {
+    xSemaphoreTake(xStoreMutex, portMAX_DELAY);
+}
+
+/*
+ * Releases the lock taken by vStoreTaskLockFlash().
+ */
+void vStoreTaskUnlockFlash(void) {
+    xSemaphoreGive(xStoreMutex);
+}
+
+/*
+ * Sends a record of stream ucStream to the uplink queue, or to the flash log
+ * if the link is down or the queue is as full as the stream may make it.
+ * Queued event, schema and gap records are flushed without waiting.
+ */
+static void StoreTaskRoute(const uint8_t *pucRecord, uint32_t ulLength,
+                           uint8_t ucStream) {
+    uint16_t usRateField;
+
+    if (StoreTaskLinkUp()) {
+        if (StoreTaskQueue(pucRecord, ulLength,
+                           ulUplinkQueueLimit(ucStream, UPLINK_BUFFER_SIZE - 1),
+                           ucStream)) {
+            memcpy(&usRateField, pucRecord, 2);
+            usRateField &= SAMPLE_RATE_MASK;
+            if (usRateField == SAMPLE_EVENT_RATE ||
+                usRateField == SAMPLE_SCHEMA_RATE ||
+                usRateField == SAMPLE_GAP_RATE) {
+                bUnflushedUrgent = true;
+            }
+            return;
+        }
+
+        if (ucStream != UPLINK_STREAM_NONE) {
+            vUplinkNoteCongestion();
+        }
+    }
+
+    bStoreTaskLog(pucRecord, ulLength);
+}
+
+/*
+ * Routes the schema record (see schema.h) if it has been rebuilt.
+ */
+static void StoreTaskRouteSchema(void) {
+    uint8_t *pucSchema;
+    uint32_t ulLength;
+
+    ulLength = ulSchemaGetPending(&pucSchema);
+    if (ulLength) {
+        sink_write(pucSchema, ulLength);
+        StoreTaskRoute(pucSchema, ulLength, UPLINK_STREAM_NONE);
+    }
+}
+
+/*
+ * Returns true if a frame of the passed buffer starting at second ulS may go
+ * to the uplink. Only LOCAL_SINK builds hold frames back here, since only
+ * they leave sampling at full rates while archive mode or the budget calls
+ * for less (see sink.h).
+ */
+static bool StoreTaskLimitAdmit(uint32_t ulBufferIndex, uint32_t ulS) {
+#ifdef LOCAL_SINK
+    /* Start of the last frame of each buffer let through, in RTC seconds */
+    static uint32_t pulAdmittedS[SAMPLE_BUFFER_COUNT];
+    static bool pbAdmitted[SAMPLE_BUFFER_COUNT];
+    uint8_t ucLimit = ucProfileGetLimit();
+    uint32_t ulIntervalS;
+
+    if (ucLimit < BUDGET_LEVEL_RATES) {
+        return true;
+    }
+
+    ulIntervalS = (ucLimit >= BUDGET_LEVEL_COARSE) ? SINK_UPLINK_COARSE_S :
+                                                     SINK_UPLINK_RATES_S;
+    if (pbAdmitted[ulBufferIndex] &&
+        ulS - pulAdmittedS[ulBufferIndex] < ulIntervalS) {
+        return false;
+    }
+
+    pulAdmittedS[ulBufferIndex] = ulS;
+    pbAdmitted[ulBufferIndex] = true;
+#endif /* LOCAL_SINK */
+
+    return true;
+}
+
+/*
+ * Encodes the samples in one of the sample buffers as batched frames (see
+ * frame.c) and routes the completed ones. Frames are kept per buffer, so
+ * samples can stay in a frame across calls until it is complete. Frames the
+ * uplink scheduler decimates go straight to the flash log, and frames held
+ * back for the archive and budget limits in LOCAL_SINK builds only go to the
+ * sink.
+ */
+static void StoreTaskRouteFrames(uint32_t ulBufferIndex) {
+    /* Static to keep the frames off the task's stack */
+    static Frame_t pxFrames[SAMPLE_BUFFER_COUNT];
+    uint8_t *pucFrame;
+    uint32_t ulLength;
+    uint16_t usRateField;
+    uint32_t ulFrameS;
+    uint32_t ulNowS;
+    uint32_t ulNowSS;
+
+    HibernateRTCGetBoth(&ulNowS, &ulNowSS);
+
+    do {
+        ulLength = ulFrameEncode(&(pxFrames[ulBufferIndex]),
+                                 pxSampleRateBuffers[ulBufferIndex],
+                                 ulNowS, ulNowSS, &pucFrame);
+
+        /* A frame started during the call may have rebuilt the schema for a
+         * new layout, which must reach the server before any frame using
+         * it. */
+        StoreTaskRouteSchema();
+
+        if (ulLength) {
+            /* The local sink gets every frame, decimated or not. */
+            sink_write(pucFrame, ulLength);
+            memcpy(&usRateField, pucFrame, 2);
+            memcpy(&ulFrameS, pucFrame + 4, 4);
+
+            if ((usRateField & SAMPLE_RATE_MASK) == SAMPLE_GAP_RATE) {
+                StoreTaskRoute(pucFrame, ulLength, UPLINK_STREAM_NONE);
+            }
+            else if (!StoreTaskLimitAdmit(ulBufferIndex, ulFrameS)) {
+                /* Held back from the uplink; the sink has it. */
+            }
+            else if (bUplinkAdmit(ulBufferIndex, ulLength)) {
+                StoreTaskRoute(pucFrame, ulLength, ulBufferIndex);
+            }
+            else {
+                bStoreTaskLog(pucFrame, ulLength);
+            }
+        }
+    } while (ulLength);
+}
+
+/*
+ * Routes the records in the CAN event buffer, one whole record at a time.
+ */
+static void StoreTaskRouteEvents(void) {
+    /* Static to keep the record off the task's stack */
+    static uint8_t pucRecord[SAMPLE_EVENT_MAX_BYTES];
+    uint16_t usSize;
+
+    /* This is the only place the buffer is read from. Records are written
+     * whole within a critical section, so a header is never read without the
+     * rest of its record being available. */
+    while (eRingBufferReadN(&(xEventBuffer.xData), pucRecord,
+                            SAMPLE_METADATA_BYTES) != BUFFER_EMPTY) {
+        memcpy(&usSize, pucRecord + 2, 2);
+
+        /* A size that can't be right means the buffer is corrupt, and
+         * nothing after this point can be trusted. */
+        if (usSize < SAMPLE_METADATA_BYTES || usSize > SAMPLE_EVENT_MAX_BYTES) {
+            vRingBufferClear(&(xEventBuffer.xData));
+            debug_print("StoreTaskRouteEvents dropped a corrupt buffer\n");
+            break;
+        }
+
+        eRingBufferReadN(&(xEventBuffer.xData),
+                         pucRecord + SAMPLE_METADATA_BYTES,
+                         usSize - SAMPLE_METADATA_BYTES);
+        sink_write(pucRecord, usSize);
+        StoreTaskRoute(pucRecord, usSize, UPLINK_STREAM_NONE);
+    }
+}
+
+/*
+ * Returns true if a logged record belongs in the answer to the current
+ * query: a frame of the query's rate (any, if it is 0), a gap or an event,
+ * stamped within the query's range. A frame spans up to a second from its
+ * timestamp, so one starting the second before the range is included too.
+ */
+static bool StoreTaskQueryMatch(const uint8_t *pucRecord, uint32_t ulLength) {
+    uint16_t usRate;
+    uint32_t ulS;
+
+    if (ulLength < SAMPLE_METADATA_BYTES) {
+        return false;
+    }
+
+    memcpy(&usRate, pucRecord, 2);
+    usRate &= SAMPLE_RATE_MASK;
+    memcpy(&ulS, pucRecord + 4, 4);
+
+    if (usRate == SAMPLE_SCHEMA_RATE || usRate == SAMPLE_LZ_RATE ||
+        ulS + 1 < ulQueryStartS || ulS > ulQueryEndS) {
+        return false;
+    }
+
+    return usRate == SAMPLE_GAP_RATE || usRate == SAMPLE_EVENT_RATE ||
+           !usQueryRateHz || usRate == usQueryRateHz;
+}
+
+/*
+ * Moves records matching the current history query from flash into the
+ * uplink queue, under the same limits as draining. Each sector's schema
+ * record is queued ahead of the first match after it, so the server can
+ * decode the answer whatever layout it was logged under. Returns the bytes
+ * queued.
+ */
+static uint32_t StoreTaskQuery(void) {
+    const uint8_t *pucRecord;
+    uint32_t ulLength;
+    const uint8_t *pucSchema;
+    uint32_t ulSchemaLength;
+    uint32_t ulQueuedBytes = 0;
+    uint16_t usRate;
+
+    if (bQueryRequested) {
+        bQueryRequested = false;
+        bQueryActive = true;
+        bQuerySchemaSeen = false;
+        bQuerySchemaQueued = false;
+        vStoreScanStart();
+    }
+
+    while (bQueryActive && ulQueuedBytes < STORE_DRAIN_ROUND_BYTES) {
+        pucRecord = pucStoreScanPeek(&ulLength);
+        if (!pucRecord) {
+            debug_print("history query done\n");
+            bQueryActive = false;
+            break;
+        }
+
+        memcpy(&usRate, pucRecord, 2);
+        if ((usRate & SAMPLE_RATE_MASK) == SAMPLE_SCHEMA_RATE) {
+            vStoreScanMark(&xQuerySchema);
+            bQuerySchemaSeen = true;
+            bQuerySchemaQueued = false;
+        }
+        else if (StoreTaskQueryMatch(pucRecord, ulLength)) {
+            if (bQuerySchemaSeen && !bQuerySchemaQueued) {
+                /* The schema's sector may have been overwritten since, in
+                 * which case there is no schema left to send. */
+                pucSchema = pucStoreScanMarked(&xQuerySchema,
+                                               &ulSchemaLength);
+                if (pucSchema) {
+                    if (!StoreTaskQueue(pucSchema, ulSchemaLength,
+                                        STORE_DRAIN_QUEUE_LIMIT,
+                                        UPLINK_STREAM_NONE)) {
+                        break;
+                    }
+                    ulQueuedBytes += ulSchemaLength;
+                }
+                bQuerySchemaQueued = true;
+            }
+
+            if (!StoreTaskQueue(pucRecord, ulLength, STORE_DRAIN_QUEUE_LIMIT,
+                                UPLINK_STREAM_NONE)) {
+                break;
+            }
+            ulQueuedBytes += ulLength;
+            ulQueryRecords++;
+            ulQueryBytes += ulLength;
+        }
+
+        vStoreScanConsume();
+    }
+
+    return ulQueuedBytes;
+}
+
+/*
+ * Starts a history query (see store_task.h), replacing any still running.
+ */
+void vStoreTaskQuery(uint32_t ulStartS, uint32_t ulEndS, uint16_t usRateHz) {
+    ulQueryStartS = ulStartS;
+    ulQueryEndS = ulEndS;
+    usQueryRateHz = usRateHz;
+    bQueryRequested = true;
+}
+
+/*
+ * Moves logged records into the uplink queue while the link is up. Drained
+ * records only fill the queue to STORE_DRAIN_QUEUE_LIMIT, and at most
+ * STORE_DRAIN_ROUND_BYTES are moved per round, so live records always have
+ * room and the backlog is sent at whatever rate the link has spare. A
+ * history query being answered takes its share of each round first.
+ */
+static void StoreTaskDrain(void) {
+    const uint8_t *pucRecord;
+    uint32_t ulLength;
+    uint32_t ulDrainedBytes = 0;
+
+    /* Nothing sent over UDP is sent again if lost (see modem_uart_task.h),
+     * so the log is kept for TCP. */
+    if (!StoreTaskLinkUp() || xModemStatus.linkUDP) {
+        return;
+    }
+
+    xSemaphoreTake(xStoreMutex, portMAX_DELAY);
+    ulDrainedBytes = StoreTaskQuery();
+    while (ulDrainedBytes < STORE_DRAIN_ROUND_BYTES &&
+           (pucRecord = pucStorePeek(&ulLength)) != NULL &&
+           StoreTaskQueue(pucRecord, ulLength, STORE_DRAIN_QUEUE_LIMIT,
+                          UPLINK_STREAM_NONE)) {
+        vStoreConsume();
+        ulDrainedBytes += ulLength;
+    }
+    xSemaphoreGive(xStoreMutex);
+}
+
+/*
+ * Wakes the Modem UART task if the flush policy says the queued records
+ * should go. Returns the ticks until they will be due by latency, or
+ * portMAX_DELAY if nothing is waiting.
+ */
+static TickType_t StoreTaskFlush(void) {
+    TickType_t xWaited;
+
+    if (!ulUnflushedBytes) {
+        return portMAX_DELAY;
+    }
+
+    xWaited = xTaskGetTickCount() - xUnflushedTick;
+
+    if (bUnflushedUrgent || ulUnflushedBytes >= usFlushWatermark ||
+        xWaited >= pdMS_TO_TICKS(usFlushLatencyMS)) {
+        xTaskNotify(xModemUARTTaskHandle, MODEM_NOTIFY_SAMPLE, eSetBits);
+        ulUnflushedBytes = 0;
+        bUnflushedUrgent = false;
+        return portMAX_DELAY;
+    }
+
+    return pdMS_TO_TICKS(usFlushLatencyMS) - xWaited;
+}
+
+/*
+ * Changes the flush policy (see store_task.h).
+ */
+void vStoreTaskSetFlush(uint16_t usWatermarkBytes, uint16_t usLatencyMS) {
+    usFlushWatermark = usWatermarkBytes;
+    usFlushLatencyMS = usLatencyMS;
+}
+
+/*
+ * Prints the flash log and history query totals.
+ */
+void vStoreTaskPrintStats(void) {
+    StoreStats_t xStats;
+
+    vStoreGetStats(&xStats);
+    debug_print("store: %d logged, %d drained, %d sectors lost, %d erases, "
+                "%d errors, %d dropped\n", xStats.ulAppendedBytes,
+                xStats.ulDrainedBytes, xStats.ulLostSectors, xStats.ulErases,
+                xStats.ulErrors, ulDroppedRecords);
+    debug_print("history queries: %d records, %d bytes\n", ulQueryRecords,
+                ulQueryBytes);
+}
+
+/*
+ * The Store task runs once per sampling interrupt. It routes everything the
+ * interrupt produced and drains some of the flash log if the link has room.
+ * The Modem UART task is then notified if the flush policy says the queue
+ * should go, and otherwise the Store task wakes again when it will be due by
+ * latency, even if sampling stops.
+ */
+static void StoreTask(void *pvParameters) {
+    /* Task notification value */
+    uint32_t ulNotificationValue = 0;
+    /* How long to wait for the next sampling round */
+    TickType_t xWait = portMAX_DELAY;
+    /* Sample buffers in the uplink scheduler's priority order */
+    uint8_t pucOrder[UPLINK_STREAM_COUNT];
+    uint32_t i;
+
+    while (1) {
+
+        if (xTaskNotifyWait(STORE_NOTIFY_NONE, STORE_NOTIFY_ALL,
+                            &ulNotificationValue, xWait) == pdTRUE &&
+            (ulNotificationValue & STORE_NOTIFY_SAMPLE)) {
+
+            StoreTaskRouteSchema();
+
+            /* Because writes to sample buffers occur in a critical section,
+             * buffers are guaranteed to contain only complete sample chunks
+             * at all times. Some buffers may be empty, and most calls only
+             * add samples to an open frame. Higher priority streams go
+             * first, so they reach the queue ahead of the others. */
+            vUplinkUpdate();
+            vUplinkGetOrder(pucOrder);
+            for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+                StoreTaskRouteFrames(pucOrder[i]);
+            }
+
+            /* CAN event records (only present in CAN event mode). */
+            StoreTaskRouteEvents();
+
+            StoreTaskDrain();
+        }
+
+        xWait = StoreTaskFlush();
+    }
+}
+
+/*
+ * Initializes the Store task by recovering the flash log and creating the
+ * task from its function.
+ */
+uint32_t StoreTaskInit(void) {
+
+    vStoreInit();
+
+    xStoreMutex = xSemaphoreCreateMutex();
+    if (xStoreMutex == NULL) {
+        return 1;
+    }
+
+    if(xTaskCreate(StoreTask, (const portCHAR *)"Store", STORETASKSTACKSIZE,
+                   NULL, tskIDLE_PRIORITY + PRIORITY_STORE_TASK,
+                   &xStoreTaskHandle) != pdTRUE) {
+        return 1;
+    }
+
+    return 0;
+}
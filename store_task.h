@@ -0,0 +1,87 @@
+/*
+ * store_task.h
+ * Header for the Store task, which encodes sample frames and routes every
+ * uplink record to the TCP connection or, while it is down, to flash.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STORE_TASK_H_
+#define STORE_TASK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame.h"
+#include "ring_buffer.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define STORE_NOTIFY_NONE               0x00000000
+#define STORE_NOTIFY_SAMPLE             0x00000001
+#define STORE_NOTIFY_ALL                0xffffffff
+
+/* Size of the queue of whole records waiting for the Modem UART task */
+#define UPLINK_BUFFER_SIZE              1024
+
+/* Each record in the queue follows a header giving the stream it belongs to
+ * (see uplink.h) and the tick it was queued at, from which the Modem UART
+ * task finds how long it waited. The header isn't sent. */
+#define UPLINK_QUEUE_HEADER_BYTES       5
+
+/* Largest record in the queue. Schema and event records are smaller than
+ * the largest frame. */
+#define UPLINK_MAX_RECORD_BYTES         FRAME_MAX_BYTES
+
+/* Drained records only fill the uplink queue to this level, leaving the
+ * rest for live records. The largest record must fit below it with its
+ * header, or a logged record that size could never be drained. */
+#define STORE_DRAIN_QUEUE_LIMIT         ( UPLINK_MAX_RECORD_BYTES + \
+                                          UPLINK_QUEUE_HEADER_BYTES )
+
+/* The Modem UART task is only woken once this many bytes are queued, once
+ * the oldest queued record has waited UPLINK_FLUSH_LATENCY_MS, or as soon as
+ * an urgent record (an event, schema or gap record) is queued. Fewer, larger
+ * writes save context switches and let the modem fill its TCP segments. The
+ * server can change both with "YYYf<watermark bytes>,<latency ms>". A
+ * watermark of 0 wakes the task every sampling round. */
+#define UPLINK_FLUSH_WATERMARK_BYTES    512
+#define UPLINK_FLUSH_LATENCY_MS         500
+
+/* Most bytes drained from flash per sampling round */
+#define STORE_DRAIN_ROUND_BYTES         256
+
+/* The server can ask for the records of a time range again with
+ * "YYYh<start s>,<end s>,<rate Hz>", in RTC seconds as in sample timestamps.
+ * Every frame of that rate (or of any rate, for 0), gap and event record
+ * still in the flash log for the range is sent again, drained or not, ahead
+ * of the log's own backlog but under the same limits, so live records keep
+ * priority. Only records that went to the log can be answered: frames sent
+ * live and samples held back by deadbands were never kept. */
+
+extern TaskHandle_t xStoreTaskHandle;
+extern volatile RingBuffer_t xUplinkBuffer;
+
+void vStoreTaskLockFlash(void);
+void vStoreTaskUnlockFlash(void);
+bool bStoreTaskLog(const uint8_t *pucRecord, uint32_t ulLength);
+void vStoreTaskQuery(uint32_t ulStartS, uint32_t ulEndS, uint16_t usRateHz);
+void vStoreTaskSetFlush(uint16_t usWatermarkBytes, uint16_t usLatencyMS);
+void vStoreTaskPrintStats(void);
+uint32_t StoreTaskInit(void);
+
+#endif /* STORE_TASK_H_ */
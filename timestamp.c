@@ -0,0 +1,170 @@
+/*
+ * timestamp.c
+ * Setup and RTC alignment for the 64-bit timestamp service.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "inc/hw_hibernate.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_timer.h"
+#include "inc/hw_types.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/timer.h"
+#include "timestamp.h"
+
+
+/* Subsecond counts per second of the RTC (32768Hz clock) */
+#define RTC_SS_PER_S                    32768
+
+
+volatile uint64_t ullTimestampOffset = 0;
+volatile uint32_t ulTimestampSeq = 0;
+
+/* Counter value and RTC time of the match used by the last rebase. These are
+ * only used from the sampling ISR, which is the only caller of
+ * vTimestampRebase(). */
+static bool bEdgeValid = false;
+static uint64_t ullEdgeCounter;
+static uint32_t ulEdgeS;
+static uint32_t ulEdgeSS;
+/* Counter ticks per RTC second, measured between consecutive rebases */
+static uint32_t ulTicksPerRTCSecond = TIMESTAMP_TICKS_PER_S;
+
+
+/*
+ * Starts Wide Timer 0 as a 64-bit up-counter at the system clock. This must be
+ * called before any caller of ullTimestampNow() can run.
+ */
+void vTimestampInit(void) {
+
+    /* Enable clocking for Wide Timer 0. */
+    SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER0);
+
+    /* Wait for Wide Timer 0 to become ready. */
+    while (!SysCtlPeripheralReady(SYSCTL_PERIPH_WTIMER0)) {
+    }
+
+    /* Concatenate both halves into one 64-bit counter counting up, which will
+     * not wrap for thousands of years at 80MHz. */
+    TimerConfigure(WTIMER0_BASE, TIMER_CFG_PERIODIC_UP);
+    TimerLoadSet64(WTIMER0_BASE, UINT64_MAX);
+
+    /* Begin counting. */
+    TimerEnable(WTIMER0_BASE, TIMER_A);
+}
+
+/*
+ * Realigns timestamps with the RTC. The sampling ISR calls this once per
+ * second, on its whole-second match, with the counter it read on entry and
+ * the match time. The system clock's error relative to the RTC can then only
+ * build up for about a second (tens of microseconds at most) before it is
+ * corrected. A clock step is picked up the same way. The spacing of
+ * consecutive rebases also gives the rate of the system clock relative to
+ * the RTC, used by bTimestampSinceRTC().
+ *
+ * The entry counter is later than the match by the ISR's entry latency, so
+ * the new offset carries that latency as an error. A match whose latency
+ * (projected from the last rebase) is more than
+ * TIMESTAMP_REBASE_MAX_LATENCY_TICKS is skipped, unless the last rebase is
+ * too old to project from, so a delayed interrupt doesn't skew timestamps.
+ *
+ * Nothing is masked. Every reader of the offset runs at a lower priority than
+ * the sampling ISR, so it can't interrupt the update, and readers that are
+ * interrupted by it read again (see ullTimestampNow()).
+ */
+void vTimestampRebase(uint64_t ullCounter, uint32_t ulS, uint32_t ulSS) {
+    uint32_t ulElapsedSS;
+    uint32_t ulLatencyTicks;
+    uint64_t ullRTCTicks;
+
+    if (bTimestampSinceRTC(ullCounter, ulS, ulSS, &ulLatencyTicks) &&
+        ulLatencyTicks > TIMESTAMP_REBASE_MAX_LATENCY_TICKS) {
+        return;
+    }
+
+    ullRTCTicks = (uint64_t)ulS * TIMESTAMP_TICKS_PER_S +
+                  (((uint64_t)ulSS * TIMESTAMP_TICKS_PER_S) / RTC_SS_PER_S);
+
+    ulTimestampSeq++;
+    ullTimestampOffset = ullRTCTicks - ullCounter;
+    ulTimestampSeq++;
+
+    /* Only rebases about a second apart are used for the rate, which rules
+     * out any spanning a clock step. */
+    if (bEdgeValid && ulS - ulEdgeS <= 2) {
+        ulElapsedSS = (ulS - ulEdgeS) * RTC_SS_PER_S + ulSS - ulEdgeSS;
+        if (ulElapsedSS > RTC_SS_PER_S / 2 &&
+            ulElapsedSS < 2 * RTC_SS_PER_S + RTC_SS_PER_S / 2) {
+            ulTicksPerRTCSecond = ((ullCounter - ullEdgeCounter) *
+                                   RTC_SS_PER_S) / ulElapsedSS;
+        }
+    }
+
+    bEdgeValid = true;
+    ullEdgeCounter = ullCounter;
+    ulEdgeS = ulS;
+    ulEdgeSS = ulSS;
+}
+
+/*
+ * Converts a timestamp to RTC seconds and subseconds, as used in sample and
+ * event records.
+ */
+void vTimestampToRTC(uint64_t ullTimestamp, uint32_t *pulS, uint32_t *pulSS) {
+    *pulS = ullTimestamp / TIMESTAMP_TICKS_PER_S;
+    *pulSS = ((ullTimestamp % TIMESTAMP_TICKS_PER_S) * RTC_SS_PER_S) /
+             TIMESTAMP_TICKS_PER_S;
+}
+
+/*
+ * Gives the number of counter ticks (see ullTimestampCounter()) from the RTC
+ * time ulS/ulSS until the counter read ullCounter. The RTC time is projected
+ * from the last rebase at the measured rate, so this is exact to within a
+ * few cycles rather than to a subsecond, measured from the (normally
+ * minimal) entry latency of the match that rebase used. Returns false if the
+ * RTC time isn't within two seconds after the last rebase. Only for use from
+ * the sampling ISR.
+ */
+bool bTimestampSinceRTC(uint64_t ullCounter, uint32_t ulS, uint32_t ulSS,
+                        uint32_t *pulTicks) {
+    int64_t llElapsedSS;
+    uint64_t ullExpected;
+
+    if (!bEdgeValid) {
+        return false;
+    }
+
+    llElapsedSS = (int64_t)(int32_t)(ulS - ulEdgeS) * RTC_SS_PER_S +
+                  (int32_t)ulSS - (int32_t)ulEdgeSS;
+    if (llElapsedSS < 0 || llElapsedSS > 2 * RTC_SS_PER_S) {
+        return false;
+    }
+
+    ullExpected = ullEdgeCounter +
+                  ((uint64_t)llElapsedSS * ulTicksPerRTCSecond) / RTC_SS_PER_S;
+
+    /* The read can only precede the RTC time by rounding error. */
+    *pulTicks = (ullCounter > ullExpected) ?
+                (uint32_t)(ullCounter - ullExpected) : 0;
+
+    return true;
+}
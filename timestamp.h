@@ -0,0 +1,93 @@
+/*
+ * timestamp.h
+ * A 64-bit timestamp service that can be read from any task or ISR without
+ * disabling interrupts.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMESTAMP_H_
+#define TIMESTAMP_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_timer.h"
+#include "inc/hw_types.h"
+
+
+/* Timestamps count system clock cycles (80MHz) since the Unix epoch */
+#define TIMESTAMP_TICKS_PER_S           80000000
+
+/* Most latency (10us) the sampling ISR may have on a whole-second match for
+ * that match to be used by vTimestampRebase() */
+#define TIMESTAMP_REBASE_MAX_LATENCY_TICKS  ( TIMESTAMP_TICKS_PER_S / 100000 )
+
+
+/* Offset from the free-running counter to Unix time, and a sequence count
+ * that is odd while the offset is being updated. Only for use by
+ * ullTimestampNow(). */
+extern volatile uint64_t ullTimestampOffset;
+extern volatile uint32_t ulTimestampSeq;
+
+
+/*
+ * Returns the raw value of Wide Timer 0, a free-running 64-bit counter at the
+ * system clock. The halves are re-read if the upper half changed in between.
+ */
+static inline uint64_t ullTimestampCounter(void) {
+    uint32_t ulHigh;
+    uint32_t ulLow;
+
+    do {
+        ulHigh = HWREG(WTIMER0_BASE + TIMER_O_TBV);
+        ulLow = HWREG(WTIMER0_BASE + TIMER_O_TAV);
+    } while (ulHigh != HWREG(WTIMER0_BASE + TIMER_O_TBV));
+
+    return ((uint64_t)ulHigh << 32) | ulLow;
+}
+
+/*
+ * Returns the current time in system clock cycles since the Unix epoch. The
+ * offset from the counter to Unix time is rebased on the RTC once per second.
+ * Nothing is masked: the offset is re-read if it was updated while it was
+ * being read. Until the RTC is first set, this is the time since startup.
+ */
+static inline uint64_t ullTimestampNow(void) {
+    uint32_t ulSeq;
+    uint64_t ullCounter;
+    uint64_t ullOffset;
+
+    do {
+        ulSeq = ulTimestampSeq;
+        ullOffset = ullTimestampOffset;
+        ullCounter = ullTimestampCounter();
+    } while ((ulSeq & 1) || ulSeq != ulTimestampSeq);
+
+    return ullCounter + ullOffset;
+}
+
+void vTimestampInit(void);
+void vTimestampRebase(uint64_t ullCounter, uint32_t ulS, uint32_t ulSS);
+void vTimestampToRTC(uint64_t ullTimestamp, uint32_t *pulS, uint32_t *pulSS);
+bool bTimestampSinceRTC(uint64_t ullCounter, uint32_t ulS, uint32_t ulSS,
+                        uint32_t *pulTicks);
+
+
+#endif /* TIMESTAMP_H_ */
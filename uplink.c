@@ -0,0 +1,293 @@
+/*
+ * uplink.c
+ * The uplink scheduler (see uplink.h). The Store task asks it which frames
+ * to queue and in what order, and the Modem UART task asks it whether each
+ * queued frame is still fresh enough to send. Throughput is measured as the
+ * record bytes the Modem UART task sends per period, before compression.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "debug_helper.h"
+#include "sample.h"
+#include "uplink.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+typedef struct {
+    uint8_t ucPriority;
+    uint16_t usDeadlineMS;
+    /* Every ucDecimation-th frame is sent live. ucSkipped counts the frames
+     * logged since the last one. */
+    uint8_t ucDecimation;
+    uint8_t ucSkipped;
+    /* Frame bytes produced this period, before decimation */
+    uint32_t ulOfferedBytes;
+    uint32_t ulSentFrames;
+    uint32_t ulDecimatedFrames;
+    uint32_t ulLateFrames;
+    uint64_t ullLatencySumMS;
+    uint32_t ulLatencyMaxMS;
+} UplinkStream_t;
+
+
+/* In the order of pxSampleRateBuffers (1 Hz, 10 Hz, 100 Hz). The 10 Hz
+ * stream is what viewers watch, and the 100 Hz stream carries most of the
+ * bytes, so it is decimated first. */
+static UplinkStream_t pxStreams[UPLINK_STREAM_COUNT] = {
+    { .ucPriority = 1, .usDeadlineMS = 5000, .ucDecimation = 1 },
+    { .ucPriority = 0, .usDeadlineMS = 2000, .ucDecimation = 1 },
+    { .ucPriority = 2, .usDeadlineMS = 2000, .ucDecimation = 1 }
+};
+
+/* Record bytes sent since startup, written only by the Modem UART task */
+static volatile uint32_t ulSentBytes = 0;
+
+/* Start of the current period, and ulSentBytes at that point */
+static TickType_t xPeriodStart = 0;
+static uint32_t ulPeriodSentBytes = 0;
+
+/* Set when a live frame found the queue full or missed its deadline this
+ * period, which means the link isn't keeping up */
+static volatile bool bCongested = false;
+
+
+/*
+ * Fills pucOrder with the UPLINK_STREAM_COUNT stream indexes, highest
+ * priority first. Streams of equal priority keep their buffer order.
+ */
+void vUplinkGetOrder(uint8_t *pucOrder) {
+    uint32_t i;
+    uint32_t j;
+    uint8_t ucStream;
+
+    for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+        ucStream = i;
+        for (j = i; j > 0 && pxStreams[pucOrder[j - 1]].ucPriority >
+                             pxStreams[ucStream].ucPriority; j--) {
+            pucOrder[j] = pucOrder[j - 1];
+        }
+        pucOrder[j] = ucStream;
+    }
+}
+
+/*
+ * Returns how full a stream's live frames may make a queue of ulQueueBytes.
+ * Each priority level below the highest leaves UPLINK_PRIORITY_RESERVE_BYTES
+ * more for the streams above it.
+ */
+uint32_t ulUplinkQueueLimit(uint8_t ucStream, uint32_t ulQueueBytes) {
+
+    if (ucStream >= UPLINK_STREAM_COUNT) {
+        return ulQueueBytes;
+    }
+
+    return ulQueueBytes -
+           pxStreams[ucStream].ucPriority * UPLINK_PRIORITY_RESERVE_BYTES;
+}
+
+/*
+ * Counts a finished frame of ulLength bytes towards its stream's load.
+ * Returns true if it should be sent live, or false if decimation means it
+ * should go to the flash log.
+ */
+bool bUplinkAdmit(uint8_t ucStream, uint32_t ulLength) {
+    UplinkStream_t *pxStream = &(pxStreams[ucStream]);
+
+    pxStream->ulOfferedBytes += ulLength;
+
+    if (++(pxStream->ucSkipped) >= pxStream->ucDecimation) {
+        pxStream->ucSkipped = 0;
+        return true;
+    }
+
+    pxStream->ulDecimatedFrames++;
+    return false;
+}
+
+/*
+ * Notes that a live frame found no room in the uplink queue.
+ */
+void vUplinkNoteCongestion(void) {
+    bCongested = true;
+}
+
+/*
+ * Called as a frame queued at xQueuedTick is taken from the queue. Returns
+ * true if it should be sent, or false if it has missed its deadline and
+ * should be logged instead. Records of no stream are always sent.
+ */
+bool bUplinkSendLive(uint8_t ucStream, TickType_t xQueuedTick) {
+    UplinkStream_t *pxStream;
+    uint32_t ulLatencyMS;
+
+    if (ucStream >= UPLINK_STREAM_COUNT) {
+        return true;
+    }
+
+    pxStream = &(pxStreams[ucStream]);
+    /* Ticks are milliseconds (see FreeRTOSConfig.h). */
+    ulLatencyMS = xTaskGetTickCount() - xQueuedTick;
+
+    if (ulLatencyMS > pxStream->usDeadlineMS) {
+        pxStream->ulLateFrames++;
+        bCongested = true;
+        return false;
+    }
+
+    pxStream->ulSentFrames++;
+    pxStream->ullLatencySumMS += ulLatencyMS;
+    if (ulLatencyMS > pxStream->ulLatencyMaxMS) {
+        pxStream->ulLatencyMaxMS = ulLatencyMS;
+    }
+
+    return true;
+}
+
+/*
+ * Counts record bytes sent on the TCP stream.
+ */
+void vUplinkNoteSent(uint32_t ulLength) {
+    ulSentBytes += ulLength;
+}
+
+/*
+ * Revises decimation once per UPLINK_PERIOD_MS. If the link fell behind
+ * during the period, what it managed to send is given to the streams in
+ * priority order, and each stream that doesn't fit in what's left is
+ * decimated enough that it would. Otherwise decimation is halved, so
+ * streams recover as soon as the link allows.
+ */
+void vUplinkUpdate(void) {
+    TickType_t xNow = xTaskGetTickCount();
+    uint8_t pucOrder[UPLINK_STREAM_COUNT];
+    UplinkStream_t *pxStream;
+    uint32_t ulBudget;
+    uint32_t ulDecimation;
+    uint32_t i;
+
+    if (xNow - xPeriodStart < pdMS_TO_TICKS(UPLINK_PERIOD_MS)) {
+        return;
+    }
+
+    ulBudget = ulSentBytes - ulPeriodSentBytes;
+    vUplinkGetOrder(pucOrder);
+
+    for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+        pxStream = &(pxStreams[pucOrder[i]]);
+
+        if (!bCongested || pxStream->ulOfferedBytes <= ulBudget) {
+            ulDecimation = (pxStream->ucDecimation + 1) / 2;
+        }
+        else if (ulBudget) {
+            ulDecimation = (pxStream->ulOfferedBytes + ulBudget - 1) /
+                           ulBudget;
+        }
+        else {
+            ulDecimation = UPLINK_MAX_DECIMATION;
+        }
+
+        if (ulDecimation > UPLINK_MAX_DECIMATION) {
+            ulDecimation = UPLINK_MAX_DECIMATION;
+        }
+
+        /* Whatever this stream will send live comes out of the budget. */
+        if (ulBudget > pxStream->ulOfferedBytes / ulDecimation) {
+            ulBudget -= pxStream->ulOfferedBytes / ulDecimation;
+        }
+        else {
+            ulBudget = 0;
+        }
+
+        if (ulDecimation != pxStream->ucDecimation) {
+            debug_print("uplink %dHz now 1 in %d\n",
+                        pxSampleRateBuffers[pucOrder[i]]->usSampleRateHz,
+                        ulDecimation);
+        }
+
+        pxStream->ucDecimation = ulDecimation;
+        pxStream->ulOfferedBytes = 0;
+    }
+
+    xPeriodStart = xNow;
+    ulPeriodSentBytes = ulSentBytes;
+    bCongested = false;
+}
+
+/*
+ * Sets the priority and deadline of the stream with the given rate. Returns
+ * false if there is no such stream.
+ */
+bool bUplinkSetStream(uint16_t usRateHz, uint8_t ucPriority,
+                      uint16_t usDeadlineMS) {
+    uint32_t i;
+
+    if (ucPriority >= UPLINK_PRIORITY_LEVELS) {
+        ucPriority = UPLINK_PRIORITY_LEVELS - 1;
+    }
+
+    for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+        if (pxSampleRateBuffers[i]->usSampleRateHz == usRateHz) {
+            pxStreams[i].ucPriority = ucPriority;
+            pxStreams[i].usDeadlineMS = usDeadlineMS;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Copies out a stream's settings and totals.
+ */
+void vUplinkGetStats(uint8_t ucStream, UplinkStats_t *pxStats) {
+    UplinkStream_t *pxStream = &(pxStreams[ucStream]);
+
+    pxStats->ucPriority = pxStream->ucPriority;
+    pxStats->usDeadlineMS = pxStream->usDeadlineMS;
+    pxStats->ucDecimation = pxStream->ucDecimation;
+    pxStats->ulSentFrames = pxStream->ulSentFrames;
+    pxStats->ulDecimatedFrames = pxStream->ulDecimatedFrames;
+    pxStats->ulLateFrames = pxStream->ulLateFrames;
+    pxStats->ulLatencyAvgMS = pxStream->ulSentFrames ?
+        (uint32_t)(pxStream->ullLatencySumMS / pxStream->ulSentFrames) : 0;
+    pxStats->ulLatencyMaxMS = pxStream->ulLatencyMaxMS;
+}
+
+/*
+ * Prints each stream's settings, frame totals and queueing latency.
+ */
+void vUplinkPrintStats(void) {
+    UplinkStats_t xStats;
+    uint32_t i;
+
+    for (i = 0; i < UPLINK_STREAM_COUNT; i++) {
+        vUplinkGetStats(i, &xStats);
+        debug_print("uplink %dHz: priority %d, 1 in %d, %d sent, %d "
+                    "decimated, %d late, latency %d avg %d max ms\n",
+                    pxSampleRateBuffers[i]->usSampleRateHz,
+                    xStats.ucPriority, xStats.ucDecimation,
+                    xStats.ulSentFrames, xStats.ulDecimatedFrames,
+                    xStats.ulLateFrames, xStats.ulLatencyAvgMS,
+                    xStats.ulLatencyMaxMS);
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * uplink.h
+ * Definitions for the uplink scheduler, which decides how the frames of
+ * each sample rate buffer share the TCP connection.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef UPLINK_H_
+#define UPLINK_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sample.h"
+#include "FreeRTOS.h"
+
+
+/* Each sample rate buffer is a stream with a priority (0 is the highest) and
+ * a deadline. Higher priority streams are routed first each round and may
+ * fill more of the uplink queue (see store_task.h). A live frame that waits
+ * in the queue longer than its stream's deadline is logged to flash instead
+ * of being sent late.
+ *
+ * When the link can't keep up, the measured throughput is shared out in
+ * priority order, and streams that don't fit are decimated: only every Nth
+ * frame is sent live and the rest are logged to flash, to be drained when
+ * the link has spare capacity. Decimation is eased off again while the link
+ * keeps up.
+ *
+ * The server can change a stream with "YYYp<rate Hz>,<priority>,<deadline
+ * ms>". */
+#define UPLINK_STREAM_COUNT             SAMPLE_BUFFER_COUNT
+#define UPLINK_PRIORITY_LEVELS          4
+/* Stream index for queued records that don't belong to a stream (drained,
+ * gap, event and schema records) */
+#define UPLINK_STREAM_NONE              0xFF
+
+/* Queue space kept back from each priority level below the highest */
+#define UPLINK_PRIORITY_RESERVE_BYTES   128
+
+/* How often throughput is measured and decimation revised */
+#define UPLINK_PERIOD_MS                5000
+/* Most frames a stream is decimated by */
+#define UPLINK_MAX_DECIMATION           16
+
+
+/* Per-stream totals since startup. Latency is the time live frames spend in
+ * the uplink queue. */
+typedef struct {
+    uint8_t ucPriority;
+    uint16_t usDeadlineMS;
+    uint8_t ucDecimation;
+    uint32_t ulSentFrames;
+    uint32_t ulDecimatedFrames;
+    uint32_t ulLateFrames;
+    uint32_t ulLatencyAvgMS;
+    uint32_t ulLatencyMaxMS;
+} UplinkStats_t;
+
+
+void vUplinkGetOrder(uint8_t *pucOrder);
+uint32_t ulUplinkQueueLimit(uint8_t ucStream, uint32_t ulQueueBytes);
+bool bUplinkAdmit(uint8_t ucStream, uint32_t ulLength);
+void vUplinkNoteCongestion(void);
+bool bUplinkSendLive(uint8_t ucStream, TickType_t xQueuedTick);
+void vUplinkNoteSent(uint32_t ulLength);
+void vUplinkUpdate(void);
+bool bUplinkSetStream(uint16_t usRateHz, uint8_t ucPriority,
+                      uint16_t usDeadlineMS);
+void vUplinkGetStats(uint8_t ucStream, UplinkStats_t *pxStats);
+void vUplinkPrintStats(void);
+
+
+#endif /* UPLINK_H_ */
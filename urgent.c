@@ -0,0 +1,194 @@
+/*
+ * urgent.c
+ * The urgent queue (see urgent.h). Any task may post a record, and only the
+ * Modem UART task takes them, so posting is done with interrupts masked and
+ * taking needs no lock.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "channel.h"
+#include "debug_helper.h"
+#include "hibernate_rtc.h"
+#include "modem_uart_task.h"
+#include "ring_buffer.h"
+#include "sample.h"
+#include "urgent.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+
+/* Required memory for the ring buffer */
+static uint8_t pucUrgentBufferData[URGENT_BUFFER_SIZE];
+
+/* Urgent records, each behind the tick it was posted at */
+static volatile RingBuffer_t xUrgentBuffer = {
+                             .pucData = pucUrgentBufferData,
+                             .ulSize = URGENT_BUFFER_SIZE,
+                             .ulReadIndex = 0,
+                             .ulWriteIndex = 0
+};
+
+/* Totals, and the sum of the latencies of the records sent */
+static uint32_t ulPosted = 0;
+static uint32_t ulDropped = 0;
+static uint32_t ulSent = 0;
+static uint32_t ulLate = 0;
+static uint64_t ullLatencySumMS = 0;
+static uint32_t ulLatencyMaxMS = 0;
+
+
+/*
+ * Posts the current value of a channel as an urgent record and wakes the
+ * Modem UART task to send it. Returns false if the queue had no room, in
+ * which case the value only reaches the server when it is next sampled.
+ */
+bool bUrgentPost(volatile Channel_t *pxCh) {
+    uint8_t pucRecord[URGENT_QUEUE_HEADER_BYTES + URGENT_MAX_RECORD_BYTES];
+    uint8_t *pucBody = pucRecord + URGENT_QUEUE_HEADER_BYTES;
+    uint16_t usRateField = SAMPLE_URGENT_RATE;
+    uint16_t usSize = SAMPLE_METADATA_BYTES + 1 + pxCh->ucByteCount;
+    TickType_t xNow = xTaskGetTickCount();
+    uint32_t ulS;
+    uint32_t ulSS;
+    bool bPosted;
+
+    HibernateRTCGetBoth(&ulS, &ulSS);
+
+    memcpy(pucRecord, &xNow, 4);
+    memcpy(pucBody, &usRateField, 2);
+    memcpy(pucBody + 2, &usSize, 2);
+    memcpy(pucBody + 4, &ulS, 4);
+    memcpy(pucBody + 8, &ulSS, 2);
+    pucBody[10] = ucChannelGetIndex(pxCh);
+
+    /* The value is copied with the record so a later change can't tear
+     * it. */
+    taskENTER_CRITICAL();
+    memcpy(pucBody + 11, (void *)pxCh->xData, pxCh->ucByteCount);
+    bPosted = (ulRingBufferFree(&xUrgentBuffer) >=
+               URGENT_QUEUE_HEADER_BYTES + usSize);
+    if (bPosted) {
+        eRingBufferWriteN(&xUrgentBuffer, pucRecord,
+                          URGENT_QUEUE_HEADER_BYTES + usSize);
+    }
+    else {
+        ulDropped++;
+    }
+    ulPosted++;
+    taskEXIT_CRITICAL();
+
+    if (!bPosted) {
+        return false;
+    }
+
+    if (xModemUARTTaskHandle) {
+        xTaskNotify(xModemUARTTaskHandle, MODEM_NOTIFY_SAMPLE, eSetBits);
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if an urgent record is waiting.
+ */
+bool bUrgentPending(void) {
+    return eRingBufferStatus(&xUrgentBuffer) != BUFFER_EMPTY;
+}
+
+/*
+ * Takes the oldest urgent record into pucRecord (which must hold
+ * URGENT_MAX_RECORD_BYTES) and the tick it was posted at into
+ * pxPostedTick. Returns its length, or 0 if there is none.
+ */
+uint32_t ulUrgentGetRecord(uint8_t *pucRecord, TickType_t *pxPostedTick) {
+    uint8_t pucHeader[URGENT_QUEUE_HEADER_BYTES];
+    uint16_t usSize;
+
+    if (eRingBufferReadN(&xUrgentBuffer, pucHeader,
+                         URGENT_QUEUE_HEADER_BYTES) == BUFFER_EMPTY) {
+        return 0;
+    }
+
+    eRingBufferReadN(&xUrgentBuffer, pucRecord, SAMPLE_METADATA_BYTES);
+    memcpy(&usSize, pucRecord + 2, 2);
+
+    /* A size that can't be right means the queue is corrupt, and nothing
+     * after this point can be trusted. */
+    if (usSize <= SAMPLE_METADATA_BYTES || usSize > URGENT_MAX_RECORD_BYTES) {
+        vRingBufferClear(&xUrgentBuffer);
+        debug_print("ulUrgentGetRecord dropped a corrupt queue\n");
+        return 0;
+    }
+
+    eRingBufferReadN(&xUrgentBuffer, pucRecord + SAMPLE_METADATA_BYTES,
+                     usSize - SAMPLE_METADATA_BYTES);
+    memcpy(pxPostedTick, pucHeader, 4);
+
+    return usSize;
+}
+
+/*
+ * Counts an urgent record posted at xPostedTick as written to the modem, and
+ * measures its wait against URGENT_TARGET_MS.
+ */
+void vUrgentNoteSent(TickType_t xPostedTick) {
+    /* Ticks are milliseconds (see FreeRTOSConfig.h). */
+    uint32_t ulLatencyMS = xTaskGetTickCount() - xPostedTick;
+
+    ulSent++;
+    ullLatencySumMS += ulLatencyMS;
+    if (ulLatencyMS > ulLatencyMaxMS) {
+        ulLatencyMaxMS = ulLatencyMS;
+    }
+    if (ulLatencyMS > URGENT_TARGET_MS) {
+        ulLate++;
+    }
+}
+
+/*
+ * Copies out the totals.
+ */
+void vUrgentGetStats(UrgentStats_t *pxStats) {
+    pxStats->ulPosted = ulPosted;
+    pxStats->ulDropped = ulDropped;
+    pxStats->ulSent = ulSent;
+    pxStats->ulLate = ulLate;
+    pxStats->ulLatencyAvgMS = ulSent ?
+        (uint32_t)(ullLatencySumMS / ulSent) : 0;
+    pxStats->ulLatencyMaxMS = ulLatencyMaxMS;
+}
+
+/*
+ * Prints the totals and how the latency compares with the target.
+ */
+void vUrgentPrintStats(void) {
+    UrgentStats_t xStats;
+
+    vUrgentGetStats(&xStats);
+    if (xStats.ulPosted) {
+        debug_print("urgent: %d posted, %d dropped, %d sent, latency %d avg "
+                    "%d max ms, %d over %d ms\n", xStats.ulPosted,
+                    xStats.ulDropped, xStats.ulSent, xStats.ulLatencyAvgMS,
+                    xStats.ulLatencyMaxMS, xStats.ulLate, URGENT_TARGET_MS);
+    }
+}
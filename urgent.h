@@ -0,0 +1,81 @@
+/*
+ * urgent.h
+ * Definitions for the urgent queue, which carries state changes (such as
+ * notification bits) to the server ahead of the sampled data.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef URGENT_H_
+#define URGENT_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "channel.h"
+#include "sample.h"
+#include "FreeRTOS.h"
+
+
+/* A state change is posted as an urgent record holding the channel's new
+ * value, which skips the sample buffers, frame batching, the uplink queue,
+ * the flush policy and compression. The Modem UART task sends urgent records
+ * before anything else, each in a packet of its own, and stops a long send
+ * between records to do so. They are kept in the upload window like any
+ * other record. The channel is still sampled as usual, so a record dropped
+ * because the queue is full (or lost over UDP) only loses the head start.
+ *
+ *   rate (2 bytes)        SAMPLE_URGENT_RATE
+ *   size (2 bytes)        total record length in bytes
+ *   timestamp (6 bytes)   RTC seconds and subseconds of the change
+ *   channel (1 byte)      the channel's ID (see schema.h)
+ *   value                 the channel's value, at its full width
+ *
+ * While connected, a record should be written to the modem within
+ * URGENT_TARGET_MS of being posted. Each record's wait is measured against
+ * this target. Records posted while the link is down wait for it, and count
+ * as late. */
+#define URGENT_TARGET_MS                100
+#define URGENT_MAX_RECORD_BYTES         ( SAMPLE_METADATA_BYTES + 1 + \
+                                          sizeof(uint32_t) )
+/* Bytes of the queue, which holds the tick each record was posted at ahead
+ * of the record */
+#define URGENT_BUFFER_SIZE              256
+#define URGENT_QUEUE_HEADER_BYTES       4
+
+
+/* Totals since startup */
+typedef struct {
+    uint32_t ulPosted;
+    uint32_t ulDropped;
+    uint32_t ulSent;
+    uint32_t ulLate;
+    uint32_t ulLatencyAvgMS;
+    uint32_t ulLatencyMaxMS;
+} UrgentStats_t;
+
+
+bool bUrgentPost(volatile Channel_t *pxCh);
+bool bUrgentPending(void);
+uint32_t ulUrgentGetRecord(uint8_t *pucRecord, TickType_t *pxPostedTick);
+void vUrgentNoteSent(TickType_t xPostedTick);
+void vUrgentGetStats(UrgentStats_t *pxStats);
+void vUrgentPrintStats(void);
+
+
+#endif /* URGENT_H_ */
@@ -0,0 +1,244 @@
+/*
+ * window.c
+ * The upload window (see window.h). Entries are kept back to back in one
+ * buffer, oldest first, so each record can be read in place. Space freed at
+ * the front is reclaimed by moving the remaining entries down when the end
+ * of the buffer is reached.
+ *
+ * Only the Modem UART task uses this module.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "window.h"
+
+
+/* Set in an entry's length field once the record has been acknowledged */
+#define WINDOW_FLAG_ACKED               0x8000
+
+
+/* Entries: first sequence (2 bytes), last sequence (2 bytes), length and
+ * flags (2 bytes), then the record. Live entries are in [ulHead, ulTail). */
+static uint8_t pucWindow[WINDOW_BYTES];
+static uint32_t ulHead = 0;
+static uint32_t ulTail = 0;
+
+/* The latest packet acknowledged on this connection. Unacknowledged records
+ * sent before it were missed by the server. */
+static bool bLatestKnown = false;
+static uint16_t usLatestAck;
+
+
+/*
+ * Returns the 16-bit field at ulOffset in the window.
+ */
+static uint16_t WindowGet16(uint32_t ulOffset) {
+    uint16_t usValue;
+
+    memcpy(&usValue, pucWindow + ulOffset, 2);
+
+    return usValue;
+}
+
+/*
+ * Returns true if usSeq is at or before usCumulative, allowing for the
+ * sequence number wrapping.
+ */
+static bool WindowCovered(uint16_t usSeq, uint16_t usCumulative) {
+    return (int16_t)(usCumulative - usSeq) >= 0;
+}
+
+/*
+ * Notes usSeq as acknowledged if it is later than any packet so far.
+ */
+static void WindowNoteLatest(uint16_t usSeq) {
+
+    if (!bLatestKnown || !WindowCovered(usSeq, usLatestAck)) {
+        usLatestAck = usSeq;
+        bLatestKnown = true;
+    }
+}
+
+/*
+ * Drops acknowledged entries from the front of the window.
+ */
+static void WindowRelease(void) {
+    while (ulHead < ulTail && (WindowGet16(ulHead + 4) & WINDOW_FLAG_ACKED)) {
+        ulHead += WINDOW_ENTRY_HEADER_BYTES +
+                  (WindowGet16(ulHead + 4) & ~WINDOW_FLAG_ACKED);
+    }
+
+    if (ulHead == ulTail) {
+        ulHead = 0;
+        ulTail = 0;
+    }
+}
+
+/*
+ * Adds a record that was just sent in the packets usFirstSeq to usLastSeq.
+ * Returns false if there isn't room, in which case the caller should make
+ * room with vWindowDrop() and try again.
+ */
+bool bWindowAdd(const uint8_t *pucRecord, uint32_t ulLength,
+                uint16_t usFirstSeq, uint16_t usLastSeq) {
+    uint32_t ulEntryBytes = WINDOW_ENTRY_HEADER_BYTES + ulLength;
+    uint16_t usLength = ulLength;
+
+    if (ulTail + ulEntryBytes > WINDOW_BYTES && ulHead) {
+        memmove(pucWindow, pucWindow + ulHead, ulTail - ulHead);
+        ulTail -= ulHead;
+        ulHead = 0;
+    }
+
+    if (ulTail + ulEntryBytes > WINDOW_BYTES) {
+        return false;
+    }
+
+    memcpy(pucWindow + ulTail, &usFirstSeq, 2);
+    memcpy(pucWindow + ulTail + 2, &usLastSeq, 2);
+    memcpy(pucWindow + ulTail + 4, &usLength, 2);
+    memcpy(pucWindow + ulTail + WINDOW_ENTRY_HEADER_BYTES, pucRecord,
+           ulLength);
+    ulTail += ulEntryBytes;
+
+    return true;
+}
+
+/*
+ * Returns a pointer to the oldest unacknowledged record, and its length in
+ * *pulLength, or NULL if there is none. The pointer is only valid until the
+ * window is next changed.
+ */
+const uint8_t *pucWindowPeek(uint32_t *pulLength) {
+
+    WindowRelease();
+
+    if (ulHead == ulTail) {
+        return NULL;
+    }
+
+    *pulLength = WindowGet16(ulHead + 4);
+
+    return pucWindow + ulHead + WINDOW_ENTRY_HEADER_BYTES;
+}
+
+/*
+ * Removes the record last returned by pucWindowPeek(), acknowledged or not.
+ */
+void vWindowDrop(void) {
+
+    if (ulHead < ulTail) {
+        ulHead += WINDOW_ENTRY_HEADER_BYTES +
+                  (WindowGet16(ulHead + 4) & ~WINDOW_FLAG_ACKED);
+    }
+
+    WindowRelease();
+}
+
+/*
+ * Applies an acknowledgement from the server (see window.h).
+ */
+void vWindowAck(uint16_t usCumulative, const uint16_t *pusSelective,
+                uint32_t ulSelectiveCount) {
+    uint32_t ulPos = ulHead;
+    uint16_t usFirstSeq;
+    uint16_t usLastSeq;
+    uint16_t usLength;
+    uint32_t i;
+
+    WindowNoteLatest(usCumulative);
+    for (i = 0; i < ulSelectiveCount; i++) {
+        WindowNoteLatest(pusSelective[i]);
+    }
+
+    while (ulPos < ulTail) {
+        usFirstSeq = WindowGet16(ulPos);
+        usLastSeq = WindowGet16(ulPos + 2);
+        usLength = WindowGet16(ulPos + 4);
+
+        if (WindowCovered(usLastSeq, usCumulative)) {
+            usLength |= WINDOW_FLAG_ACKED;
+        }
+        else if (usFirstSeq == usLastSeq) {
+            for (i = 0; i < ulSelectiveCount; i++) {
+                if (pusSelective[i] == usLastSeq) {
+                    usLength |= WINDOW_FLAG_ACKED;
+                }
+            }
+        }
+
+        memcpy(pucWindow + ulPos + 4, &usLength, 2);
+        ulPos += WINDOW_ENTRY_HEADER_BYTES + (usLength & ~WINDOW_FLAG_ACKED);
+    }
+
+    WindowRelease();
+}
+
+/*
+ * Returns true if the oldest unacknowledged record was sent before a packet
+ * the server has since acknowledged. TCP delivers in order, so the server
+ * will never have it from this connection, and it can be sent again
+ * straight away.
+ */
+bool bWindowMissed(void) {
+
+    WindowRelease();
+
+    return ulHead < ulTail && bLatestKnown &&
+           WindowCovered(WindowGet16(ulHead + 2) + 1, usLatestAck);
+}
+
+/*
+ * Returns true if a record of ulLength bytes can be added without making
+ * room.
+ */
+bool bWindowRoom(uint32_t ulLength) {
+    return (ulTail - ulHead) + WINDOW_ENTRY_HEADER_BYTES + ulLength <=
+           WINDOW_BYTES;
+}
+
+/*
+ * Forgets the acknowledgements of the last connection, whose sequence
+ * numbers no longer apply once every record has been sent again.
+ */
+void vWindowRestart(void) {
+    bLatestKnown = false;
+}
+
+/*
+ * Returns the number of records not yet acknowledged.
+ */
+uint32_t ulWindowCount(void) {
+    uint32_t ulPos = ulHead;
+    uint32_t ulCount = 0;
+    uint16_t usLength;
+
+    while (ulPos < ulTail) {
+        usLength = WindowGet16(ulPos + 4);
+        if (!(usLength & WINDOW_FLAG_ACKED)) {
+            ulCount++;
+        }
+        ulPos += WINDOW_ENTRY_HEADER_BYTES + (usLength & ~WINDOW_FLAG_ACKED);
+    }
+
+    return ulCount;
+}
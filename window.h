@@ -0,0 +1,62 @@
+/*
+ * window.h
+ * Definitions for the upload window, which keeps records sent on the TCP
+ * stream until the server acknowledges them.
+ *
+ * Copyright 2018, 2019 Matt Rounds
+ *
+ * This file is part of ExplorerLink.
+ *
+ * ExplorerLink is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ExplorerLink is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ExplorerLink. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Records are kept in the order they were sent, each with the sequence
+ * numbers of the first and last stream packets (see modem_uart_task.h)
+ * carrying its bytes. A record is released once every one of those packets
+ * has been acknowledged.
+ *
+ * The server acknowledges with "YYYk<cumulative>[,<sequence>...]" in
+ * decimal: every packet up to and including the cumulative sequence number
+ * arrived on this connection, as did each listed packet after it. Listed
+ * packets only release records carried by a single packet. Records sent
+ * before an acknowledged packet but not acknowledged themselves are sent
+ * again on the same connection, and the rest after a reconnect. */
+#define WINDOW_BYTES                    1024
+#define WINDOW_ENTRY_HEADER_BYTES       6
+
+/* Most selectively acknowledged packets in one acknowledgement */
+#define WINDOW_MAX_SELECTIVE            8
+
+
+bool bWindowAdd(const uint8_t *pucRecord, uint32_t ulLength,
+                uint16_t usFirstSeq, uint16_t usLastSeq);
+const uint8_t *pucWindowPeek(uint32_t *pulLength);
+void vWindowDrop(void);
+void vWindowAck(uint16_t usCumulative, const uint16_t *pusSelective,
+                uint32_t ulSelectiveCount);
+bool bWindowMissed(void);
+bool bWindowRoom(uint32_t ulLength);
+void vWindowRestart(void);
+uint32_t ulWindowCount(void);
+
+
+#endif /* WINDOW_H_ */